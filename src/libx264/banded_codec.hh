@@ -0,0 +1,227 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef BANDED_CODEC_HH
+#define BANDED_CODEC_HH
+
+/* Splits every raster into horizontal bands and codes each band with its
+   own single-threaded encoder and decoder, all bands in parallel on the
+   shared thread pool. Each band stays deterministic, so the receiver's
+   resync (a fresh encoder re-encoding a raster) simply happens per band.
+
+   The inner codecs have to keep to one thread, or every band would start
+   threads for every core on top of the pool's: H264_encoder and
+   H264_decoder set libavcodec's thread_count to 1, and X264_encoder sets
+   x264's i_threads and i_lookahead_threads to 1.
+
+   A banded frame is a table of BANDS little-endian 32-bit band lengths,
+   followed by the bands' frames in order. */
+
+#include <endian.h>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include "chunk.hh"
+#include "gop_mode.hh"
+#include "slice_sink.hh"
+#include "thread_pool.hh"
+#include "timeline.hh"
+
+/* rows [first_row, first_row + height) of the picture */
+struct Band
+{
+  size_t first_row;
+  size_t height;
+
+  /* where the band's planes start in an I420 raster of the given size */
+  void planes( const size_t width, const size_t picture_height,
+               const uint8_t * raster, const uint8_t * planes[ 3 ] ) const
+  {
+    const size_t chroma_offset = ( first_row / 2 ) * ( width / 2 );
+
+    planes[ 0 ] = raster + first_row * width;
+    planes[ 1 ] = raster + width * picture_height + chroma_offset;
+    planes[ 2 ] = raster + width * picture_height + ( width * picture_height ) / 4 + chroma_offset;
+  }
+};
+
+/* up to `count` bands of whole macroblock rows, as even as possible */
+inline std::vector<Band> split_bands( const size_t height, const size_t count )
+{
+  const size_t macroblock_rows = ( height + 15 ) / 16;
+  const size_t band_height = 16 * ( ( macroblock_rows + count - 1 ) / count );
+
+  std::vector<Band> bands;
+  for ( size_t row = 0; row < height; row += band_height ) {
+    bands.push_back( { row, std::min( band_height, height - row ) } );
+  }
+
+  return bands;
+}
+
+template <class Inner, size_t BANDS>
+class BandedEncoder
+{
+private:
+  struct BandEncoder
+  {
+    Band band;
+    std::unique_ptr<Inner> encoder;
+    std::vector<uint8_t> output;
+    size_t output_size;
+  };
+
+  const size_t width_;
+  const size_t height_;
+  std::vector<BandEncoder> bands_ {};
+
+public:
+  BandedEncoder( const size_t width, const size_t height, const size_t quantization,
+                 const GopMode gop = GopMode::INFINITE_GOP )
+    : width_( width ), height_( height )
+  {
+    for ( const Band & band : split_bands( height, BANDS ) ) {
+      bands_.push_back( { band, std::make_unique<Inner>( width, band.height, quantization, gop ),
+                          std::vector<uint8_t>( ( width * band.height * 3 ) / 2 ), 0 } );
+    }
+  }
+
+  size_t encode( uint8_t * input, uint8_t * output )
+  {
+    return encode( input, output, q() );
+  }
+
+  size_t encode( uint8_t * input, uint8_t * output, const size_t quantizer )
+  {
+    const int strides[ 3 ] = { int( width_ ), int( width_ / 2 ), int( width_ / 2 ) };
+
+    ThreadPool::shared().parallel_for( bands_.size(),
+      [&]( const size_t i )
+      {
+        TimelineSpan span { "encode band" };
+        span.arg( "band", i );
+
+        BandEncoder & b = bands_[ i ];
+        const uint8_t * planes[ 3 ];
+        b.band.planes( width_, height_, input, planes );
+        b.output_size = b.encoder->encode( planes, strides, b.output.data(), quantizer );
+      } );
+
+    /* band table, then the bands */
+    uint8_t * next = output;
+    for ( const BandEncoder & b : bands_ ) {
+      const uint32_t length = htole32( b.output_size );
+      std::memcpy( next, &length, sizeof( length ) );
+      next += sizeof( length );
+    }
+
+    for ( const BandEncoder & b : bands_ ) {
+      std::memcpy( next, b.output.data(), b.output_size );
+      next += b.output_size;
+    }
+
+    return next - output;
+  }
+
+  /* the bands finish together, so the frame is passed on in one piece */
+  size_t encode( uint8_t * input, uint8_t * output, const SliceSink & sink )
+  {
+    const size_t size = encode( input, output );
+    sink( Chunk( output, size ) );
+    return size;
+  }
+
+  size_t q( void ) const { return bands_.front().encoder->q(); }
+  GopMode gop( void ) const { return bands_.front().encoder->gop(); }
+};
+
+template <class Inner, size_t BANDS>
+class BandedDecoder
+{
+private:
+  struct BandDecoder
+  {
+    Band band;
+    std::unique_ptr<Inner> decoder;
+    std::vector<uint8_t> raster;
+  };
+
+  const size_t width_;
+  const size_t height_;
+  std::vector<BandDecoder> bands_ {};
+  std::vector<uint8_t> parts_ {};
+
+public:
+  BandedDecoder( const size_t width, const size_t height )
+    : width_( width ), height_( height )
+  {
+    for ( const Band & band : split_bands( height, BANDS ) ) {
+      bands_.push_back( { band, std::make_unique<Inner>( width, band.height ),
+                          std::vector<uint8_t>( ( width * band.height * 3 ) / 2 ) } );
+    }
+  }
+
+  void decode( uint8_t * input, size_t length, uint8_t * output )
+  {
+    const Chunk frame { input, length };
+    const size_t table_size = bands_.size() * sizeof( uint32_t );
+
+    std::vector<Chunk> band_frames;
+    size_t offset = table_size;
+    for ( size_t i = 0; i < bands_.size(); i++ ) {
+      const size_t band_length = frame( i * sizeof( uint32_t ), sizeof( uint32_t ) ).le32();
+      band_frames.push_back( frame( offset, band_length ) );
+      offset += band_length;
+    }
+
+    if ( offset != length ) {
+      throw std::runtime_error( "BandedDecoder: band lengths do not add up" );
+    }
+
+    ThreadPool::shared().parallel_for( bands_.size(),
+      [&]( const size_t i )
+      {
+        TimelineSpan span { "decode band" };
+        span.arg( "band", i );
+
+        BandDecoder & b = bands_[ i ];
+        b.decoder->decode( const_cast<uint8_t *>( band_frames[ i ].buffer() ),
+                           band_frames[ i ].size(), b.raster.data() );
+
+        /* the band's rows go straight into each plane of the picture */
+        const uint8_t * planes[ 3 ];
+        b.band.planes( width_, height_, output, planes );
+
+        const size_t luma_size = width_ * b.band.height;
+        std::memcpy( const_cast<uint8_t *>( planes[ 0 ] ), b.raster.data(), luma_size );
+        std::memcpy( const_cast<uint8_t *>( planes[ 1 ] ), b.raster.data() + luma_size, luma_size / 4 );
+        std::memcpy( const_cast<uint8_t *>( planes[ 2 ] ), b.raster.data() + luma_size + luma_size / 4,
+                     luma_size / 4 );
+      } );
+  }
+
+  /* bands cannot be decoded before their whole frame is in */
+  void decode_part( const uint8_t * part, size_t length )
+  {
+    parts_.insert( parts_.end(), part, part + length );
+  }
+
+  void finish_frame( uint8_t * output )
+  {
+    decode( parts_.data(), parts_.size(), output );
+    parts_.clear();
+  }
+
+  void reset( void )
+  {
+    for ( auto & b : bands_ ) {
+      b.decoder->reset();
+    }
+
+    parts_.clear();
+  }
+};
+
+#endif /* BANDED_CODEC_HH */
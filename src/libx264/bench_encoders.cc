@@ -0,0 +1,126 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* compares the libavcodec and native libx264 encoder backends: per-frame
+   encode time on a warmed encoder, the cost of a resync (fresh encoder plus
+   one frame), and whether both produce the same bits. Also shows how soon
+   the native encoder hands over the first slice of a frame, which is when
+   streaming can start sending it. */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+
+#include "salsify_protocol.hh"
+#include "h264_encoder.hh"
+#include "x264_encoder.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+constexpr uint16_t width = 1280;
+constexpr uint16_t height = 720;
+constexpr uint32_t frame_size = ( width * height * 3 ) / 2;
+
+void usage()
+{
+  cerr << "bench_encoders <quantizer> <input.raw> [max-frames]" << endl;
+}
+
+struct Timer
+{
+  double total_ms { 0 };
+
+  template <class Function>
+  auto time( Function && f ) -> decltype( f() )
+  {
+    const auto start = steady_clock::now();
+    auto result = f();
+    total_ms += duration<double, milli>( steady_clock::now() - start ).count();
+    return result;
+  }
+};
+
+int main( int argc, char const * argv[] )
+{
+  if ( argc != 3 and argc != 4 ) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  const size_t quantizer = stoul( argv[ 1 ] );
+  const size_t max_frames = ( argc == 4 ) ? stoul( argv[ 3 ] ) : 600;
+
+  /* load the rasters up front so I/O stays out of the measurements */
+  ifstream input_fin { argv[ 2 ] };
+  vector<Raster> rasters;
+  Raster raster( frame_size );
+  while ( rasters.size() < max_frames
+          and input_fin.read( reinterpret_cast<char *>( raster.data() ), frame_size ) ) {
+    rasters.push_back( raster );
+  }
+
+  if ( rasters.empty() ) {
+    cerr << "no frames in input" << endl;
+    return EXIT_FAILURE;
+  }
+
+  H264_encoder avcodec_encoder { width, height, quantizer };
+  X264_encoder native_encoder { width, height, quantizer };
+  Frame avcodec_frame( frame_size );
+
+  Timer avcodec_encode, native_encode, avcodec_resync, native_resync;
+  double first_slice_ms = 0;
+  size_t stream_mismatches = 0, resync_mismatches = 0;
+
+  for ( Raster & r : rasters ) {
+    /* steady state: one long-lived encoder per backend */
+    const size_t avcodec_size = avcodec_encode.time( [&]() {
+        return avcodec_encoder.encode( r.data(), avcodec_frame.data() ); } );
+    const auto start = steady_clock::now();
+    bool first_slice = true;
+    const Chunk native_frame = native_encode.time( [&]() {
+        return native_encoder.encode( r.data(), [&]( const Chunk & ) {
+            if ( first_slice ) {
+              first_slice_ms += duration<double, milli>( steady_clock::now() - start ).count();
+              first_slice = false;
+            }
+          } ); } );
+
+    if ( native_frame.size() != avcodec_size
+         or memcmp( native_frame.buffer(), avcodec_frame.data(), avcodec_size ) ) {
+      stream_mismatches++;
+    }
+
+    /* what the receiver does on a switch: fresh encoder, one frame */
+    const size_t avcodec_resync_size = avcodec_resync.time( [&]() {
+        H264_encoder encoder { width, height, quantizer };
+        return encoder.encode( r.data(), avcodec_frame.data() ); } );
+
+    const bool resync_match = native_resync.time( [&]() {
+        X264_encoder encoder { width, height, quantizer };
+        const Chunk frame = encoder.encode( r.data() );
+        return frame.size() == avcodec_resync_size
+               and not memcmp( frame.buffer(), avcodec_frame.data(), frame.size() ); } );
+
+    if ( not resync_match ) {
+      resync_mismatches++;
+    }
+  }
+
+  const double n = rasters.size();
+  cout << "frames: " << rasters.size() << endl
+       << "encode (ms/frame): libavcodec " << avcodec_encode.total_ms / n
+       << ", native " << native_encode.total_ms / n
+       << ", overhead " << ( avcodec_encode.total_ms - native_encode.total_ms ) / n << endl
+       << "first slice ready (ms/frame): native " << first_slice_ms / n << endl
+       << "resync (ms/frame): libavcodec " << avcodec_resync.total_ms / n
+       << ", native " << native_resync.total_ms / n << endl
+       << "frames with different bits: stream " << stream_mismatches
+       << ", resync " << resync_mismatches << endl;
+
+  return ( stream_mismatches or resync_mismatches ) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
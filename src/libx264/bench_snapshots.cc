@@ -0,0 +1,136 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* compares two ways for the sender to carry every quality forward after a
+   frame: what SalsifySender does (one encoder per quality, losers rebuilt
+   by a fresh encoder re-encoding a raster) and ForkedEncoder (losers
+   replaced by fork()ed copies of the winner). The winner is the high
+   quality, except for every <switch-every>th frame. */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#include "salsify_protocol.hh"
+#include "codec_backend.hh"
+#include "forked_encoder.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+constexpr uint16_t width = 1280;
+constexpr uint16_t height = 720;
+constexpr uint32_t frame_size = ( width * height * 3 ) / 2;
+
+typedef H264Backend Backend;
+
+void usage()
+{
+  cerr << "bench_snapshots <input.raw> [max-frames] [switch-every]" << endl;
+}
+
+struct Timer
+{
+  double total_ms { 0 };
+
+  template <class Function>
+  void time( Function && f )
+  {
+    const auto start = steady_clock::now();
+    f();
+    total_ms += duration<double, milli>( steady_clock::now() - start ).count();
+  }
+};
+
+int main( int argc, char const * argv[] )
+{
+  if ( argc < 2 or argc > 4 ) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  const size_t max_frames = ( argc >= 3 ) ? stoul( argv[ 2 ] ) : 600;
+  const size_t switch_every = ( argc == 4 ) ? stoul( argv[ 3 ] ) : 10;
+
+  if ( switch_every == 0 ) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  const vector<size_t> qualities { Backend::HIGH_QUALITY, Backend::LOW_QUALITY };
+
+  /* fork while the program is still single-threaded (which the
+     ForkedEncoder checks, along with H264_encoder keeping to one thread) */
+  ForkedEncoder<Backend::Encoder> forked { width, height, qualities };
+
+  /* load the rasters up front so I/O stays out of the measurements */
+  ifstream input_fin { argv[ 1 ] };
+  vector<Raster> rasters;
+  Raster raster( frame_size );
+  while ( rasters.size() < max_frames
+          and input_fin.read( reinterpret_cast<char *>( raster.data() ), frame_size ) ) {
+    rasters.push_back( raster );
+  }
+
+  if ( rasters.empty() ) {
+    cerr << "no frames in input" << endl;
+    return EXIT_FAILURE;
+  }
+
+  vector<unique_ptr<Backend::Encoder>> encoders;
+  vector<Frame> outputs;
+  for ( const size_t q : qualities ) {
+    encoders.emplace_back( new Backend::Encoder( width, height, q ) );
+    outputs.emplace_back( frame_size );
+  }
+
+  Timer rebuild_encode, rebuild, forked_encode, forked_commit;
+  vector<size_t> rebuild_bytes( qualities.size() ), forked_bytes( qualities.size() );
+
+  for ( size_t frame_no = 0; frame_no < rasters.size(); frame_no++ ) {
+    Raster & r = rasters[ frame_no ];
+    const size_t winner = ( frame_no % switch_every == switch_every - 1 ) ? 1 : 0;
+
+    /* current approach */
+    rebuild_encode.time( [&]() {
+        for ( size_t i = 0; i < encoders.size(); i++ ) {
+          rebuild_bytes[ i ] += encoders[ i ]->encode( r.data(), outputs[ i ].data() );
+        } } );
+
+    rebuild.time( [&]() {
+        for ( size_t i = 0; i < encoders.size(); i++ ) {
+          if ( i != winner ) {
+            encoders[ i ].reset( new Backend::Encoder( width, height, qualities[ i ] ) );
+            encoders[ i ]->encode( r.data(), outputs[ i ].data() );
+          }
+        } } );
+
+    /* forked snapshots */
+    forked_encode.time( [&]() { forked.branch( r.data() ); } );
+
+    for ( size_t i = 0; i < qualities.size(); i++ ) {
+      forked_bytes[ i ] += forked.frame( i ).size();
+    }
+
+    forked_commit.time( [&]() { forked.commit( winner ); } );
+  }
+
+  const double n = rasters.size();
+  cout << "frames: " << rasters.size() << ", switching every " << switch_every << endl
+       << "rebuild (ms/frame): encode " << rebuild_encode.total_ms / n
+       << ", rebuild losers " << rebuild.total_ms / n
+       << ", total " << ( rebuild_encode.total_ms + rebuild.total_ms ) / n << endl
+       << "forked (ms/frame): branch " << forked_encode.total_ms / n
+       << ", commit " << forked_commit.total_ms / n
+       << ", total " << ( forked_encode.total_ms + forked_commit.total_ms ) / n << endl;
+
+  for ( size_t i = 0; i < qualities.size(); i++ ) {
+    cout << "q=" << qualities[ i ] << " (bytes/frame): rebuild " << rebuild_bytes[ i ] / n
+         << ", forked " << forked_bytes[ i ] / n << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef CODEC_BACKEND_HH
+#define CODEC_BACKEND_HH
+
+#include <string>
+#include <stdexcept>
+
+#include "h264_encoder.hh"
+#include "h264_decoder.hh"
+#include "x264_encoder.hh"
+#include "vp8_encoder.hh"
+#include "vp8_decoder.hh"
+#include "banded_codec.hh"
+
+/* the tools that pick a backend take it as an option */
+#include "args.hh"
+
+/* A backend names the codec pair SalsifySender and SalsifyReceiver are
+   instantiated with. It is a policy rather than an interface so that the
+   per-frame calls are not virtual. A backend provides:
+
+     Encoder, constructible from ( width, height, quantizer, GopMode ), with
+       size_t encode( uint8_t * raster, uint8_t * output )
+       size_t encode( uint8_t * raster, uint8_t * output, size_t quantizer )
+       size_t encode( uint8_t * raster, uint8_t * output, const SliceSink & sink )
+       size_t q() const
+     and producing the same bits from the same rasters every time it is
+     constructed (the receiver depends on that to resync);
+
+     Decoder, constructible from ( width, height ), with
+       void decode( uint8_t * frame, size_t length, uint8_t * raster )
+       void decode_part( const uint8_t * part, size_t length )
+       void finish_frame( uint8_t * raster )
+       void reset()   (start over as if newly constructed)
+
+     name(), the quantizers of the HIGH_QUALITY and LOW_QUALITY streams on
+     the codec's own scale, ANNEX_B: whether frames are H.264 byte
+     streams (which SalsifySender can splice, see h264_splicer.hh), and
+     USES_THREAD_POOL: whether the codec spreads a frame over
+     ThreadPool::shared(). */
+
+struct H264Backend
+{
+  typedef H264_encoder Encoder;
+  typedef H264_decoder Decoder;
+
+  static constexpr size_t HIGH_QUALITY = 16;
+  static constexpr size_t LOW_QUALITY = 48;
+  static constexpr bool ANNEX_B = true;
+  static constexpr bool USES_THREAD_POOL = false;
+
+  static const char * name( void ) { return "h264"; }
+};
+
+/* libx264 without libavcodec in between; decodes like H264Backend */
+struct X264Backend
+{
+  typedef X264_encoder Encoder;
+  typedef H264_decoder Decoder;
+
+  static constexpr size_t HIGH_QUALITY = H264Backend::HIGH_QUALITY;
+  static constexpr size_t LOW_QUALITY = H264Backend::LOW_QUALITY;
+  static constexpr bool ANNEX_B = true;
+  static constexpr bool USES_THREAD_POOL = false;
+
+  static const char * name( void ) { return "x264"; }
+};
+
+struct VP8Backend
+{
+  typedef VP8_encoder Encoder;
+  typedef VP8_decoder Decoder;
+
+  static constexpr size_t HIGH_QUALITY = 10;
+  static constexpr size_t LOW_QUALITY = 56;
+  static constexpr bool ANNEX_B = false;
+  static constexpr bool USES_THREAD_POOL = false;
+
+  static const char * name( void ) { return "vp8"; }
+};
+
+/* an inner backend split into horizontal bands that are coded in parallel */
+template <class InnerBackend, size_t BANDS>
+struct BandedBackend
+{
+  typedef BandedEncoder<typename InnerBackend::Encoder, BANDS> Encoder;
+  typedef BandedDecoder<typename InnerBackend::Decoder, BANDS> Decoder;
+
+  static constexpr size_t HIGH_QUALITY = InnerBackend::HIGH_QUALITY;
+  static constexpr size_t LOW_QUALITY = InnerBackend::LOW_QUALITY;
+
+  /* the bands are framed by BandedEncoder, and coded on the shared pool */
+  static constexpr bool ANNEX_B = false;
+  static constexpr bool USES_THREAD_POOL = true;
+
+  static std::string name( void ) { return InnerBackend::name() + std::string( "-bands" ); }
+};
+
+constexpr size_t BANDS_PER_FRAME = 4;
+
+typedef BandedBackend<H264Backend, BANDS_PER_FRAME> BandedH264Backend;
+typedef BandedBackend<X264Backend, BANDS_PER_FRAME> BandedX264Backend;
+
+constexpr const char * BACKEND_NAMES = "h264, x264, vp8, h264-bands, x264-bands";
+
+/* call f( Backend() ) for the backend with the given name */
+template <class Function>
+auto with_backend( const std::string & name, Function && f ) -> decltype( f( H264Backend() ) )
+{
+  if ( name == H264Backend::name() ) {
+    return f( H264Backend() );
+  }
+  else if ( name == X264Backend::name() ) {
+    return f( X264Backend() );
+  }
+  else if ( name == VP8Backend::name() ) {
+    return f( VP8Backend() );
+  }
+  else if ( name == BandedH264Backend::name() ) {
+    return f( BandedH264Backend() );
+  }
+  else if ( name == BandedX264Backend::name() ) {
+    return f( BandedX264Backend() );
+  }
+
+  throw std::runtime_error( "unknown codec backend: " + name );
+}
+
+#endif /* CODEC_BACKEND_HH */
@@ -0,0 +1,97 @@
+#include <cerrno>
+#include <memory>
+#include <sys/stat.h>
+
+#include "encode_cache.hh"
+#include "exception.hh"
+
+namespace {
+
+std::unique_ptr<EncodeCache> active_cache;
+
+std::string make_directory(const std::string &directory){
+    if(mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST){
+        throw unix_error("mkdir " + directory);
+    }
+    return directory;
+}
+
+}
+
+
+EncodeCache::EncodeCache(const std::string &directory) :
+    frames(make_directory(directory) + "/frames"),
+    rasters(directory + "/rasters"),
+    hits(0),
+    misses(0),
+    replays(0),
+    miss_us(0)
+{
+}
+
+
+EncodeCache *EncodeCache::active(){
+    return active_cache.get();
+}
+
+
+void EncodeCache::activate(const std::string &directory){
+    active_cache.reset(new EncodeCache(directory));
+}
+
+
+bool EncodeCache::get_frame(uint64_t key, std::vector<uint8_t> &frame) const{
+    return frames.get(key, frame);
+}
+
+
+void EncodeCache::put_frame(uint64_t key, const uint8_t *frame, size_t size){
+    frames.put(key, Chunk(frame, size));
+}
+
+
+bool EncodeCache::has_raster(uint64_t hash) const{
+    return rasters.contains(hash);
+}
+
+
+bool EncodeCache::get_raster(uint64_t hash, std::vector<uint8_t> &raster) const{
+    return rasters.get(hash, raster);
+}
+
+
+void EncodeCache::put_raster(uint64_t hash, const uint8_t *raster, size_t size){
+    rasters.put(hash, Chunk(raster, size));
+}
+
+
+void EncodeCache::record_hit(){
+    hits++;
+}
+
+
+void EncodeCache::record_miss(double encode_ms){
+    misses++;
+    miss_us += uint64_t(encode_ms * 1000);
+}
+
+
+void EncodeCache::record_replay(){
+    replays++;
+}
+
+
+void EncodeCache::print_stats(std::ostream &out) const{
+    const size_t lookups = hits + misses;
+    if(lookups == 0){
+        return;
+    }
+
+    // a hit saves a typical encode, unless a later miss had to replay it
+    const double ms_per_encode = misses ? miss_us / 1000.0 / misses : 0.0;
+    const double saved_ms = (double(hits) - double(replays)) * ms_per_encode;
+
+    out << "encode cache: " << hits << " hits / " << lookups << " lookups ("
+        << 100.0 * hits / lookups << "%), " << replays << " replayed, "
+        << "about " << saved_ms / 1000.0 << " s of encoding saved\n";
+}
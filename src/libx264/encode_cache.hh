@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "blob_store.hh"
+
+// An on-disk cache of encoded frames, for experiments that encode the same
+// rasters over and over. A frame is keyed by a hash of the encoder's
+// configuration, every input the encoder has seen since it was built (its
+// lineage) and the raster itself, so a hit is exactly the frame the encoder
+// would have produced. Rasters are kept too, by content: an encoder that
+// skipped frames on hits has to feed them to the codec after all on its
+// first miss, to catch its state up.
+class EncodeCache{
+public:
+    // keeps its stores in the given directory, which is created if needed
+    explicit EncodeCache(const std::string &directory);
+
+    // the cache encoders consult, if one was activated
+    static EncodeCache *active();
+    static void activate(const std::string &directory);
+
+    bool get_frame(uint64_t key, std::vector<uint8_t> &frame) const;
+    void put_frame(uint64_t key, const uint8_t *frame, size_t size);
+
+    bool has_raster(uint64_t hash) const;
+    bool get_raster(uint64_t hash, std::vector<uint8_t> &raster) const;
+    void put_raster(uint64_t hash, const uint8_t *raster, size_t size);
+
+    void record_hit();
+    void record_miss(double encode_ms);
+    void record_replay();
+
+    // hit rate, and the encode time hits saved (net of catching up)
+    void print_stats(std::ostream &out) const;
+
+private:
+    BlobStore frames;
+    BlobStore rasters;
+
+    std::atomic<size_t> hits;
+    std::atomic<size_t> misses;
+    std::atomic<size_t> replays;
+    std::atomic<uint64_t> miss_us;
+};
@@ -0,0 +1,328 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FORKED_ENCODER_HH
+#define FORKED_ENCODER_HH
+
+/* Experimental: branches an encoder's state with fork() instead of
+   rebuilding it.
+
+   The warmed encoder lives in a separate "state process". To encode the
+   next raster, the state process forks one child per quality; each child
+   holds a copy-on-write copy of the encoder, encodes the raster at its
+   quality and hands the bits over in shared memory. commit() keeps the
+   winning child, which becomes the new state process, and ends all others.
+   Every quality therefore continues from the real state of the stream,
+   with no resync encode and no encoder initialization.
+
+   The caller becomes a child subreaper, so that it inherits (and reaps)
+   the state processes even though each one is forked by the previous one.
+   fork() only copies the calling thread, so the encoder must not use
+   threads of its own, and the program must be single-threaded when the
+   ForkedEncoder is constructed. The constructor checks both: it fails if
+   the program has other threads, or if the state process has more than
+   one once the encoder is built (H264_encoder pins libavcodec to one
+   thread for this, among other reasons). */
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+#include "chunk.hh"
+#include "gop_mode.hh"
+#include "exception.hh"
+#include "mmap_region.hh"
+#include "child_process.hh"
+#include "file_descriptor.hh"
+
+template <class Encoder>
+class ForkedEncoder
+{
+private:
+  struct Pipe
+  {
+    FileDescriptor read_end;
+    FileDescriptor write_end;
+
+    static Pipe make( void )
+    {
+      int fds[ 2 ];
+      SystemCall( "pipe", pipe( fds ) );
+      return { fds[ 0 ], fds[ 1 ] };
+    }
+  };
+
+  /* closes the descriptor (the temporary takes it over) */
+  static void close_end( FileDescriptor & fd )
+  {
+    FileDescriptor closing( std::move( fd ) );
+  }
+
+  /* the calling process's threads */
+  static size_t thread_count( void )
+  {
+    DIR * const tasks = opendir( "/proc/self/task" );
+    if ( not tasks ) {
+      throw unix_error( "opendir /proc/self/task" );
+    }
+
+    /* one entry per thread, besides . and .. */
+    size_t count = 0;
+    while ( const dirent * entry = readdir( tasks ) ) {
+      if ( entry->d_name[ 0 ] != '.' ) {
+        count++;
+      }
+    }
+
+    closedir( tasks );
+    return count;
+  }
+
+  /* one-byte messages */
+  static constexpr char BRANCH = 'b', QUIT = 'q', READY = 'r';
+  static constexpr char WINNER = 'w', LOSER = 'l';
+
+  /* what each branch leaves in the shared region, ahead of its frame */
+  struct BranchHeader
+  {
+    uint64_t frame_size;
+    pid_t pid;
+  };
+
+  const size_t raster_size_;
+  const std::vector<size_t> qualities_;
+
+  MMap_Region shared_;
+
+  Pipe commands_;
+  Pipe done_;
+  std::vector<Pipe> decisions_ {};
+
+  std::unique_ptr<ChildProcess> first_state_process_ {};
+
+  /* the state process, and the one it replaced, which is about to exit */
+  pid_t state_process_ { 0 };
+  pid_t retired_state_process_ { 0 };
+
+  bool branched_ { false };
+
+  /* the raster, then one header and frame per quality, each 8-byte aligned */
+  static size_t aligned( const size_t size ) { return ( size + 7 ) & ~size_t( 7 ); }
+  size_t branch_stride( void ) const { return sizeof( BranchHeader ) + aligned( raster_size_ ); }
+
+  uint8_t * raster( void ) const { return shared_.addr(); }
+
+  BranchHeader & branch_header( const size_t index ) const
+  {
+    return *reinterpret_cast<BranchHeader *>( shared_.addr() + aligned( raster_size_ )
+                                              + index * branch_stride() );
+  }
+
+  uint8_t * branch_frame( const size_t index ) const
+  {
+    return reinterpret_cast<uint8_t *>( &branch_header( index ) + 1 );
+  }
+
+  /* the state process's loop; returns its exit status */
+  int hold( Encoder & encoder )
+  {
+    char message;
+
+    while ( true ) {
+      commands_.read_end.read_exactly( &message, 1 );
+      if ( message == QUIT ) {
+        return EXIT_SUCCESS;
+      }
+
+      size_t branch = qualities_.size();
+      for ( size_t i = 0; i < qualities_.size(); i++ ) {
+        if ( SystemCall( "fork", fork() ) == 0 ) {
+          branch = i;
+          break;
+        }
+      }
+
+      if ( branch == qualities_.size() ) {
+        /* the state has moved on to the winner; leave once the others are gone */
+        for ( size_t i = 1; i < qualities_.size(); i++ ) {
+          SystemCall( "wait", wait( nullptr ) );
+        }
+
+        return EXIT_SUCCESS;
+      }
+
+      BranchHeader & header = branch_header( branch );
+      header.pid = getpid();
+      header.frame_size = encoder.encode( raster(), branch_frame( branch ), qualities_[ branch ] );
+      done_.write_end.write( std::string( 1, char( branch ) ) );
+
+      decisions_[ branch ].read_end.read_exactly( &message, 1 );
+      if ( message != WINNER ) {
+        return EXIT_SUCCESS;
+      }
+
+      /* this branch is the state process now */
+    }
+  }
+
+  void reap( const pid_t pid )
+  {
+    if ( pid == 0 ) {
+      return;
+    }
+
+    if ( pid == first_state_process_->pid() ) {
+      while ( not first_state_process_->terminated() ) {
+        first_state_process_->wait();
+      }
+    }
+    else {
+      SystemCall( "waitpid", waitpid( pid, nullptr, 0 ) );
+    }
+  }
+
+public:
+  ForkedEncoder( const size_t width, const size_t height,
+                 const std::vector<size_t> & qualities,
+                 const GopMode gop = GopMode::INFINITE_GOP )
+    : raster_size_( ( width * height * 3 ) / 2 ),
+      qualities_( qualities ),
+      shared_( aligned( raster_size_ ) + qualities.size() * branch_stride(),
+               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1 ),
+      commands_( Pipe::make() ),
+      done_( Pipe::make() )
+  {
+    if ( qualities_.empty() ) {
+      throw std::runtime_error( "ForkedEncoder: at least one quality is required" );
+    }
+
+    for ( size_t i = 0; i < qualities_.size(); i++ ) {
+      decisions_.push_back( Pipe::make() );
+    }
+
+    if ( thread_count() != 1 ) {
+      throw std::runtime_error( "ForkedEncoder: the program must be single-threaded" );
+    }
+
+    SystemCall( "prctl", prctl( PR_SET_CHILD_SUBREAPER, 1 ) );
+
+    first_state_process_.reset( new ChildProcess( "encoder state",
+      [&]()
+      {
+        /* keep only the ends the state processes use, so that either side
+           sees end-of-file when the other is gone */
+        close_end( commands_.write_end );
+        close_end( done_.read_end );
+        for ( auto & decision : decisions_ ) {
+          close_end( decision.write_end );
+        }
+
+        Encoder encoder( width, height, qualities_.front(), gop );
+
+        /* a thread of the encoder's would be missing from every branch */
+        if ( thread_count() != 1 ) {
+          throw std::runtime_error( "ForkedEncoder: the encoder started threads of its own" );
+        }
+
+        done_.write_end.write( std::string( 1, READY ) );
+        return hold( encoder );
+      } ) );
+
+    state_process_ = first_state_process_->pid();
+
+    close_end( commands_.read_end );
+    close_end( done_.write_end );
+    for ( auto & decision : decisions_ ) {
+      close_end( decision.read_end );
+    }
+
+    /* the state process exits before this if its encoder is not usable */
+    char ready;
+    if ( done_.read_end.read( &ready, 1 ) != 1 ) {
+      throw std::runtime_error( "ForkedEncoder: the encoder state process failed to start" );
+    }
+  }
+
+  ~ForkedEncoder()
+  {
+    try {
+      if ( branched_ ) {
+        commit( 0 );
+      }
+
+      /* as in branch(), the state process must outlive the previous one */
+      reap( retired_state_process_ );
+      commands_.write_end.write( std::string( 1, QUIT ) );
+      reap( state_process_ );
+    } catch ( const std::exception & e ) {
+      print_exception( "ForkedEncoder", e );
+    }
+  }
+
+  /* ban copying */
+  ForkedEncoder( const ForkedEncoder & other ) = delete;
+  ForkedEncoder & operator=( const ForkedEncoder & other ) = delete;
+
+  /* encode the raster at every quality, each from the current state */
+  void branch( const uint8_t * input )
+  {
+    if ( branched_ ) {
+      throw std::runtime_error( "ForkedEncoder: the last branch was not committed" );
+    }
+
+    /* the previous state process exits once the last losers are gone, and
+       none of them may still be waiting for a decision when the new branches
+       ask for theirs; it has usually had a whole frame to get there */
+    reap( retired_state_process_ );
+    retired_state_process_ = 0;
+
+    std::memcpy( raster(), input, raster_size_ );
+    commands_.write_end.write( std::string( 1, BRANCH ) );
+
+    char done;
+    for ( size_t i = 0; i < qualities_.size(); i++ ) {
+      done_.read_end.read_exactly( &done, 1 );
+    }
+
+    branched_ = true;
+  }
+
+  /* valid until the next branch() */
+  Chunk frame( const size_t index ) const
+  {
+    return { branch_frame( index ), branch_header( index ).frame_size };
+  }
+
+  size_t quality_count( void ) const { return qualities_.size(); }
+  size_t quantizer( const size_t index ) const { return qualities_.at( index ); }
+
+  /* continue from the state the given quality left behind */
+  void commit( const size_t winner )
+  {
+    if ( not branched_ ) {
+      throw std::runtime_error( "ForkedEncoder: nothing to commit" );
+    }
+
+    if ( winner >= qualities_.size() ) {
+      throw std::out_of_range( "ForkedEncoder: no such quality" );
+    }
+
+    for ( size_t i = 0; i < qualities_.size(); i++ ) {
+      decisions_[ i ].write_end.write( std::string( 1, i == winner ? WINNER : LOSER ) );
+    }
+
+    retired_state_process_ = state_process_;
+    state_process_ = branch_header( winner ).pid;
+
+    branched_ = false;
+  }
+};
+
+#endif /* FORKED_ENCODER_HH */
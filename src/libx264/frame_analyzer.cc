@@ -0,0 +1,220 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cstring>
+#include <algorithm>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#include "frame_analyzer.hh"
+
+using namespace std;
+
+namespace {
+
+uint32_t block_sad_scalar( const uint8_t * a, const uint8_t * b, const size_t stride,
+                           const size_t width, const size_t height )
+{
+  uint32_t sad = 0;
+
+  for ( size_t row = 0; row < height; row++ ) {
+    for ( size_t i = 0; i < width; i++ ) {
+      sad += abs( a[ row * stride + i ] - b[ row * stride + i ] );
+    }
+  }
+
+  return sad;
+}
+
+/* sum and sum of squares of the pixels of a block */
+void block_moments_scalar( const uint8_t * a, const size_t stride,
+                           const size_t width, const size_t height,
+                           uint32_t & sum, uint32_t & sum_sq )
+{
+  sum = 0;
+  sum_sq = 0;
+
+  for ( size_t row = 0; row < height; row++ ) {
+    for ( size_t i = 0; i < width; i++ ) {
+      const uint32_t pixel = a[ row * stride + i ];
+      sum += pixel;
+      sum_sq += pixel * pixel;
+    }
+  }
+}
+
+#if defined( __SSE2__ )
+
+uint32_t sad_16x16( const uint8_t * a, const uint8_t * b, const size_t stride )
+{
+  __m128i acc = _mm_setzero_si128();
+
+  for ( size_t row = 0; row < 16; row++ ) {
+    const __m128i va = _mm_loadu_si128( reinterpret_cast<const __m128i *>( a + row * stride ) );
+    const __m128i vb = _mm_loadu_si128( reinterpret_cast<const __m128i *>( b + row * stride ) );
+    acc = _mm_add_epi64( acc, _mm_sad_epu8( va, vb ) );
+  }
+
+  return _mm_cvtsi128_si32( acc ) + _mm_cvtsi128_si32( _mm_srli_si128( acc, 8 ) );
+}
+
+/* two rows of 8 per register */
+uint32_t sad_8x8( const uint8_t * a, const uint8_t * b, const size_t stride )
+{
+  __m128i acc = _mm_setzero_si128();
+
+  for ( size_t row = 0; row < 8; row += 2 ) {
+    const __m128i va = _mm_unpacklo_epi64(
+      _mm_loadl_epi64( reinterpret_cast<const __m128i *>( a + row * stride ) ),
+      _mm_loadl_epi64( reinterpret_cast<const __m128i *>( a + ( row + 1 ) * stride ) ) );
+    const __m128i vb = _mm_unpacklo_epi64(
+      _mm_loadl_epi64( reinterpret_cast<const __m128i *>( b + row * stride ) ),
+      _mm_loadl_epi64( reinterpret_cast<const __m128i *>( b + ( row + 1 ) * stride ) ) );
+    acc = _mm_add_epi64( acc, _mm_sad_epu8( va, vb ) );
+  }
+
+  return _mm_cvtsi128_si32( acc ) + _mm_cvtsi128_si32( _mm_srli_si128( acc, 8 ) );
+}
+
+/* a lane of _mm_madd_epi16 gets at most 2 * 255^2 per row and half, so
+   32-bit lanes hold the 32 of them in a macroblock easily */
+void moments_16x16( const uint8_t * a, const size_t stride, uint32_t & sum, uint32_t & sum_sq )
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sums = zero;
+  __m128i squares = zero;
+
+  for ( size_t row = 0; row < 16; row++ ) {
+    const __m128i va = _mm_loadu_si128( reinterpret_cast<const __m128i *>( a + row * stride ) );
+    const __m128i lo = _mm_unpacklo_epi8( va, zero );
+    const __m128i hi = _mm_unpackhi_epi8( va, zero );
+
+    sums = _mm_add_epi64( sums, _mm_sad_epu8( va, zero ) );
+    squares = _mm_add_epi32( squares, _mm_madd_epi16( lo, lo ) );
+    squares = _mm_add_epi32( squares, _mm_madd_epi16( hi, hi ) );
+  }
+
+  uint32_t lanes[ 4 ];
+  _mm_storeu_si128( reinterpret_cast<__m128i *>( lanes ), squares );
+
+  sum = _mm_cvtsi128_si32( sums ) + _mm_cvtsi128_si32( _mm_srli_si128( sums, 8 ) );
+  sum_sq = lanes[ 0 ] + lanes[ 1 ] + lanes[ 2 ] + lanes[ 3 ];
+}
+
+#endif
+
+uint32_t block_sad( const uint8_t * a, const uint8_t * b, const size_t stride,
+                    const size_t width, const size_t height, const size_t size )
+{
+#if defined( __SSE2__ )
+  if ( width == size and height == size ) {
+    return ( size == 16 ) ? sad_16x16( a, b, stride ) : sad_8x8( a, b, stride );
+  }
+#endif
+
+  return block_sad_scalar( a, b, stride, width, height );
+}
+
+void block_moments( const uint8_t * a, const size_t stride,
+                    const size_t width, const size_t height,
+                    uint32_t & sum, uint32_t & sum_sq )
+{
+#if defined( __SSE2__ )
+  if ( width == 16 and height == 16 ) {
+    moments_16x16( a, stride, sum, sum_sq );
+    return;
+  }
+#endif
+
+  block_moments_scalar( a, stride, width, height, sum, sum_sq );
+}
+
+}
+
+FrameAnalyzer::FrameAnalyzer( const uint16_t width, const uint16_t height,
+                              const uint32_t block_threshold )
+  : width_( width ), height_( height ), block_threshold_( block_threshold ),
+    reference_( ( width * height * 3 ) / 2 )
+{}
+
+FrameActivity FrameAnalyzer::analyze( const uint8_t * raster ) const
+{
+  FrameActivity activity;
+  activity.has_reference = has_reference_;
+
+  const size_t chroma_width = width_ / 2;
+  const size_t chroma_height = height_ / 2;
+
+  const size_t offsets[ 3 ] = { 0, size_t( width_ ) * height_,
+                                size_t( width_ ) * height_ + chroma_width * chroma_height };
+
+  const uint8_t * const planes[ 3 ] = {
+    raster + offsets[ 0 ], raster + offsets[ 1 ], raster + offsets[ 2 ] };
+  const uint8_t * const reference[ 3 ] = {
+    reference_.data() + offsets[ 0 ], reference_.data() + offsets[ 1 ], reference_.data() + offsets[ 2 ] };
+
+  double variance = 0;
+
+  for ( size_t y = 0; y < height_; y += 16 ) {
+    for ( size_t x = 0; x < width_; x += 16 ) {
+      const size_t block_width = min<size_t>( 16, width_ - x );
+      const size_t block_height = min<size_t>( 16, height_ - y );
+      const size_t luma = y * width_ + x;
+
+      uint32_t sum, sum_sq;
+      block_moments( planes[ 0 ] + luma, width_, block_width, block_height, sum, sum_sq );
+
+      const double pixels = block_width * block_height;
+      variance += ( sum_sq - double( sum ) * sum / pixels ) / pixels;
+      activity.blocks++;
+
+      if ( not has_reference_ ) {
+        continue;
+      }
+
+      const size_t chroma = ( y / 2 ) * chroma_width + x / 2;
+      const size_t chroma_block_width = min<size_t>( 8, chroma_width - x / 2 );
+      const size_t chroma_block_height = min<size_t>( 8, chroma_height - y / 2 );
+
+      const uint32_t sad =
+        block_sad( planes[ 0 ] + luma, reference[ 0 ] + luma, width_, block_width, block_height, 16 )
+        + block_sad( planes[ 1 ] + chroma, reference[ 1 ] + chroma, chroma_width,
+                     chroma_block_width, chroma_block_height, 8 )
+        + block_sad( planes[ 2 ] + chroma, reference[ 2 ] + chroma, chroma_width,
+                     chroma_block_width, chroma_block_height, 8 );
+
+      activity.sad += sad;
+      activity.max_block_sad = max( activity.max_block_sad, sad );
+      activity.changed_blocks += ( sad > block_threshold_ );
+    }
+  }
+
+  activity.variance = activity.blocks ? variance / activity.blocks : 0;
+  return activity;
+}
+
+void FrameAnalyzer::set_reference( const uint8_t * raster )
+{
+  memcpy( reference_.data(), raster, reference_.size() );
+  has_reference_ = true;
+}
+
+void ActivitySummary::add( const FrameActivity & activity )
+{
+  frames++;
+  static_frames += activity.is_static();
+  changed_fraction += activity.changed_fraction();
+  variance += activity.variance;
+}
+
+void ActivitySummary::print( ostream & out ) const
+{
+  if ( frames == 0 ) {
+    return;
+  }
+
+  out << "static frames: " << static_frames << " of " << frames
+      << ", changed macroblocks: " << 100 * changed_fraction / frames
+      << "%, macroblock variance: " << variance / frames << endl;
+}
@@ -0,0 +1,77 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FRAME_ANALYZER_HH
+#define FRAME_ANALYZER_HH
+
+/* measures how much an I420 raster changed since the last one that was
+   encoded, per macroblock (16x16 luma pixels, and the 8x8 chroma pixels
+   of each plane under them), so static stretches of screen or camera
+   content need not be encoded at all. Uses SSE2 where available. */
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "salsify_protocol.hh"
+
+struct FrameActivity
+{
+  /* false for the first raster, which has nothing to be compared with */
+  bool has_reference { false };
+
+  /* sum of absolute differences with the reference, all planes */
+  uint64_t sad { 0 };
+
+  /* macroblocks whose SAD is above the threshold, out of `blocks` */
+  uint32_t changed_blocks { 0 };
+  uint32_t blocks { 0 };
+  uint32_t max_block_sad { 0 };
+
+  /* mean luma variance of the macroblocks: how costly the picture is to code */
+  double variance { 0 };
+
+  /* near-identical to the reference: no macroblock changed beyond the threshold */
+  bool is_static( void ) const { return has_reference and changed_blocks == 0; }
+
+  double changed_fraction( void ) const { return blocks ? double( changed_blocks ) / blocks : 0; }
+};
+
+class FrameAnalyzer
+{
+public:
+  /* a mean absolute difference of 1 over a macroblock's 384 pixels */
+  static constexpr uint32_t DEFAULT_BLOCK_THRESHOLD = 384;
+
+private:
+  const uint16_t width_;
+  const uint16_t height_;
+  const uint32_t block_threshold_;
+
+  Raster reference_;
+  bool has_reference_ { false };
+
+public:
+  FrameAnalyzer( const uint16_t width, const uint16_t height,
+                 const uint32_t block_threshold = DEFAULT_BLOCK_THRESHOLD );
+
+  /* compare a raster with the reference */
+  FrameActivity analyze( const uint8_t * raster ) const;
+
+  /* the raster that was encoded last, which later ones are compared with
+     (so changes below the threshold cannot pile up across skipped frames) */
+  void set_reference( const uint8_t * raster );
+};
+
+/* totals over a run of frames */
+struct ActivitySummary
+{
+  size_t frames { 0 };
+  size_t static_frames { 0 };
+  double changed_fraction { 0 };
+  double variance { 0 };
+
+  void add( const FrameActivity & activity );
+  void print( std::ostream & out ) const;
+};
+
+#endif /* FRAME_ANALYZER_HH */
@@ -0,0 +1,109 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <thread>
+#include <algorithm>
+
+#include "frame_pacer.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+double to_ms( const FramePacer::Clock::duration interval )
+{
+  return duration<double, milli>( interval ).count();
+}
+
+}
+
+FramePacer::FramePacer( const unsigned int frame_rate, const size_t qualities )
+  : period_( duration_cast<Clock::duration>( seconds( 1 ) ) / frame_rate ),
+    qualities_( qualities )
+{}
+
+void FramePacer::release( void )
+{
+  if ( frames_ == 0 ) {
+    start_ = Clock::now();
+  }
+
+  /* a sender that fell behind does not wait, and has to catch up */
+  const Clock::time_point capture = start_ + frames_ * period_;
+  this_thread::sleep_until( capture );
+
+  deadline_ = capture + period_;
+  stage_start_ = Clock::now();
+  encode_start_ = stage_start_;
+  frames_++;
+}
+
+void FramePacer::mark( const Stage stage )
+{
+  const Clock::time_point now = Clock::now();
+  stage_ms_[ stage ] += to_ms( now - stage_start_ );
+  stage_start_ = now;
+
+  if ( stage == READ ) {
+    encode_start_ = now;
+  }
+}
+
+bool FramePacer::hurried( void ) const
+{
+  return full_cost_ms_ > 0 and downgraded_in_a_row_ < RETRY_INTERVAL
+         and to_ms( deadline_ - Clock::now() ) < full_cost_ms_;
+}
+
+void FramePacer::finish( const Outcome outcome )
+{
+  const Clock::time_point now = Clock::now();
+  const double slack = to_ms( deadline_ - now );
+
+  slack_ms_.push_back( slack );
+  missed_ += ( slack < 0 or outcome == Outcome::DROPPED );
+  outcomes_[ static_cast<size_t>( outcome ) ]++;
+
+  /* otherwise an estimate past the deadline would downgrade every frame
+     from then on, however fast encoding got */
+  if ( outcome == Outcome::ENCODED or outcome == Outcome::DOWNGRADED ) {
+    const double scale = ( outcome == Outcome::DOWNGRADED ) ? qualities_ : 1;
+    const double cost = scale * to_ms( now - encode_start_ );
+    full_cost_ms_ = ( full_cost_ms_ == 0 ) ? cost : ( 7 * full_cost_ms_ + cost ) / 8;
+  }
+
+  if ( outcome == Outcome::DOWNGRADED ) {
+    downgraded_in_a_row_++;
+  }
+  else if ( outcome == Outcome::ENCODED ) {
+    downgraded_in_a_row_ = 0;
+  }
+}
+
+void FramePacer::print( ostream & out ) const
+{
+  if ( slack_ms_.empty() ) {
+    return;
+  }
+
+  vector<double> slack = slack_ms_;
+  sort( slack.begin(), slack.end() );
+
+  const size_t frames = slack.size();
+  auto percentile = [&]( const size_t p ) { return slack[ min( frames - 1, ( frames * p ) / 100 ) ]; };
+
+  out << "paced frames: " << frames
+      << ", deadline misses: " << missed_ << " (" << ( 100.0 * missed_ ) / frames << "%)"
+      << ", downgraded: " << outcomes_[ static_cast<size_t>( Outcome::DOWNGRADED ) ]
+      << ", dropped: " << outcomes_[ static_cast<size_t>( Outcome::DROPPED ) ]
+      << ", repeated: " << outcomes_[ static_cast<size_t>( Outcome::REPEATED ) ] << endl
+      << "slack (ms): min=" << slack.front()
+      << " p5=" << percentile( 5 )
+      << " p50=" << percentile( 50 )
+      << " p95=" << percentile( 95 )
+      << " max=" << slack.back() << endl
+      << "stage time (ms per frame): read=" << stage_ms_[ READ ] / frames
+      << " encode=" << stage_ms_[ ENCODE ] / frames
+      << " resync=" << stage_ms_[ RESYNC ] / frames
+      << " write=" << stage_ms_[ WRITE ] / frames << endl;
+}
@@ -0,0 +1,84 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FRAME_PACER_HH
+#define FRAME_PACER_HH
+
+/* Releases frames at a fixed rate on the monotonic clock, as a camera or
+   screen capture would, and follows each one through the sender against
+   its deadline: the moment the next frame is released. A frame that is
+   already late when it has been read should be dropped, and one that
+   would be late if every quality were encoded should be downgraded to a
+   single one; the summary tells how often deadlines were missed anyway,
+   and by how much they were met. */
+
+#include <array>
+#include <chrono>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+
+class FramePacer
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  /* where a frame's time goes; ENCODE includes the frame analysis, and
+     RESYNC is commit(), which rebuilds the encoders that did not win */
+  enum Stage { READ, ENCODE, RESYNC, WRITE, STAGE_COUNT };
+
+  /* every quality encoded, a single one, none because the raster did not
+     change (see frame_analyzer.hh), or none because it was late */
+  enum class Outcome { ENCODED, DOWNGRADED, REPEATED, DROPPED };
+
+private:
+  const Clock::duration period_;
+
+  Clock::time_point start_ {};
+  size_t frames_ { 0 };
+
+  Clock::time_point deadline_ {};
+  Clock::time_point stage_start_ {};
+  Clock::time_point encode_start_ {};
+
+  const size_t qualities_;
+
+  /* running estimate of the time from the end of READ to the end of WRITE
+     when every quality is encoded; a downgraded frame updates it too, as
+     if each quality had cost what its single one did */
+  double full_cost_ms_ { 0 };
+
+  /* after this many downgrades in a row, one frame is encoded in full to
+     measure the real cost again */
+  static constexpr size_t RETRY_INTERVAL = 32;
+  size_t downgraded_in_a_row_ { 0 };
+
+  std::array<double, STAGE_COUNT> stage_ms_ {};
+  std::vector<double> slack_ms_ {};
+  size_t missed_ { 0 };
+
+  /* frames by Outcome */
+  std::array<size_t, 4> outcomes_ {};
+
+public:
+  /* `qualities` is how many the sender encodes when not downgraded */
+  FramePacer( const unsigned int frame_rate, const size_t qualities );
+
+  /* wait until the next frame is captured, and start following it */
+  void release( void );
+
+  /* the current frame is done with `stage` */
+  void mark( const Stage stage );
+
+  /* already past the deadline: drop the frame */
+  bool late( void ) const { return Clock::now() >= deadline_; }
+
+  /* encoding every quality would probably miss the deadline */
+  bool hurried( void ) const;
+
+  /* the current frame has been written */
+  void finish( const Outcome outcome );
+
+  void print( std::ostream & out ) const;
+};
+
+#endif /* FRAME_PACER_HH */
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// How an encoder uses intra coding after its first frame, which is always
+// a key frame. Sender and receiver must use the same mode, since the
+// receiver reproduces the sender's encoders when it resyncs.
+enum class GopMode : uint8_t {
+    ALL_INTRA = 0,      // every frame is a key frame
+    INFINITE_GOP = 1,   // P-frames only
+    INTRA_REFRESH = 2,  // P-frames, with a column of intra blocks sweeping the picture
+};
+
+// frames it takes intra refresh to sweep across the whole picture
+constexpr size_t INTRA_REFRESH_PERIOD = 60;
+
+// frames per second the encoders are told to expect, and the senders
+// capture at; every frame lasts one tick of a 1/FRAME_RATE time base
+constexpr int FRAME_RATE = 60;
+
+inline const char *gop_mode_name(GopMode mode){
+    switch(mode){
+    case GopMode::ALL_INTRA: return "all-intra";
+    case GopMode::INFINITE_GOP: return "infinite";
+    case GopMode::INTRA_REFRESH: return "intra-refresh";
+    }
+    throw std::runtime_error("invalid GOP mode");
+}
+
+inline GopMode parse_gop_mode(const std::string &name){
+    for(GopMode mode : {GopMode::ALL_INTRA, GopMode::INFINITE_GOP, GopMode::INTRA_REFRESH}){
+        if(name == gop_mode_name(mode)){
+            return mode;
+        }
+    }
+    throw std::runtime_error("unknown GOP mode: " + name);
+}
@@ -0,0 +1,179 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <stdexcept>
+
+#include "h264_bitstream.hh"
+#include "nal_scanner.hh"
+
+using namespace std;
+
+string nal_to_rbsp( const Chunk & nal )
+{
+  string rbsp;
+  rbsp.reserve( nal.size() );
+
+  uint64_t copied = 0;
+  for ( uint64_t escape = find_escape( nal, 0 ); escape < nal.size();
+        escape = find_escape( nal, copied ) ) {
+    if ( nal.buffer()[ escape + 2 ] != 3 ) {
+      throw runtime_error( "nal_to_rbsp: start code inside a NAL unit" );
+    }
+
+    /* keep the two zeros, skip the 03 */
+    rbsp.append( reinterpret_cast<const char *>( nal.buffer() + copied ), escape + 2 - copied );
+    copied = escape + 3;
+  }
+
+  rbsp.append( reinterpret_cast<const char *>( nal.buffer() + copied ), nal.size() - copied );
+  return rbsp;
+}
+
+string rbsp_to_nal( const Chunk & rbsp )
+{
+  string nal;
+  nal.reserve( rbsp.size() + rbsp.size() / 64 + 1 );
+
+  uint64_t copied = 0;
+  for ( uint64_t escape = find_escape( rbsp, 0 ); escape < rbsp.size();
+        escape = find_escape( rbsp, copied ) ) {
+    /* the byte after the zeros starts the search again, as it may be a zero itself */
+    nal.append( reinterpret_cast<const char *>( rbsp.buffer() + copied ), escape + 2 - copied );
+    nal.push_back( 3 );
+    copied = escape + 2;
+  }
+
+  nal.append( reinterpret_cast<const char *>( rbsp.buffer() + copied ), rbsp.size() - copied );
+
+  /* cabac_zero_words at the very end would run into the next start code */
+  if ( nal.size() >= 2 and nal[ nal.size() - 1 ] == 0 and nal[ nal.size() - 2 ] == 0 ) {
+    nal.push_back( 3 );
+  }
+
+  return nal;
+}
+
+uint32_t BitReader::ue( void )
+{
+  /* a code with n leading zeros is 2n + 1 bits long */
+  const unsigned window = bits_left() < 32 ? bits_left() : 32;
+  const uint32_t peek = window ? data_.be_bits( position_, window ) << ( 32 - window ) : 0;
+
+  if ( peek == 0 ) {
+    throw runtime_error( "BitReader: invalid Exp-Golomb code" );
+  }
+
+  const unsigned zeros = __builtin_clz( peek );
+  position_ += zeros;
+  return u( zeros + 1 ) - 1;
+}
+
+int32_t BitReader::se( void )
+{
+  const uint32_t code = ue();
+  return ( code & 1 ) ? int32_t( ( code + 1 ) / 2 ) : -int32_t( code / 2 );
+}
+
+void BitWriter::put( const uint64_t value, const unsigned n )
+{
+  /* n <= 32, so the cache never holds more than 39 bits */
+  cache_ = ( cache_ << n ) | ( value & ( ( uint64_t( 1 ) << n ) - 1 ) );
+  cached_ += n;
+
+  while ( cached_ >= 8 ) {
+    cached_ -= 8;
+    out_.push_back( static_cast<char>( cache_ >> cached_ ) );
+  }
+
+  cache_ &= ( uint64_t( 1 ) << cached_ ) - 1;
+}
+
+void BitWriter::u( const uint64_t value, const unsigned n )
+{
+  if ( n > 64 ) {
+    throw out_of_range( "BitWriter: more than 64 bits" );
+  }
+
+  if ( n > 32 ) {
+    put( value >> 32, n - 32 );
+    put( value, 32 );
+  }
+  else {
+    put( value, n );
+  }
+}
+
+void BitWriter::ue( const uint32_t value )
+{
+  const uint64_t code = uint64_t( value ) + 1;
+  const unsigned length = 64 - __builtin_clzll( code );
+
+  u( 0, length - 1 );
+  u( code, length );
+}
+
+void BitWriter::se( const int32_t value )
+{
+  ue( value > 0 ? 2 * uint32_t( value ) - 1 : 2 * uint32_t( -int64_t( value ) ) );
+}
+
+void BitWriter::copy( BitReader & in, uint64_t n )
+{
+  if ( byte_aligned() and in.position() % 8 == 0 ) {
+    for ( ; n >= 8; n -= 8 ) {
+      out_.push_back( static_cast<char>( in.u( 8 ) ) );
+    }
+  }
+
+  for ( ; n >= 32; n -= 32 ) {
+    put( in.u( 32 ), 32 );
+  }
+
+  put( in.u( n ), n );
+}
+
+void BitWriter::append( const Chunk & bytes )
+{
+  if ( not byte_aligned() ) {
+    throw runtime_error( "BitWriter: append needs a byte boundary" );
+  }
+
+  out_.append( reinterpret_cast<const char *>( bytes.buffer() ), bytes.size() );
+}
+
+void BitWriter::align_with_ones( void )
+{
+  if ( not byte_aligned() ) {
+    put( 0xff, 8 - cached_ );
+  }
+}
+
+void BitWriter::trailing_bits( void )
+{
+  put( 1, 1 );
+
+  if ( not byte_aligned() ) {
+    put( 0, 8 - cached_ );
+  }
+}
+
+const string & BitWriter::bytes( void ) const
+{
+  if ( not byte_aligned() ) {
+    throw runtime_error( "BitWriter: not at a byte boundary" );
+  }
+
+  return out_;
+}
+
+uint64_t rbsp_stop_bit( const Chunk & rbsp )
+{
+  for ( uint64_t i = rbsp.size(); i > 0; i-- ) {
+    const uint8_t byte = rbsp.buffer()[ i - 1 ];
+
+    if ( byte ) {
+      return ( i - 1 ) * 8 + 7 - __builtin_ctz( byte );
+    }
+  }
+
+  throw runtime_error( "rbsp_stop_bit: no stop bit" );
+}
@@ -0,0 +1,89 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef H264_BITSTREAM_HH
+#define H264_BITSTREAM_HH
+
+/* bit-level access to H.264 syntax: NAL units are converted to raw byte
+   sequence payloads (RBSPs) and back, and read and written most
+   significant bit first, with Exp-Golomb codes */
+
+#include <string>
+#include <cstdint>
+
+#include "chunk.hh"
+
+/* drop the emulation prevention bytes of a NAL unit (header included) */
+std::string nal_to_rbsp( const Chunk & nal );
+
+/* insert emulation prevention bytes, so no start code appears inside */
+std::string rbsp_to_nal( const Chunk & rbsp );
+
+class BitReader
+{
+private:
+  Chunk data_;
+  uint64_t position_ { 0 };
+
+public:
+  BitReader( const Chunk & data ) : data_( data ) {}
+
+  /* n <= 64 bits as an unsigned number */
+  uint64_t u( const unsigned n )
+  {
+    const uint64_t val = data_.be_bits( position_, n );
+    position_ += n;
+    return val;
+  }
+
+  bool flag( void ) { return u( 1 ); }
+
+  uint32_t ue( void );
+  int32_t se( void );
+
+  uint64_t position( void ) const { return position_; }
+  uint64_t bits_left( void ) const { return data_.size() * 8 - position_; }
+  void seek( const uint64_t position ) { position_ = position; }
+};
+
+class BitWriter
+{
+private:
+  std::string out_ {};
+
+  /* bits not yet in out_, right-aligned; always fewer than 8 */
+  uint64_t cache_ { 0 };
+  unsigned cached_ { 0 };
+
+  void put( const uint64_t value, const unsigned n );
+
+public:
+  /* the low n <= 64 bits of value */
+  void u( const uint64_t value, const unsigned n );
+  void flag( const bool value ) { put( value, 1 ); }
+
+  void ue( const uint32_t value );
+  void se( const int32_t value );
+
+  /* the next n bits of the reader */
+  void copy( BitReader & in, uint64_t n );
+
+  /* whole bytes; only at a byte boundary */
+  void append( const Chunk & bytes );
+
+  bool byte_aligned( void ) const { return cached_ == 0; }
+
+  /* pad to a byte boundary with ones (cabac_alignment_one_bit) */
+  void align_with_ones( void );
+
+  /* rbsp_trailing_bits(): a one, then zeros to the byte boundary */
+  void trailing_bits( void );
+
+  /* the bytes written; only at a byte boundary */
+  const std::string & bytes( void ) const;
+};
+
+/* position of the rbsp_stop_one_bit: the last one bit, ignoring any
+   zero bytes after it */
+uint64_t rbsp_stop_bit( const Chunk & rbsp );
+
+#endif /* H264_BITSTREAM_HH */
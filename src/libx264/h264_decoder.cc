@@ -5,6 +5,7 @@
 #include <vector>
 #include <mutex>
 #include <chrono>
+#include <stdexcept>
 #include "h264_decoder.hh"
 
 extern "C" {
@@ -22,7 +23,9 @@ extern "C" {
 H264_decoder::H264_decoder(size_t _width, size_t _height) :
     width(_width),
     height(_height),
-    frame_count(0)    
+    frame_count(0),
+    part_buffer(),
+    part_output_set(false)
 {
 
     avcodec_register_all();
@@ -44,6 +47,14 @@ H264_decoder::H264_decoder(size_t _width, size_t _height) :
     decoder_context->width = width;
     decoder_context->height = height;
 
+    // accept frames in pieces, and output a picture as soon as its last
+    // macroblock is decoded
+    decoder_context->flags2 |= AV_CODEC_FLAG2_CHUNKS;
+
+    // frame threads would hold pictures back, and slice threads would
+    // compete with the other bands' decoders, which run one per core
+    decoder_context->thread_count = 1;
+
     if(avcodec_open2(decoder_context, decoder_codec, NULL) < 0){
         std::cout << "could not open decoder" << "\n";;
         throw;
@@ -54,6 +65,9 @@ H264_decoder::H264_decoder(size_t _width, size_t _height) :
         std::cout << "Decoder parser could not be initialized" << "\n";
         throw;
     }
+    // every call to decode() hands over exactly one frame, so don't hold it
+    // back waiting for the start of the next one
+    decoder_parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
 
     decoder_frame = av_frame_alloc();
     if(decoder_frame == NULL) {
@@ -88,6 +102,46 @@ H264_decoder::~H264_decoder(){
 }
 
 
+void H264_decoder::reset(){
+    avcodec_flush_buffers(decoder_context);
+
+    // the parser may still hold the tail of the previous stream
+    av_parser_close(decoder_parser);
+    decoder_parser = av_parser_init(decoder_codec->id);
+    if(decoder_parser == NULL){
+        throw std::runtime_error("Decoder parser could not be reinitialized");
+    }
+    decoder_parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+
+    part_output_set = false;
+    frame_count = 0;
+}
+
+
+void H264_decoder::decode_part(const uint8_t *input, size_t len){
+    part_buffer.resize(len + AV_INPUT_BUFFER_PADDING_SIZE);
+    std::memcpy(part_buffer.data(), input, len);
+    std::memset(part_buffer.data() + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    decoder_packet->data = part_buffer.data();
+    decoder_packet->size = len;
+    if(avcodec_send_packet(decoder_context, decoder_packet) < 0){
+        throw std::runtime_error("error while decoding a slice: send_packet");
+    }
+
+    // only the last slice completes the picture
+    if(avcodec_receive_frame(decoder_context, decoder_frame) >= 0){
+        part_output_set = true;
+    }
+}
+
+
+void H264_decoder::finish_frame(uint8_t *output){
+    write_output(part_output_set, output);
+    part_output_set = false;
+}
+
+
 void H264_decoder::decode(uint8_t *input, size_t len, uint8_t *output){
     bool output_set = false;
 
@@ -143,15 +197,24 @@ void H264_decoder::decode(uint8_t *input, size_t len, uint8_t *output){
     }
     //av_packet_unref(decoder_packet);
 
+    write_output(output_set, output);
+}
+
+
+void H264_decoder::write_output(bool output_set, uint8_t *output){
+    AVFrame *outputFrame = decoder_frame;
+
+    // a receive_frame() that came back empty has already released the
+    // frame's buffers, so the placeholder goes straight to the output
     if(!output_set){
-        std::memset(outputFrame->data[0], 255, width*height);
-        std::memset(outputFrame->data[1], 128, width*height/4);
-        std::memset(outputFrame->data[2], 128, width*height/4);
+        std::memset(output, 255, width*height);
+        std::memset(output + width*height, 128, width*height/2);
+    }
+    else{
+        std::memcpy(output, outputFrame->data[0], height*width);
+        std::memcpy(output + width*height, outputFrame->data[1], height*width/4);
+        std::memcpy(output + width*height + width*height/4, outputFrame->data[2], height*width/4);
     }
-
-    std::memcpy(output, outputFrame->data[0], height*width);
-    std::memcpy(output + width*height, outputFrame->data[1], height*width/4);
-    std::memcpy(output + width*height + width*height/4, outputFrame->data[2], height*width/4);
 
     frame_count += 1;
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 extern "C" {
 #include "libavcodec/avcodec.h"
 #include "libavutil/frame.h"
@@ -12,6 +14,14 @@ public:
 
     void decode(uint8_t *input, size_t len, uint8_t *output);
 
+    // decode a frame as it arrives: hand over its NAL units in order, each
+    // one decoded right away, then collect the picture
+    void decode_part(const uint8_t *input, size_t len);
+    void finish_frame(uint8_t *output);
+
+    // forget all decoded pictures without reopening the codec
+    void reset();
+
 private:
     const AVCodecID codec_id = AV_CODEC_ID_H264;
     const AVPixelFormat pix_fmt = AV_PIX_FMT_YUV420P;
@@ -26,4 +36,10 @@ private:
     AVFrame *decoder_frame;
     AVPacket *decoder_packet;
 
+    // decode_part() bypasses the parser, and libavcodec reads past the end
+    // of its input; keep a padded copy
+    std::vector<uint8_t> part_buffer;
+    bool part_output_set;
+
+    void write_output(bool output_set, uint8_t *output);
 };
@@ -5,7 +5,10 @@
 #include <vector>
 #include <mutex>
 #include <chrono>
+#include <stdexcept>
 #include "h264_encoder.hh"
+#include "encode_cache.hh"
+#include "hash.hh"
 
 extern "C" {
 #include <stdlib.h>
@@ -19,11 +22,16 @@ extern "C" {
 }
 
 
-H264_encoder::H264_encoder(size_t _width, size_t _height, size_t quantization) :
+H264_encoder::H264_encoder(size_t _width, size_t _height, size_t quantization, GopMode gop) :
     width(_width),
     height(_height),
     frame_count(0),
-    quantization(quantization)
+    quantization(quantization),
+    gop_mode(gop),
+    lineage(0),
+    skipped(),
+    cacheable(true),
+    cache_buffer()
 {
     avcodec_register_all();
 
@@ -44,19 +52,41 @@ H264_encoder::H264_encoder(size_t _width, size_t _height, size_t quantization) :
     encoder_context->width = width;
     encoder_context->height = height;
 
-    encoder_context->bit_rate = 1<<10;
-    encoder_context->bit_rate_tolerance = 0;
-
-    encoder_context->time_base = (AVRational){1, 20};
-    encoder_context->framerate = (AVRational){60, 1};
-    encoder_context->gop_size = 0;
+    encoder_context->time_base = (AVRational){1, FRAME_RATE};
+    encoder_context->framerate = (AVRational){FRAME_RATE, 1};
+    switch(gop_mode){
+    case GopMode::ALL_INTRA:
+        encoder_context->gop_size = 0; // x264 raises this to 1: every frame is an IDR
+        break;
+    case GopMode::INFINITE_GOP:
+        encoder_context->gop_size = 1 << 30; // X264_KEYINT_MAX_INFINITE
+        break;
+    case GopMode::INTRA_REFRESH:
+        encoder_context->gop_size = INTRA_REFRESH_PERIOD;
+        av_opt_set_int(encoder_context->priv_data, "intra-refresh", 1, 0);
+        break;
+    }
+    // a scene cut would add key frames that the mode did not ask for
+    encoder_context->scenechange_threshold = 0;
     encoder_context->max_b_frames = 0;
-    encoder_context->qmin = quantization;
-    encoder_context->qmax = quantization;
-    encoder_context->qcompress = 0.5;
+    encoder_context->slices = SLICES_PER_FRAME;
+    // libavcodec would pick a thread count from the core count, and x264's
+    // sliced threads would then change the slice layout from machine to
+    // machine; one thread also keeps the encoder safe to fork (see
+    // forked_encoder.hh) and to run one per core (bands, segments)
+    encoder_context->thread_count = 1;
     av_opt_set(encoder_context->priv_data, "tune", "zerolatency", 0); // forces no frame buffer delay (https://stackoverflow.com/questions/10155099/c-ffmpeg-h264-creating-zero-delay-stream)
     av_opt_set(encoder_context->priv_data, "preset", "fast", 0);
 
+    // Constant quantizer that can change between frames. x264 cannot
+    // reconfigure the QP of a running CQP encoder, but it can reconfigure
+    // CRF, and with qcomp = 1, no adaptive quantization and an I/P ratio of 1
+    // every frame is coded at QP = crf.
+    encoder_context->qcompress = 1.0;
+    encoder_context->i_quant_factor = 1.0;
+    av_opt_set_int(encoder_context->priv_data, "aq-mode", 0, 0);
+    av_opt_set_double(encoder_context->priv_data, "crf", quantization, 0);
+
     if(avcodec_open2(encoder_context, encoder_codec, NULL) < 0){
         std::cout << "could not open encoder" << "\n";;
         throw;
@@ -83,6 +113,15 @@ H264_encoder::H264_encoder(size_t _width, size_t _height, size_t quantization) :
         std::cout << "AVPacket not allocated: encoder" << "\n";
         throw;
     }
+
+    // everything above that decides the bits, so that cached frames from
+    // another configuration or libavcodec build never match
+    lineage = hash64(std::string(LIBAVCODEC_IDENT) + " H264_encoder "
+                     + std::to_string(width) + "x" + std::to_string(height)
+                     + " gop " + gop_mode_name(gop_mode)
+                     + " fps " + std::to_string(FRAME_RATE)
+                     + " slices " + std::to_string(SLICES_PER_FRAME)
+                     + " threads 1");
 }
 
 
@@ -93,7 +132,111 @@ H264_encoder::~H264_encoder(){
 }
 
 
+size_t H264_encoder::encode(uint8_t *input, uint8_t *output, size_t q){
+    set_quantizer(q);
+    return encode(input, output);
+}
+
+
+size_t H264_encoder::encode(const uint8_t *const planes[3], const int strides[3],
+                            uint8_t *output, size_t q){
+    set_quantizer(q);
+    return encode(planes, strides, output);
+}
+
+
+void H264_encoder::set_quantizer(size_t q){
+    if(q != quantization){
+        // picked up by libx264's reconfig before the next frame is encoded
+        if(av_opt_set_double(encoder_context->priv_data, "crf", q, 0) < 0){
+            throw std::runtime_error("could not change the quantizer");
+        }
+        quantization = q;
+    }
+}
+
+
+size_t H264_encoder::encode(uint8_t *input, uint8_t *output, const SliceSink &sink){
+    const size_t size = encode(input, output);
+    sink(Chunk(output, size));
+    return size;
+}
+
+
 size_t H264_encoder::encode(uint8_t *input, uint8_t *output){
+    const uint8_t *const planes[3] = {input, input + width*height, input + width*height + width*height/4};
+    const int strides[3] = {int(width), int(width/2), int(width/2)};
+
+    EncodeCache *cache = EncodeCache::active();
+    if(cache == NULL || !cacheable){
+        return encode_planes(planes, strides, output);
+    }
+
+    const size_t raster_size = width*height + width*height/2;
+    const uint64_t raster_hash = hash64(input, raster_size);
+    const uint64_t key = hash_combine(hash_combine(lineage, raster_hash), quantization);
+    lineage = key;
+
+    // a hit is only usable if the raster can be replayed later
+    if(cache->has_raster(raster_hash) && cache->get_frame(key, cache_buffer)){
+        std::memcpy(output, cache_buffer.data(), cache_buffer.size());
+        skipped.emplace_back(raster_hash, quantization);
+        cache->record_hit();
+        return cache_buffer.size();
+    }
+
+    catch_up(*cache);
+
+    const auto start = std::chrono::steady_clock::now();
+    const size_t size = encode_planes(planes, strides, output);
+    cache->record_miss(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    cache->put_raster(raster_hash, input, raster_size);
+    cache->put_frame(key, output, size);
+    return size;
+}
+
+
+void H264_encoder::catch_up(EncodeCache &cache){
+    if(skipped.empty()){
+        return;
+    }
+
+    const size_t q = quantization;
+    std::vector<uint8_t> raster;
+    cache_buffer.resize(width*height + width*height/2);
+
+    for(const auto &frame : skipped){
+        if(!cache.get_raster(frame.first, raster)){
+            throw std::runtime_error("encode cache: raster to replay is gone");
+        }
+
+        const uint8_t *const planes[3] = {raster.data(), raster.data() + width*height,
+                                          raster.data() + width*height + width*height/4};
+        const int strides[3] = {int(width), int(width/2), int(width/2)};
+
+        set_quantizer(frame.second);
+        encode_planes(planes, strides, cache_buffer.data());
+        cache.record_replay();
+    }
+
+    skipped.clear();
+    set_quantizer(q);
+}
+
+
+size_t H264_encoder::encode(const uint8_t *const planes[3], const int strides[3], uint8_t *output){
+    EncodeCache *cache = EncodeCache::active();
+    if(cache != NULL){
+        catch_up(*cache);
+    }
+    cacheable = false;
+
+    return encode_planes(planes, strides, output);
+}
+
+
+size_t H264_encoder::encode_planes(const uint8_t *const planes[3], const int strides[3], uint8_t *output){
     bool output_set = false;
 
     AVFrame *inputFrame = encoder_frame;
@@ -102,13 +245,19 @@ size_t H264_encoder::encode(uint8_t *input, uint8_t *output){
         throw;
     }
 
-    std::memcpy(inputFrame->data[0], input, height*width);
-    std::memcpy(inputFrame->data[1], input + height*width, height*width/4);
-    std::memcpy(inputFrame->data[2], input + height*width + height*width/4, height*width/4);
+    for(int p = 0; p < 3; p++){
+        const size_t plane_width = p ? width/2 : width;
+        const size_t plane_height = p ? height/2 : height;
+        for(size_t row = 0; row < plane_height; row++){
+            std::memcpy(inputFrame->data[p] + row*inputFrame->linesize[p],
+                        planes[p] + row*strides[p], plane_width);
+        }
+    }
 
     // encode frame
     auto encode1 = std::chrono::high_resolution_clock::now();
-    inputFrame->pts = frame_count;
+    // every frame the encoder sees gets the next pts, replays included
+    inputFrame->pts = frame_count++;
     int ret = avcodec_send_frame(encoder_context, inputFrame);
     if (ret < 0) {
         std::cout << "error sending a frame for encoding" << "\n";
@@ -9,14 +9,36 @@ extern "C" {
 }
 
 #include <mutex>
+#include <utility>
+#include <vector>
+
+#include "gop_mode.hh"
+#include "slice_sink.hh"
+
+class EncodeCache;
 
 class H264_encoder{
 public:
-    H264_encoder(size_t _width, size_t _height, size_t quantization);
+    H264_encoder(size_t _width, size_t _height, size_t quantization,
+                 GopMode gop = GopMode::INFINITE_GOP);
     ~H264_encoder();
 
+    // consults EncodeCache::active(), if there is one
     size_t encode(uint8_t *input, uint8_t *output);
+
+    // encode at quantizer q, which stays in effect for later frames
+    size_t encode(uint8_t *input, uint8_t *output, size_t q);
+
+    // the same, from separate Y, U and V planes with the given row strides;
+    // these are never cached, and turn the cache off for this encoder
+    size_t encode(const uint8_t *const planes[3], const int strides[3], uint8_t *output);
+    size_t encode(const uint8_t *const planes[3], const int strides[3], uint8_t *output, size_t q);
+
+    // libavcodec only returns whole frames, so sink gets the frame in one piece
+    size_t encode(uint8_t *input, uint8_t *output, const SliceSink &sink);
+
     size_t q() const { return quantization; }
+    GopMode gop() const { return gop_mode; }
 
 private:
     const AVCodecID codec_id = AV_CODEC_ID_H264;
@@ -24,14 +46,26 @@ private:
 
     const size_t width;
     const size_t height;
-    const size_t quantization;
+    size_t quantization;
     size_t frame_count;
+    const GopMode gop_mode;
 
     AVCodec *encoder_codec;
     AVCodecContext *encoder_context;
     AVPacket *encoder_packet;
     AVFrame *encoder_frame;
 
+    // with an EncodeCache: the hash of everything encoded so far, and the
+    // frames served from the cache that the codec has not seen yet
+    uint64_t lineage;
+    std::vector<std::pair<uint64_t, size_t>> skipped; // raster hash, quantizer
+    bool cacheable;
+    std::vector<uint8_t> cache_buffer;
+
+    void set_quantizer(size_t q);
+    size_t encode_planes(const uint8_t *const planes[3], const int strides[3], uint8_t *output);
+    void catch_up(EncodeCache &cache);
+
 };
 
 //#endif
@@ -0,0 +1,436 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <stdexcept>
+
+#include "h264_headers.hh"
+#include "h264_bitstream.hh"
+
+using namespace std;
+
+namespace {
+
+/* slice_type % 5 (H.264 table 7-6) */
+enum SliceType { P_SLICE = 0, B_SLICE = 1, I_SLICE = 2, SP_SLICE = 3, SI_SLICE = 4 };
+
+bool high_profile( const uint8_t profile_idc )
+{
+  switch ( profile_idc ) {
+  case 100: case 110: case 122: case 244: case 44: case 83:
+  case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+void skip_scaling_list( BitReader & in, const unsigned size )
+{
+  int last_scale = 8;
+  int next_scale = 8;
+
+  for ( unsigned j = 0; j < size; j++ ) {
+    if ( next_scale != 0 ) {
+      next_scale = ( last_scale + in.se() + 256 ) % 256;
+    }
+
+    last_scale = ( next_scale == 0 ) ? last_scale : next_scale;
+  }
+}
+
+void skip_ref_pic_list_modification( BitReader & in )
+{
+  if ( not in.flag() ) {
+    return;
+  }
+
+  for ( uint32_t idc = in.ue(); idc != 3; idc = in.ue() ) {
+    if ( idc > 3 ) {
+      throw runtime_error( "invalid modification_of_pic_nums_idc" );
+    }
+
+    in.ue();   /* abs_diff_pic_num_minus1 or long_term_pic_num */
+  }
+}
+
+void skip_weights( BitReader & in, const uint32_t count, const bool chroma )
+{
+  for ( uint32_t i = 0; i < count; i++ ) {
+    if ( in.flag() ) {   /* luma_weight_flag */
+      in.se();
+      in.se();
+    }
+
+    if ( chroma and in.flag() ) {   /* chroma_weight_flag */
+      for ( unsigned j = 0; j < 4; j++ ) {
+        in.se();
+      }
+    }
+  }
+}
+
+void skip_dec_ref_pic_marking( BitReader & in, const bool idr )
+{
+  if ( idr ) {
+    in.u( 2 );   /* no_output_of_prior_pics_flag, long_term_reference_flag */
+    return;
+  }
+
+  if ( not in.flag() ) {   /* adaptive_ref_pic_marking_mode_flag */
+    return;
+  }
+
+  for ( uint32_t mmco = in.ue(); mmco != 0; mmco = in.ue() ) {
+    if ( mmco > 6 ) {
+      throw runtime_error( "invalid memory_management_control_operation" );
+    }
+
+    if ( mmco == 1 or mmco == 3 ) {
+      in.ue();   /* difference_of_pic_nums_minus1 */
+    }
+    if ( mmco == 2 ) {
+      in.ue();   /* long_term_pic_num */
+    }
+    if ( mmco == 3 or mmco == 6 ) {
+      in.ue();   /* long_term_frame_idx */
+    }
+    if ( mmco == 4 ) {
+      in.ue();   /* max_long_term_frame_idx_plus1 */
+    }
+  }
+}
+
+/* a value to put in place of a field */
+struct FieldEdit
+{
+  BitField field;
+  bool exp_golomb;
+  uint32_t value;
+};
+
+/* copy the RBSP, replacing the (ordered) fields; the bits after the last
+   one are copied through `end`, and the rest either realigned as CABAC
+   slice data or copied up to the stop bit */
+string apply_edits( const Chunk & rbsp, const FieldEdit * edits, const size_t count,
+                    const uint64_t end, const bool cabac )
+{
+  BitReader in { rbsp };
+  BitWriter out;
+
+  for ( size_t i = 0; i < count; i++ ) {
+    const FieldEdit & edit = edits[ i ];
+
+    if ( edit.field.end == edit.field.begin ) {
+      continue;
+    }
+
+    out.copy( in, edit.field.begin - in.position() );
+
+    if ( edit.exp_golomb ) {
+      out.ue( edit.value );
+    }
+    else {
+      out.u( edit.value, edit.field.end - edit.field.begin );
+    }
+
+    in.seek( edit.field.end );
+  }
+
+  if ( cabac ) {
+    /* the header's length may have changed, so the alignment bits do too */
+    out.copy( in, end - in.position() );
+    out.align_with_ones();
+    out.append( rbsp( ( end + 7 ) / 8 ) );
+  }
+  else {
+    out.copy( in, rbsp_stop_bit( rbsp ) - in.position() );
+    out.trailing_bits();
+  }
+
+  return out.bytes();
+}
+
+}
+
+SequenceParameterSet SequenceParameterSet::parse( const Chunk & rbsp )
+{
+  BitReader in { rbsp };
+  SequenceParameterSet sps;
+
+  in.u( 8 );   /* NAL header */
+  sps.profile_idc = in.u( 8 );
+  in.u( 16 );  /* constraint flags, level_idc */
+  sps.id = in.ue();
+
+  if ( high_profile( sps.profile_idc ) ) {
+    sps.chroma_format_idc = in.ue();
+
+    if ( sps.chroma_format_idc == 3 ) {
+      sps.separate_colour_plane = in.flag();
+    }
+
+    in.ue();     /* bit_depth_luma_minus8 */
+    in.ue();     /* bit_depth_chroma_minus8 */
+    in.flag();   /* qpprime_y_zero_transform_bypass_flag */
+
+    if ( in.flag() ) {   /* seq_scaling_matrix_present_flag */
+      const unsigned lists = ( sps.chroma_format_idc != 3 ) ? 8 : 12;
+
+      for ( unsigned i = 0; i < lists; i++ ) {
+        if ( in.flag() ) {
+          skip_scaling_list( in, i < 6 ? 16 : 64 );
+        }
+      }
+    }
+  }
+
+  sps.log2_max_frame_num = in.ue() + 4;
+  sps.pic_order_cnt_type = in.ue();
+
+  if ( sps.pic_order_cnt_type == 0 ) {
+    sps.log2_max_pic_order_cnt_lsb = in.ue() + 4;
+  }
+  else if ( sps.pic_order_cnt_type == 1 ) {
+    sps.delta_pic_order_always_zero = in.flag();
+    in.se();   /* offset_for_non_ref_pic */
+    in.se();   /* offset_for_top_to_bottom_field */
+
+    const uint32_t cycle = in.ue();
+    for ( uint32_t i = 0; i < cycle; i++ ) {
+      in.se();
+    }
+  }
+
+  in.ue();     /* max_num_ref_frames */
+  in.flag();   /* gaps_in_frame_num_value_allowed_flag */
+  in.ue();     /* pic_width_in_mbs_minus1 */
+  in.ue();     /* pic_height_in_map_units_minus1 */
+  sps.frame_mbs_only = in.flag();
+
+  if ( sps.log2_max_frame_num > 16 or sps.log2_max_pic_order_cnt_lsb > 16 ) {
+    throw runtime_error( "SPS: invalid frame_num or POC size" );
+  }
+
+  return sps;
+}
+
+PictureParameterSet PictureParameterSet::parse( const Chunk & rbsp )
+{
+  BitReader in { rbsp };
+  PictureParameterSet pps;
+
+  in.u( 8 );   /* NAL header */
+  pps.id = in.ue();
+  pps.sps_id = in.ue();
+  pps.entropy_coding_mode = in.flag();
+  pps.bottom_field_pic_order_in_frame_present = in.flag();
+
+  if ( in.ue() != 0 ) {
+    throw runtime_error( "PPS: slice groups are not supported" );
+  }
+
+  pps.num_ref_idx_l0_default_active = in.ue() + 1;
+  pps.num_ref_idx_l1_default_active = in.ue() + 1;
+  pps.weighted_pred = in.flag();
+  pps.weighted_bipred_idc = in.u( 2 );
+  in.se();     /* pic_init_qp_minus26 */
+  in.se();     /* pic_init_qs_minus26 */
+  in.se();     /* chroma_qp_index_offset */
+  pps.deblocking_filter_control_present = in.flag();
+  in.flag();   /* constrained_intra_pred_flag */
+  pps.redundant_pic_cnt_present = in.flag();
+
+  return pps;
+}
+
+void ParameterSets::observe( const Chunk & rbsp )
+{
+  if ( rbsp.size() == 0 ) {
+    return;
+  }
+
+  switch ( rbsp.octet() & 0x1f ) {
+  case nal::SPS: {
+    const SequenceParameterSet parsed = SequenceParameterSet::parse( rbsp );
+    sps[ parsed.id ] = parsed;
+    break;
+  }
+
+  case nal::PPS: {
+    const PictureParameterSet parsed = PictureParameterSet::parse( rbsp );
+    pps[ parsed.id ] = parsed;
+    break;
+  }
+
+  default:
+    break;
+  }
+}
+
+SliceHeader SliceHeader::parse( const Chunk & rbsp, const ParameterSets & params )
+{
+  BitReader in { rbsp };
+  SliceHeader header;
+
+  const uint8_t nal_header = in.u( 8 );
+  header.nal_type = nal_header & 0x1f;
+  header.nal_ref_idc = ( nal_header >> 5 ) & 3;
+
+  if ( header.nal_type != nal::SLICE and header.nal_type != nal::IDR ) {
+    throw runtime_error( "SliceHeader: not a slice" );
+  }
+
+  header.first_mb_in_slice = in.ue();
+  header.slice_type = in.ue();
+  const uint32_t type = header.slice_type % 5;
+
+  header.pps_id_bits.begin = in.position();
+  header.pps_id = in.ue();
+  header.pps_id_bits.end = in.position();
+
+  const auto pps_entry = params.pps.find( header.pps_id );
+  if ( pps_entry == params.pps.end() ) {
+    throw runtime_error( "SliceHeader: unknown PPS" );
+  }
+  const PictureParameterSet & pps = pps_entry->second;
+
+  const auto sps_entry = params.sps.find( pps.sps_id );
+  if ( sps_entry == params.sps.end() ) {
+    throw runtime_error( "SliceHeader: unknown SPS" );
+  }
+  const SequenceParameterSet & sps = sps_entry->second;
+
+  header.cabac = pps.entropy_coding_mode;
+
+  if ( sps.separate_colour_plane ) {
+    in.u( 2 );   /* colour_plane_id */
+  }
+
+  header.frame_num_bits.begin = in.position();
+  header.frame_num = in.u( sps.log2_max_frame_num );
+  header.frame_num_bits.end = in.position();
+
+  if ( not sps.frame_mbs_only ) {
+    header.field_pic = in.flag();
+    if ( header.field_pic ) {
+      in.flag();   /* bottom_field_flag */
+    }
+  }
+
+  if ( header.idr() ) {
+    header.idr_pic_id_bits.begin = in.position();
+    header.idr_pic_id = in.ue();
+    header.idr_pic_id_bits.end = in.position();
+  }
+
+  if ( sps.pic_order_cnt_type == 0 ) {
+    header.pic_order_cnt_lsb_bits.begin = in.position();
+    header.pic_order_cnt_lsb = in.u( sps.log2_max_pic_order_cnt_lsb );
+    header.pic_order_cnt_lsb_bits.end = in.position();
+
+    if ( pps.bottom_field_pic_order_in_frame_present and not header.field_pic ) {
+      in.se();   /* delta_pic_order_cnt_bottom */
+    }
+  }
+  else if ( sps.pic_order_cnt_type == 1 and not sps.delta_pic_order_always_zero ) {
+    in.se();   /* delta_pic_order_cnt[ 0 ] */
+    if ( pps.bottom_field_pic_order_in_frame_present and not header.field_pic ) {
+      in.se();
+    }
+  }
+
+  if ( pps.redundant_pic_cnt_present ) {
+    in.ue();
+  }
+
+  if ( type == B_SLICE ) {
+    in.flag();   /* direct_spatial_mv_pred_flag */
+  }
+
+  uint32_t num_ref_idx_l0_active = pps.num_ref_idx_l0_default_active;
+  uint32_t num_ref_idx_l1_active = pps.num_ref_idx_l1_default_active;
+
+  if ( type == P_SLICE or type == SP_SLICE or type == B_SLICE ) {
+    if ( in.flag() ) {   /* num_ref_idx_active_override_flag */
+      num_ref_idx_l0_active = in.ue() + 1;
+      if ( type == B_SLICE ) {
+        num_ref_idx_l1_active = in.ue() + 1;
+      }
+    }
+  }
+
+  if ( type != I_SLICE and type != SI_SLICE ) {
+    skip_ref_pic_list_modification( in );
+  }
+  if ( type == B_SLICE ) {
+    skip_ref_pic_list_modification( in );
+  }
+
+  if ( ( pps.weighted_pred and ( type == P_SLICE or type == SP_SLICE ) )
+       or ( pps.weighted_bipred_idc == 1 and type == B_SLICE ) ) {
+    const bool chroma = sps.chroma_array_type() != 0;
+
+    in.ue();   /* luma_log2_weight_denom */
+    if ( chroma ) {
+      in.ue();
+    }
+
+    skip_weights( in, num_ref_idx_l0_active, chroma );
+    if ( type == B_SLICE ) {
+      skip_weights( in, num_ref_idx_l1_active, chroma );
+    }
+  }
+
+  if ( header.nal_ref_idc != 0 ) {
+    skip_dec_ref_pic_marking( in, header.idr() );
+  }
+
+  if ( pps.entropy_coding_mode and type != I_SLICE and type != SI_SLICE ) {
+    in.ue();   /* cabac_init_idc */
+  }
+
+  in.se();   /* slice_qp_delta */
+
+  if ( type == SP_SLICE or type == SI_SLICE ) {
+    if ( type == SP_SLICE ) {
+      in.flag();   /* sp_for_switch_flag */
+    }
+    in.se();   /* slice_qs_delta */
+  }
+
+  if ( pps.deblocking_filter_control_present ) {
+    if ( in.ue() != 1 ) {   /* disable_deblocking_filter_idc */
+      in.se();   /* slice_alpha_c0_offset_div2 */
+      in.se();   /* slice_beta_offset_div2 */
+    }
+  }
+
+  header.end = in.position();
+  return header;
+}
+
+string rewrite_pps_id( const Chunk & rbsp, const uint32_t pps_id )
+{
+  BitReader in { rbsp };
+  in.u( 8 );
+
+  FieldEdit edit { { in.position(), 0 }, true, pps_id };
+  in.ue();
+  edit.field.end = in.position();
+
+  return apply_edits( rbsp, &edit, 1, 0, false );
+}
+
+string rewrite_slice( const Chunk & rbsp, const SliceHeader & header,
+                      const SliceRewrite & values )
+{
+  const FieldEdit edits[] = {
+    { header.pps_id_bits, true, values.pps_id },
+    { header.frame_num_bits, false, values.frame_num },
+    { header.idr_pic_id_bits, true, values.idr_pic_id },
+    { header.pic_order_cnt_lsb_bits, false, values.pic_order_cnt_lsb },
+  };
+
+  return apply_edits( rbsp, edits, sizeof( edits ) / sizeof( edits[ 0 ] ),
+                      header.end, header.cabac );
+}
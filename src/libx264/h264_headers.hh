@@ -0,0 +1,118 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef H264_HEADERS_HH
+#define H264_HEADERS_HH
+
+/* parses the H.264 headers that tie a slice to its stream (parameter sets,
+   and the slice header up to the slice data) and rewrites the fields that
+   a stream splice has to change. Everything here works on RBSPs (see
+   h264_bitstream.hh), header byte included. */
+
+#include <map>
+#include <string>
+#include <cstdint>
+
+#include "chunk.hh"
+#include "nal_scanner.hh"
+
+struct SequenceParameterSet
+{
+  uint8_t profile_idc { 0 };
+  uint32_t id { 0 };
+  uint32_t chroma_format_idc { 1 };
+  bool separate_colour_plane { false };
+  unsigned log2_max_frame_num { 4 };
+  uint32_t pic_order_cnt_type { 0 };
+  unsigned log2_max_pic_order_cnt_lsb { 4 };
+  bool delta_pic_order_always_zero { false };
+  bool frame_mbs_only { true };
+
+  static SequenceParameterSet parse( const Chunk & rbsp );
+
+  uint32_t max_frame_num( void ) const { return 1u << log2_max_frame_num; }
+  uint32_t max_pic_order_cnt_lsb( void ) const { return 1u << log2_max_pic_order_cnt_lsb; }
+  uint32_t chroma_array_type( void ) const { return separate_colour_plane ? 0 : chroma_format_idc; }
+};
+
+struct PictureParameterSet
+{
+  uint32_t id { 0 };
+  uint32_t sps_id { 0 };
+  bool entropy_coding_mode { false };   /* CABAC */
+  bool bottom_field_pic_order_in_frame_present { false };
+  uint32_t num_ref_idx_l0_default_active { 1 };
+  uint32_t num_ref_idx_l1_default_active { 1 };
+  bool weighted_pred { false };
+  uint32_t weighted_bipred_idc { 0 };
+  bool deblocking_filter_control_present { false };
+  bool redundant_pic_cnt_present { false };
+
+  static PictureParameterSet parse( const Chunk & rbsp );
+};
+
+/* the parameter sets a decoder has seen, by id */
+struct ParameterSets
+{
+  std::map<uint32_t, SequenceParameterSet> sps {};
+  std::map<uint32_t, PictureParameterSet> pps {};
+
+  /* remember the SPS or PPS in this RBSP; other NAL units are ignored */
+  void observe( const Chunk & rbsp );
+};
+
+/* a bit range [begin, end) of an RBSP */
+struct BitField
+{
+  uint64_t begin { 0 };
+  uint64_t end { 0 };
+};
+
+struct SliceHeader
+{
+  uint8_t nal_type { 0 };
+  uint8_t nal_ref_idc { 0 };
+  uint32_t first_mb_in_slice { 0 };
+  uint32_t slice_type { 0 };
+  uint32_t pps_id { 0 };
+  uint32_t frame_num { 0 };
+  bool field_pic { false };
+  uint32_t idr_pic_id { 0 };
+  uint32_t pic_order_cnt_lsb { 0 };
+
+  /* from the PPS: CABAC slice data starts byte-aligned */
+  bool cabac { false };
+
+  /* where the rewritable fields are; the last two are empty when absent */
+  BitField pps_id_bits {};
+  BitField frame_num_bits {};
+  BitField idr_pic_id_bits {};
+  BitField pic_order_cnt_lsb_bits {};
+
+  /* the first bit after the header: slice_data(), or the CABAC alignment before it */
+  uint64_t end { 0 };
+
+  /* a PPS (and its SPS) for pps_id has to be in `params` */
+  static SliceHeader parse( const Chunk & rbsp, const ParameterSets & params );
+
+  bool idr( void ) const { return nal_type == nal::IDR; }
+};
+
+/* the PPS with another pic_parameter_set_id; like rewrite_slice(), this
+   returns an RBSP */
+std::string rewrite_pps_id( const Chunk & rbsp, const uint32_t pps_id );
+
+/* new values for a slice header's stream-level fields */
+struct SliceRewrite
+{
+  uint32_t pps_id;
+  uint32_t frame_num;
+  uint32_t idr_pic_id;
+  uint32_t pic_order_cnt_lsb;
+};
+
+/* the slice with its header fields replaced (the ones it does not have
+   are ignored); `header` is what parse() made of it */
+std::string rewrite_slice( const Chunk & rbsp, const SliceHeader & header,
+                           const SliceRewrite & values );
+
+#endif /* H264_HEADERS_HH */
@@ -0,0 +1,187 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "h264_splicer.hh"
+#include "h264_bitstream.hh"
+#include "nal_scanner.hh"
+
+using namespace std;
+
+namespace {
+
+const string START_CODE { 0, 0, 0, 1 };
+
+const SequenceParameterSet & sps_of( const ParameterSets & params, const SliceHeader & slice )
+{
+  return params.sps.at( params.pps.at( slice.pps_id ).sps_id );
+}
+
+}
+
+void H264StreamTracker::reset( void )
+{
+  params_ = {};
+  sps_.clear();
+  has_picture_ = false;
+}
+
+void H264StreamTracker::feed( const Chunk & frame )
+{
+  NalScanner scanner { frame };
+  NalUnit nal;
+
+  while ( scanner.next( nal ) ) {
+    const Chunk unit = frame( nal.offset, nal.size );
+
+    if ( nal.type == nal::SPS or nal.type == nal::PPS ) {
+      params_.observe( nal_to_rbsp( unit ) );
+
+      if ( nal.type == nal::SPS ) {
+        sps_ = unit.to_string();
+      }
+    }
+    else if ( nal.first_slice ) {
+      last_picture_ = SliceHeader::parse( nal_to_rbsp( unit ), params_ );
+      has_picture_ = true;
+    }
+  }
+}
+
+void H264Splicer::learn( const Chunk & nal )
+{
+  const string rbsp = nal_to_rbsp( nal );
+  params_.observe( rbsp );
+
+  if ( ( nal.octet() & 0x1f ) == nal::PPS ) {
+    pps_ = rbsp;
+  }
+}
+
+void H264Splicer::start( const uint32_t pps_id )
+{
+  active_ = true;
+  pps_id_ = pps_id;
+  frame_num_offset_ = 0;
+  poc_lsb_offset_ = 0;
+  pending_pps_.clear();
+  idr_ = false;
+}
+
+bool H264Splicer::start( const uint32_t pps_id, const Chunk & keyframe,
+                         const H264StreamTracker & stream )
+{
+  stop();
+
+  string sps;
+  bool has_slice = false;
+  SliceHeader key;
+
+  NalScanner scanner { keyframe };
+  NalUnit nal;
+
+  while ( scanner.next( nal ) ) {
+    const Chunk unit = keyframe( nal.offset, nal.size );
+
+    if ( nal.type == nal::SPS or nal.type == nal::PPS ) {
+      learn( unit );
+
+      if ( nal.type == nal::SPS ) {
+        sps = unit.to_string();
+      }
+    }
+    else if ( nal.first_slice and not has_slice ) {
+      key = SliceHeader::parse( nal_to_rbsp( unit ), params_ );
+      has_slice = true;
+    }
+  }
+
+  /* the decoder keeps its SPS, and the references are described by it */
+  if ( not has_slice or pps_.empty() or not stream.has_picture() or sps != stream.sps() ) {
+    return false;
+  }
+
+  const SequenceParameterSet & seq = sps_of( params_, key );
+  const SliceHeader & last = stream.last_picture();
+
+  start( pps_id );
+  frame_num_offset_ = ( last.frame_num - key.frame_num ) & ( seq.max_frame_num() - 1 );
+  poc_lsb_offset_ = ( last.pic_order_cnt_lsb - key.pic_order_cnt_lsb )
+                    & ( seq.max_pic_order_cnt_lsb() - 1 );
+  pending_pps_ = START_CODE + rbsp_to_nal( rewrite_pps_id( pps_, pps_id_ ) );
+  return true;
+}
+
+void H264Splicer::stop( void )
+{
+  active_ = false;
+  pending_pps_.clear();
+}
+
+string H264Splicer::apply( const Chunk & frame, const H264StreamTracker & stream )
+{
+  string out;
+  out.reserve( frame.size() + pending_pps_.size() + 64 );
+
+  bool has_pps = false;
+
+  NalScanner scanner { frame };
+  NalUnit nal;
+
+  while ( scanner.next( nal ) ) {
+    const Chunk unit = frame( nal.offset, nal.size );
+
+    if ( nal.type == nal::SPS or nal.type == nal::PPS ) {
+      learn( unit );
+    }
+
+    if ( nal.type == nal::PPS ) {
+      out += START_CODE + rbsp_to_nal( rewrite_pps_id( pps_, pps_id_ ) );
+      has_pps = true;
+    }
+    else if ( nal.is_slice() ) {
+      if ( nal.first_slice and not has_pps ) {
+        out += pending_pps_;
+      }
+
+      const string rbsp = nal_to_rbsp( unit );
+      const SliceHeader header = SliceHeader::parse( rbsp, params_ );
+      const SequenceParameterSet & sps = sps_of( params_, header );
+
+      SliceRewrite values { pps_id_, header.frame_num, header.idr_pic_id, header.pic_order_cnt_lsb };
+
+      if ( header.idr() ) {
+        /* an IDR restarts the numbering, but two IDRs in a row need different ids */
+        idr_ = true;
+
+        if ( stream.has_picture() and stream.last_picture().idr()
+             and stream.last_picture().idr_pic_id == values.idr_pic_id ) {
+          values.idr_pic_id ^= 1;
+        }
+      }
+      else {
+        values.frame_num = ( header.frame_num + frame_num_offset_ ) & ( sps.max_frame_num() - 1 );
+        values.pic_order_cnt_lsb = ( header.pic_order_cnt_lsb + poc_lsb_offset_ )
+                                   & ( sps.max_pic_order_cnt_lsb() - 1 );
+      }
+
+      out += START_CODE + rbsp_to_nal( rewrite_slice( rbsp, header, values ) );
+    }
+    else {
+      out += START_CODE;
+      out.append( reinterpret_cast<const char *>( unit.buffer() ), unit.size() );
+    }
+  }
+
+  return out;
+}
+
+void H264Splicer::committed( void )
+{
+  /* the encoder's own numbering is the decoder's from its IDR on */
+  if ( idr_ ) {
+    frame_num_offset_ = 0;
+    poc_lsb_offset_ = 0;
+  }
+
+  pending_pps_.clear();
+  idr_ = false;
+}
@@ -0,0 +1,87 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef H264_SPLICER_HH
+#define H264_SPLICER_HH
+
+/* Feeds the frames of one H.264 encoder into a decoder that has been
+   following another one, by rewriting their headers: the parameter sets
+   get an id of their own, and frame_num, pic_order_cnt_lsb and idr_pic_id
+   continue where the decoder's stream left off. The pictures decode the
+   same as long as the decoder's references match the encoder's, which is
+   for the caller to establish. */
+
+#include <string>
+#include <cstdint>
+
+#include "chunk.hh"
+#include "h264_headers.hh"
+
+/* what a decoder knows about the stream it has been fed */
+class H264StreamTracker
+{
+private:
+  ParameterSets params_ {};
+
+  /* the last SPS, as a NAL unit */
+  std::string sps_ {};
+
+  bool has_picture_ { false };
+  SliceHeader last_picture_ {};
+
+public:
+  /* the decoder started over */
+  void reset( void );
+
+  /* follow a frame (Annex B) fed to the decoder */
+  void feed( const Chunk & frame );
+
+  const std::string & sps( void ) const { return sps_; }
+  const ParameterSets & params( void ) const { return params_; }
+
+  bool has_picture( void ) const { return has_picture_; }
+  const SliceHeader & last_picture( void ) const { return last_picture_; }
+};
+
+class H264Splicer
+{
+private:
+  bool active_ { false };
+  uint32_t pps_id_ { 0 };
+
+  /* added to the encoder's numbering, up to its next IDR */
+  uint32_t frame_num_offset_ { 0 };
+  uint32_t poc_lsb_offset_ { 0 };
+
+  /* the encoder's parameter sets, and its last PPS as an RBSP */
+  ParameterSets params_ {};
+  std::string pps_ {};
+
+  /* a rewritten PPS the decoder has not seen yet, and whether the frame
+     being rewritten has an IDR */
+  std::string pending_pps_ {};
+  bool idr_ { false };
+
+  void learn( const Chunk & nal );
+
+public:
+  /* rewrite with PPS id `pps_id`, keeping the numbering: for a decoder
+     that is about to get an IDR from this encoder anyway */
+  void start( const uint32_t pps_id );
+
+  /* rewrite the frames that follow `keyframe`, which this encoder just
+     produced, as if they followed the last picture of `stream` instead;
+     false if that cannot work (the SPS differs, or `stream` is empty) */
+  bool start( const uint32_t pps_id, const Chunk & keyframe, const H264StreamTracker & stream );
+
+  void stop( void );
+  bool active( void ) const { return active_; }
+
+  /* a frame of the encoder, or any run of its NAL units, ready for the
+     decoder `stream` tracks; call in stream order */
+  std::string apply( const Chunk & frame, const H264StreamTracker & stream );
+
+  /* the last frame given to apply() went to the decoder */
+  void committed( void );
+};
+
+#endif /* H264_SPLICER_HH */
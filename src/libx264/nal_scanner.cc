@@ -0,0 +1,137 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#include "nal_scanner.hh"
+
+using namespace std;
+
+const char * nal_type_name( const uint8_t type )
+{
+  switch ( type ) {
+  case nal::SLICE: return "non-IDR";
+  case 2: case 3: case 4: return "partition";
+  case nal::IDR: return "IDR";
+  case nal::SEI: return "SEI";
+  case nal::SPS: return "SPS";
+  case nal::PPS: return "PPS";
+  case nal::AUD: return "AUD";
+  case 10: return "end-of-seq";
+  case 11: return "end-of-stream";
+  case 12: return "filler";
+  default: return "other";
+  }
+}
+
+bool NalUnit::starts_access_unit( void ) const
+{
+  if ( is_slice() ) {
+    return first_slice;
+  }
+
+  return type == nal::SEI or type == nal::SPS or type == nal::PPS or type == nal::AUD
+         or ( type >= 14 and type <= 18 );
+}
+
+namespace {
+
+/* the first 00 00 xx with LOW <= xx <= HIGH, at or after `from` */
+template <uint8_t LOW, uint8_t HIGH>
+uint64_t find_zeros_then( const Chunk & stream, const uint64_t from )
+{
+  const uint8_t * const data = stream.buffer();
+  const uint64_t size = stream.size();
+  uint64_t i = from;
+
+#if defined( __SSE2__ )
+  /* 16 candidate positions at a time */
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i low = _mm_set1_epi8( LOW );
+  const __m128i high = _mm_set1_epi8( HIGH );
+
+  for ( ; i + 18 <= size; i += 16 ) {
+    const __m128i first = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + i ) );
+    const __m128i second = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + i + 1 ) );
+    const __m128i third = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + i + 2 ) );
+
+    const __m128i third_matches = ( LOW == HIGH )
+      ? _mm_cmpeq_epi8( third, low )
+      : _mm_and_si128( _mm_cmpeq_epi8( _mm_max_epu8( third, low ), third ),
+                       _mm_cmpeq_epi8( _mm_min_epu8( third, high ), third ) );
+
+    const int matches = _mm_movemask_epi8( _mm_and_si128( _mm_and_si128( _mm_cmpeq_epi8( first, zero ),
+                                                                          _mm_cmpeq_epi8( second, zero ) ),
+                                                           third_matches ) );
+    if ( matches ) {
+      return i + __builtin_ctz( matches );
+    }
+  }
+#endif
+
+  for ( ; i + 3 <= size; i++ ) {
+    if ( data[ i + 2 ] > HIGH ) {
+      /* no match can start here, or at either of the next two bytes */
+      i += 2;
+    }
+    else if ( data[ i ] == 0 and data[ i + 1 ] == 0 and data[ i + 2 ] >= LOW ) {
+      return i;
+    }
+  }
+
+  return size;
+}
+
+}
+
+uint64_t find_start_code( const Chunk & stream, const uint64_t from )
+{
+  return find_zeros_then<1, 1>( stream, from );
+}
+
+uint64_t find_escape( const Chunk & data, const uint64_t from )
+{
+  return find_zeros_then<0, 3>( data, from );
+}
+
+NalScanner::NalScanner( const Chunk & stream )
+  : stream_( stream ),
+    next_( find_start_code( stream, 0 ) )
+{
+  if ( next_ < stream_.size() ) {
+    next_ += 3;
+  }
+}
+
+bool NalScanner::next( NalUnit & nal )
+{
+  const uint8_t * const data = stream_.buffer();
+
+  while ( next_ < stream_.size() ) {
+    const uint64_t start = next_;
+    uint64_t end = find_start_code( stream_, start );
+    next_ = ( end < stream_.size() ) ? end + 3 : end;
+
+    /* the leading zero of a four-byte start code, or trailing_zero_8bits */
+    while ( end > start and data[ end - 1 ] == 0 ) {
+      end--;
+    }
+
+    if ( end == start ) {
+      continue;
+    }
+
+    nal.offset = start;
+    nal.size = end - start;
+    nal.type = data[ start ] & 0x1f;
+    nal.ref_idc = ( data[ start ] >> 5 ) & 3;
+
+    /* first_mb_in_slice is the slice header's first ue(v); 0 codes as a 1 bit */
+    nal.first_slice = nal.is_slice() and nal.size > 1 and ( data[ start + 1 ] & 0x80 );
+
+    return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,71 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef NAL_SCANNER_HH
+#define NAL_SCANNER_HH
+
+/* finds the NAL units of an H.264 Annex B byte stream (what the H.264
+   encoders produce), without copying it: the stream is usually a mapped
+   File, and may be larger than memory */
+
+#include <cstdint>
+
+#include "chunk.hh"
+
+/* nal_unit_type values (H.264 table 7-1) */
+namespace nal {
+
+constexpr uint8_t SLICE = 1;
+constexpr uint8_t IDR = 5;
+constexpr uint8_t SEI = 6;
+constexpr uint8_t SPS = 7;
+constexpr uint8_t PPS = 8;
+constexpr uint8_t AUD = 9;
+
+constexpr uint8_t TYPE_COUNT = 32;
+
+}
+
+const char * nal_type_name( const uint8_t type );
+
+struct NalUnit
+{
+  uint64_t offset;   /* of the NAL header, just past the start code */
+  uint64_t size;     /* header and payload, without trailing zero bytes */
+  uint8_t type;
+  uint8_t ref_idc;
+
+  /* a slice with first_mb_in_slice == 0: the first slice of a picture */
+  bool first_slice;
+
+  bool is_slice( void ) const { return type == nal::SLICE or type == nal::IDR; }
+
+  /* whether this NAL begins a new access unit (frame), assuming the
+     current one already has a slice (H.264 7.4.1.2.3) */
+  bool starts_access_unit( void ) const;
+};
+
+/* offset of the first 00 00 01 at or after `from`, or the stream's size
+   if there is none; uses SSE2 where available */
+uint64_t find_start_code( const Chunk & stream, const uint64_t from );
+
+/* same for 00 00 followed by 00, 01, 02 or 03: in a NAL unit, always an
+   emulation prevention byte (03) after two zeros; in an RBSP, where one
+   has to be inserted */
+uint64_t find_escape( const Chunk & data, const uint64_t from );
+
+class NalScanner
+{
+private:
+  Chunk stream_;
+
+  /* the next NAL's header, or the stream's size when done */
+  uint64_t next_;
+
+public:
+  NalScanner( const Chunk & stream );
+
+  /* fills in the next NAL unit; false at the end of the stream */
+  bool next( NalUnit & nal );
+};
+
+#endif /* NAL_SCANNER_HH */
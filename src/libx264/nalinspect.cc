@@ -0,0 +1,132 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* lists the frames of an H.264 Annex B stream (such as sender's output):
+   one line per frame with its NAL units and their sizes, then totals by
+   NAL type. The stream is mapped, not read, so it can be any size. */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <sys/mman.h>
+
+#include "file.hh"
+#include "exception.hh"
+#include "nal_scanner.hh"
+#include "args.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+void usage()
+{
+  cerr << "nalinspect [--summary] <stream.h264>" << endl
+       << endl
+       << "  Prints: frame, offset, bytes, slices, then each NAL as type:bytes." << endl
+       << "  With --summary, only the totals are printed." << endl;
+}
+
+struct TypeStats
+{
+  uint64_t count { 0 };
+  uint64_t bytes { 0 };
+};
+
+/* the access unit being collected */
+struct FrameStats
+{
+  uint64_t offset { 0 };
+  uint64_t bytes { 0 };
+  size_t slices { 0 };
+  size_t nals { 0 };
+  ostringstream listing {};
+
+  void clear( const uint64_t new_offset )
+  {
+    offset = new_offset;
+    bytes = 0;
+    slices = 0;
+    nals = 0;
+    listing.str( "" );
+  }
+};
+
+int main( int argc, char const * argv[] )
+{
+  const bool summary_only = take_flag( argc, argv, "summary" );
+
+  if ( argc != 2 ) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  const File stream { argv[ 1 ] };
+  if ( stream.size() ) {
+    /* one pass, front to back */
+    madvise( const_cast<uint8_t *>( stream.chunk().buffer() ), stream.size(), MADV_SEQUENTIAL );
+  }
+
+  const auto start = steady_clock::now();
+
+  NalScanner scanner { stream.chunk() };
+  TypeStats totals[ nal::TYPE_COUNT ];
+  FrameStats frame;
+  uint64_t frame_count = 0;
+  uint64_t slice_count = 0;
+
+  auto finish_frame = [&]()
+    {
+      if ( frame.nals and not summary_only ) {
+        cout << frame_count << "\t" << frame.offset << "\t" << frame.bytes << "\t"
+             << frame.slices << "\t" << frame.listing.str() << "\n";
+      }
+      frame_count += ( frame.slices > 0 );
+    };
+
+  for ( NalUnit unit; scanner.next( unit ); ) {
+    if ( frame.slices and unit.starts_access_unit() ) {
+      finish_frame();
+      frame.clear( unit.offset );
+    }
+    else if ( frame.nals == 0 ) {
+      frame.offset = unit.offset;
+    }
+
+    totals[ unit.type ].count++;
+    totals[ unit.type ].bytes += unit.size;
+
+    frame.bytes += unit.size;
+    frame.slices += unit.is_slice();
+    frame.nals++;
+    slice_count += unit.is_slice();
+
+    if ( not summary_only ) {
+      frame.listing << ( frame.nals > 1 ? " " : "" ) << nal_type_name( unit.type ) << ":" << unit.size;
+    }
+  }
+
+  finish_frame();
+
+  const double seconds = duration<double>( steady_clock::now() - start ).count();
+
+  cout << "frames: " << frame_count << ", slices: " << slice_count;
+  if ( frame_count ) {
+    cout << " (" << double( slice_count ) / frame_count << " per frame)";
+  }
+  cout << endl;
+
+  for ( uint8_t type = 0; type < nal::TYPE_COUNT; type++ ) {
+    const TypeStats & t = totals[ type ];
+    if ( t.count ) {
+      cout << setw( 14 ) << nal_type_name( type ) << " (" << int( type ) << "): "
+           << t.count << " NALs, " << t.bytes << " bytes, mean " << t.bytes / t.count << endl;
+    }
+  }
+
+  cerr << "scanned " << stream.size() / 1e6 << " MB in " << seconds * 1000 << " ms ("
+       << ( seconds > 0 ? stream.size() / seconds / 1e9 : 0 ) << " GB/s)" << endl;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,263 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#include "quality.hh"
+
+using namespace std;
+
+namespace {
+
+/* sums of one 4x4 block; SSIM windows are made of 2x2 of them */
+struct BlockSums
+{
+  uint32_t sum_a;
+  uint32_t sum_b;
+  uint32_t sum_aa_bb;
+  uint32_t sum_ab;
+};
+
+uint64_t row_sse_scalar( const uint8_t * a, const uint8_t * b, const size_t width )
+{
+  uint64_t sse = 0;
+  for ( size_t i = 0; i < width; i++ ) {
+    const int diff = a[ i ] - b[ i ];
+    sse += diff * diff;
+  }
+  return sse;
+}
+
+void block_sums_scalar( const uint8_t * a, const uint8_t * b, const size_t stride,
+                        const size_t first_block, const size_t blocks, BlockSums * sums )
+{
+  for ( size_t block = first_block; block < blocks; block++ ) {
+    BlockSums s { 0, 0, 0, 0 };
+
+    for ( size_t row = 0; row < 4; row++ ) {
+      const uint8_t * pa = a + row * stride + block * 4;
+      const uint8_t * pb = b + row * stride + block * 4;
+
+      for ( size_t i = 0; i < 4; i++ ) {
+        s.sum_a += pa[ i ];
+        s.sum_b += pb[ i ];
+        s.sum_aa_bb += pa[ i ] * pa[ i ] + pb[ i ] * pb[ i ];
+        s.sum_ab += pa[ i ] * pb[ i ];
+      }
+    }
+
+    sums[ block ] = s;
+  }
+}
+
+#if defined( __SSE2__ )
+
+/* 16 pixels at a time; a lane of _mm_madd_epi16 holds at most 2 * 255^2,
+   so the 32-bit lanes are safe for rows of over 100000 pixels */
+uint64_t row_sse( const uint8_t * a, const uint8_t * b, const size_t width )
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  size_t x = 0;
+
+  for ( ; x + 16 <= width; x += 16 ) {
+    const __m128i va = _mm_loadu_si128( reinterpret_cast<const __m128i *>( a + x ) );
+    const __m128i vb = _mm_loadu_si128( reinterpret_cast<const __m128i *>( b + x ) );
+
+    const __m128i diff_lo = _mm_sub_epi16( _mm_unpacklo_epi8( va, zero ), _mm_unpacklo_epi8( vb, zero ) );
+    const __m128i diff_hi = _mm_sub_epi16( _mm_unpackhi_epi8( va, zero ), _mm_unpackhi_epi8( vb, zero ) );
+
+    acc = _mm_add_epi32( acc, _mm_madd_epi16( diff_lo, diff_lo ) );
+    acc = _mm_add_epi32( acc, _mm_madd_epi16( diff_hi, diff_hi ) );
+  }
+
+  uint32_t lanes[ 4 ];
+  _mm_storeu_si128( reinterpret_cast<__m128i *>( lanes ), acc );
+
+  return uint64_t( lanes[ 0 ] ) + lanes[ 1 ] + lanes[ 2 ] + lanes[ 3 ]
+         + row_sse_scalar( a + x, b + x, width - x );
+}
+
+/* the pair sums in lanes 0 and 1, and 2 and 3, are the sums of two blocks */
+inline void store_pairs( const __m128i v, uint32_t & first, uint32_t & second )
+{
+  const __m128i pairs = _mm_add_epi32( v, _mm_srli_epi64( v, 32 ) );
+  first = _mm_cvtsi128_si32( pairs );
+  second = _mm_cvtsi128_si32( _mm_srli_si128( pairs, 8 ) );
+}
+
+/* four blocks (16 pixels by 4 rows) at a time */
+void block_sums( const uint8_t * a, const uint8_t * b, const size_t stride,
+                 const size_t blocks, BlockSums * sums )
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16( 1 );
+  size_t block = 0;
+
+  for ( ; block + 4 <= blocks; block += 4 ) {
+    __m128i sum_a[ 2 ] = { zero, zero }, sum_b[ 2 ] = { zero, zero };
+    __m128i sum_aa_bb[ 2 ] = { zero, zero }, sum_ab[ 2 ] = { zero, zero };
+
+    for ( size_t row = 0; row < 4; row++ ) {
+      const __m128i va = _mm_loadu_si128( reinterpret_cast<const __m128i *>( a + row * stride + block * 4 ) );
+      const __m128i vb = _mm_loadu_si128( reinterpret_cast<const __m128i *>( b + row * stride + block * 4 ) );
+      const __m128i wa[ 2 ] = { _mm_unpacklo_epi8( va, zero ), _mm_unpackhi_epi8( va, zero ) };
+      const __m128i wb[ 2 ] = { _mm_unpacklo_epi8( vb, zero ), _mm_unpackhi_epi8( vb, zero ) };
+
+      for ( size_t half = 0; half < 2; half++ ) {
+        sum_a[ half ] = _mm_add_epi32( sum_a[ half ], _mm_madd_epi16( wa[ half ], ones ) );
+        sum_b[ half ] = _mm_add_epi32( sum_b[ half ], _mm_madd_epi16( wb[ half ], ones ) );
+        sum_aa_bb[ half ] = _mm_add_epi32( sum_aa_bb[ half ],
+                                           _mm_add_epi32( _mm_madd_epi16( wa[ half ], wa[ half ] ),
+                                                          _mm_madd_epi16( wb[ half ], wb[ half ] ) ) );
+        sum_ab[ half ] = _mm_add_epi32( sum_ab[ half ], _mm_madd_epi16( wa[ half ], wb[ half ] ) );
+      }
+    }
+
+    for ( size_t half = 0; half < 2; half++ ) {
+      BlockSums & first = sums[ block + 2 * half ];
+      BlockSums & second = sums[ block + 2 * half + 1 ];
+
+      store_pairs( sum_a[ half ], first.sum_a, second.sum_a );
+      store_pairs( sum_b[ half ], first.sum_b, second.sum_b );
+      store_pairs( sum_aa_bb[ half ], first.sum_aa_bb, second.sum_aa_bb );
+      store_pairs( sum_ab[ half ], first.sum_ab, second.sum_ab );
+    }
+  }
+
+  block_sums_scalar( a, b, stride, block, blocks, sums );
+}
+
+#else
+
+uint64_t row_sse( const uint8_t * a, const uint8_t * b, const size_t width )
+{
+  return row_sse_scalar( a, b, width );
+}
+
+void block_sums( const uint8_t * a, const uint8_t * b, const size_t stride,
+                 const size_t blocks, BlockSums * sums )
+{
+  block_sums_scalar( a, b, stride, 0, blocks, sums );
+}
+
+#endif
+
+/* SSIM of one 8x8 window, from its four blocks */
+double window_ssim( const BlockSums & s0, const BlockSums & s1,
+                    const BlockSums & s2, const BlockSums & s3 )
+{
+  const double c1 = ( 0.01 * 255 ) * ( 0.01 * 255 );
+  const double c2 = ( 0.03 * 255 ) * ( 0.03 * 255 );
+  const double count = 64;
+
+  const double mean_a = ( s0.sum_a + s1.sum_a + s2.sum_a + s3.sum_a ) / count;
+  const double mean_b = ( s0.sum_b + s1.sum_b + s2.sum_b + s3.sum_b ) / count;
+  const double variance_sum = ( double( s0.sum_aa_bb ) + s1.sum_aa_bb + s2.sum_aa_bb + s3.sum_aa_bb ) / count
+                              - mean_a * mean_a - mean_b * mean_b;
+  const double covariance = ( double( s0.sum_ab ) + s1.sum_ab + s2.sum_ab + s3.sum_ab ) / count
+                            - mean_a * mean_b;
+
+  return ( ( 2 * mean_a * mean_b + c1 ) * ( 2 * covariance + c2 ) )
+         / ( ( mean_a * mean_a + mean_b * mean_b + c1 ) * ( variance_sum + c2 ) );
+}
+
+double sse_to_psnr( const uint64_t sse, const size_t samples )
+{
+  if ( sse == 0 ) {
+    return MAX_PSNR;
+  }
+
+  return 10.0 * log10( 255.0 * 255.0 * samples / sse );
+}
+
+}
+
+uint64_t plane_sse( const uint8_t * a, const uint8_t * b,
+                    const size_t width, const size_t height, const size_t stride )
+{
+  uint64_t sse = 0;
+  for ( size_t row = 0; row < height; row++ ) {
+    sse += row_sse( a + row * stride, b + row * stride, width );
+  }
+  return sse;
+}
+
+double psnr( const uint8_t * a, const uint8_t * b, const size_t width, const size_t height )
+{
+  return sse_to_psnr( plane_sse( a, b, width, height, width ), width * height );
+}
+
+double plane_ssim( const uint8_t * a, const uint8_t * b,
+                   const size_t width, const size_t height, const size_t stride )
+{
+  const size_t blocks_x = width / 4;
+  const size_t blocks_y = height / 4;
+
+  if ( blocks_x < 2 or blocks_y < 2 ) {
+    return 1.0;
+  }
+
+  /* two rows of blocks: the top and bottom halves of a row of windows */
+  vector<BlockSums> above( blocks_x ), below( blocks_x );
+  block_sums( a, b, stride, blocks_x, above.data() );
+
+  double total = 0;
+  for ( size_t block_y = 1; block_y < blocks_y; block_y++ ) {
+    block_sums( a + block_y * 4 * stride, b + block_y * 4 * stride, stride, blocks_x, below.data() );
+
+    for ( size_t x = 0; x + 1 < blocks_x; x++ ) {
+      total += window_ssim( above[ x ], above[ x + 1 ], below[ x ], below[ x + 1 ] );
+    }
+
+    swap( above, below );
+  }
+
+  return total / ( ( blocks_x - 1 ) * ( blocks_y - 1 ) );
+}
+
+double ssim( const uint8_t * a, const uint8_t * b, const size_t width, const size_t height )
+{
+  return plane_ssim( a, b, width, height, width );
+}
+
+FrameQuality measure_quality( const uint8_t * source, const uint8_t * shown,
+                              const size_t width, const size_t height )
+{
+  const size_t luma = width * height;
+  const size_t chroma = luma / 4;
+
+  const uint64_t y_sse = plane_sse( source, shown, width, height, width );
+  const uint64_t u_sse = plane_sse( source + luma, shown + luma, width / 2, height / 2, width / 2 );
+  const uint64_t v_sse = plane_sse( source + luma + chroma, shown + luma + chroma,
+                                    width / 2, height / 2, width / 2 );
+
+  return { sse_to_psnr( y_sse, luma ),
+           sse_to_psnr( y_sse + u_sse + v_sse, luma + 2 * chroma ),
+           plane_ssim( source, shown, width, height, width ) };
+}
+
+void QualitySummary::add( const FrameQuality & frame )
+{
+  frames++;
+  psnr_y += frame.psnr_y;
+  psnr += frame.psnr;
+  ssim += frame.ssim;
+  worst_psnr_y = min( worst_psnr_y, frame.psnr_y );
+}
+
+void QualitySummary::print( ostream & out ) const
+{
+  if ( frames == 0 ) {
+    return;
+  }
+
+  out << "quality over " << frames << " frames: luma PSNR " << psnr_y / frames
+      << " dB (worst " << worst_psnr_y << " dB), PSNR " << psnr / frames
+      << " dB, SSIM " << ssim / frames << endl;
+}
@@ -0,0 +1,49 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef QUALITY_HH
+#define QUALITY_HH
+
+/* objective quality of a decoded picture against its source. The plane
+   kernels use SSE2 where available; psnr() and ssim() look at the luma
+   plane of two I420 rasters of the same size. */
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/* in dB; identical pictures are capped at MAX_PSNR */
+constexpr double MAX_PSNR = 100.0;
+
+uint64_t plane_sse( const uint8_t * a, const uint8_t * b,
+                    const size_t width, const size_t height, const size_t stride );
+double psnr( const uint8_t * a, const uint8_t * b, const size_t width, const size_t height );
+
+/* mean SSIM of the 8x8 windows on a 4-pixel grid, in [0, 1] */
+double plane_ssim( const uint8_t * a, const uint8_t * b,
+                   const size_t width, const size_t height, const size_t stride );
+double ssim( const uint8_t * a, const uint8_t * b, const size_t width, const size_t height );
+
+struct FrameQuality
+{
+  double psnr_y;   /* luma only */
+  double psnr;     /* all three planes */
+  double ssim;     /* luma */
+};
+
+FrameQuality measure_quality( const uint8_t * source, const uint8_t * shown,
+                              const size_t width, const size_t height );
+
+/* means over a run of frames */
+struct QualitySummary
+{
+  size_t frames { 0 };
+  double psnr_y { 0 };
+  double psnr { 0 };
+  double ssim { 0 };
+  double worst_psnr_y { MAX_PSNR };
+
+  void add( const FrameQuality & frame );
+  void print( std::ostream & out ) const;
+};
+
+#endif /* QUALITY_HH */
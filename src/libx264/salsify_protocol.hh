@@ -0,0 +1,169 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef SALSIFY_PROTOCOL_HH
+#define SALSIFY_PROTOCOL_HH
+
+#include <endian.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+#include "hash.hh"
+#include "chunk.hh"
+#include "gop_mode.hh"
+
+typedef std::vector<uint8_t> Raster;
+typedef std::vector<uint8_t> Frame;
+
+/* Every frame is coded against a numbered decoder state (the raster the
+   receiver shows after decoding some earlier frame) and, once decoded,
+   produces the state numbered after the frame itself. */
+
+/* the state of a receiver that has not decoded anything yet */
+constexpr uint32_t INITIAL_STATE = 0;
+
+namespace wire {
+
+inline void put_le16( std::string & out, const uint16_t val )
+{
+  const uint16_t le = htole16( val );
+  out.append( reinterpret_cast<const char *>( &le ), sizeof( le ) );
+}
+
+inline void put_le32( std::string & out, const uint32_t val )
+{
+  const uint32_t le = htole32( val );
+  out.append( reinterpret_cast<const char *>( &le ), sizeof( le ) );
+}
+
+inline void put_le64( std::string & out, const uint64_t val )
+{
+  const uint64_t le = htole64( val );
+  out.append( reinterpret_cast<const char *>( &le ), sizeof( le ) );
+}
+
+}
+
+/* what FrameHeader::state_hash carries; 0 is reserved for "not given" */
+inline uint64_t state_hash( const Raster & raster )
+{
+  const uint64_t hash = bulk_hash64( raster.data(), raster.size() );
+  return hash ? hash : 1;
+}
+
+/* A frame is either sent whole, or streamed as it is encoded: one record
+   per slice (`more` set, `part` counting up from 0), then a final record
+   without `more` that completes the frame. The part number has 5 bits, so
+   a frame is streamed as at most MAX_PARTS records: the sender puts any
+   slices past that into the final record. A `repeat` record has no
+   payload: the source did not change, and the receiver keeps showing
+   base_state without decoding anything. */
+
+struct FrameHeader
+{
+  static constexpr size_t SIZE = 24;
+
+  /* records per streamed frame, the final one included */
+  static constexpr uint8_t MAX_PARTS = 32;
+
+  uint32_t frame_no;
+  uint32_t base_state;
+  uint32_t length;
+  uint16_t quantizer;
+
+  /* the receiver must rebuild its decoder from base_state by re-encoding
+     that raster at `quantizer` before it can decode this frame */
+  bool resync;
+
+  /* how the sender's encoders (and so the receiver's resync encoder) are set up */
+  GopMode gop;
+
+  /* set on every part of a streamed frame but the last */
+  bool more { false };
+
+  /* this record's position within a streamed frame (0 if sent whole) */
+  uint8_t part { 0 };
+
+  /* state_hash() of the raster the sender decoded from this frame, so the
+     receiver can check it shows the same; 0 on records with `more` set */
+  uint64_t state_hash { 0 };
+
+  /* nothing to decode: base_state is shown again, and stays the receiver's state */
+  bool repeat { false };
+
+  std::string serialize( void ) const
+  {
+    std::string out;
+    out.reserve( SIZE );
+    serialize( out );
+    return out;
+  }
+
+  /* into `out`, reusing its buffer */
+  void serialize( std::string & out ) const
+  {
+    if ( part >= MAX_PARTS ) {
+      throw std::runtime_error( "FrameHeader: too many parts" );
+    }
+
+    out.clear();
+    wire::put_le32( out, frame_no );
+    wire::put_le32( out, base_state );
+    wire::put_le32( out, length );
+    wire::put_le16( out, quantizer );
+    out.push_back( ( resync ? 1 : 0 ) | ( more ? 2 : 0 ) | ( part << 2 )
+                   | ( repeat ? 0x80 : 0 ) );
+    out.push_back( static_cast<char>( gop ) );
+    wire::put_le64( out, state_hash );
+  }
+
+  static FrameHeader parse( const Chunk & chunk )
+  {
+    const uint8_t flags = chunk( 14, 1 ).octet();
+    const uint8_t gop = chunk( 15, 1 ).octet();
+    if ( gop > static_cast<uint8_t>( GopMode::INTRA_REFRESH ) ) {
+      throw std::runtime_error( "FrameHeader: invalid GOP mode" );
+    }
+
+    return { static_cast<uint32_t>( chunk( 0, 4 ).le32() ),
+             static_cast<uint32_t>( chunk( 4, 4 ).le32() ),
+             static_cast<uint32_t>( chunk( 8, 4 ).le32() ),
+             chunk( 12, 2 ).le16(),
+             ( flags & 1 ) != 0,
+             static_cast<GopMode>( gop ),
+             ( flags & 2 ) != 0,
+             static_cast<uint8_t>( ( flags >> 2 ) % MAX_PARTS ),
+             chunk( 16, 8 ).le64(),
+             ( flags & 0x80 ) != 0 };
+  }
+};
+
+/* receiver -> sender feedback, sent for every frame that arrives */
+struct Ack
+{
+  static constexpr size_t SIZE = 9;
+
+  uint32_t frame_no;  /* the frame that just arrived */
+  uint32_t state;     /* the state the receiver holds after handling it */
+  bool applied;       /* false if the frame's base state was unavailable */
+
+  std::string serialize( void ) const
+  {
+    std::string out;
+    out.reserve( SIZE );
+    wire::put_le32( out, frame_no );
+    wire::put_le32( out, state );
+    out.push_back( applied ? 1 : 0 );
+    return out;
+  }
+
+  static Ack parse( const Chunk & chunk )
+  {
+    return { static_cast<uint32_t>( chunk( 0, 4 ).le32() ),
+             static_cast<uint32_t>( chunk( 4, 4 ).le32() ),
+             chunk( 8, 1 ).octet() != 0 };
+  }
+};
+
+#endif /* SALSIFY_PROTOCOL_HH */
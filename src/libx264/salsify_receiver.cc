@@ -0,0 +1,526 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "salsify_receiver.hh"
+#include "timeline.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+template <class Backend>
+SalsifyReceiver<Backend>::SalsifyReceiver( const uint16_t width, const uint16_t height,
+                                           const size_t capacity, const bool speculate )
+  : width_( width ), height_( height ), capacity_( capacity ),
+    speculate_( speculate ),
+    blank_raster_( ( width * height * 3 ) / 2 ),
+    scratch_raster_( blank_raster_.size() ),
+    temp_frame_( blank_raster_.size() )
+{
+  if ( capacity_ == 0 ) {
+    throw runtime_error( "SalsifyReceiver: must keep at least one state" );
+  }
+}
+
+template <class Backend>
+SalsifyReceiver<Backend>::~SalsifyReceiver()
+{
+  {
+    lock_guard<mutex> lock { mutex_ };
+    stopping_ = true;
+  }
+
+  /* a job that is running finishes first */
+  changed_.notify_all();
+
+  if ( worker_.joinable() ) {
+    worker_.join();
+  }
+}
+
+template <class Backend>
+const Raster & SalsifyReceiver<Backend>::raster( void ) const
+{
+  for ( const auto & s : states_ ) {
+    if ( s.id == state_ ) {
+      return s.raster;
+    }
+  }
+
+  return blank_raster_;
+}
+
+template <class Backend>
+typename SalsifyReceiver<Backend>::DecoderState *
+SalsifyReceiver<Backend>::find( const uint32_t id )
+{
+  for ( auto it = states_.begin(); it != states_.end(); it++ ) {
+    if ( it->id == id ) {
+      states_.splice( states_.begin(), states_, it );
+      return &states_.front();
+    }
+  }
+
+  return nullptr;
+}
+
+template <class Backend>
+unique_ptr<typename Backend::Decoder> SalsifyReceiver<Backend>::acquire_decoder( void )
+{
+  const auto start = steady_clock::now();
+
+  if ( spare_decoders_.empty() ) {
+    unique_ptr<Decoder> decoder = make_unique<Decoder>( width_, height_ );
+    decoders_built_++;
+    build_time_ += steady_clock::now() - start;
+    return decoder;
+  }
+
+  unique_ptr<Decoder> decoder = move( spare_decoders_.back() );
+  spare_decoders_.pop_back();
+  decoder->reset();
+  decoders_reset_++;
+  reset_time_ += steady_clock::now() - start;
+  return decoder;
+}
+
+template <class Backend>
+typename SalsifyReceiver<Backend>::DecoderStats
+SalsifyReceiver<Backend>::decoder_stats( void ) const
+{
+  return { decoders_built_, duration<double, milli>( build_time_ ).count(),
+           decoders_reset_, duration<double, milli>( reset_time_ ).count() };
+}
+
+template <class Backend>
+unique_ptr<typename Backend::Decoder>
+SalsifyReceiver<Backend>::prime( const Raster & raster,
+                                 const uint16_t quantizer, const GopMode gop,
+                                 unique_ptr<Decoder> && decoder,
+                                 Frame & temp_frame, Raster & scratch ) const
+{
+  TimelineSpan span { "prime" };
+  span.arg( "quantizer", quantizer );
+
+  /* reproduce what the sender's encoder was rebuilt on */
+  Encoder encoder { width_, height_, quantizer, gop };
+  const size_t temp_frame_size = encoder.encode( const_cast<uint8_t *>( raster.data() ),
+                                                 temp_frame.data() );
+
+  decoder->decode( temp_frame.data(), temp_frame_size, scratch.data() );
+  return move( decoder );
+}
+
+template <class Backend>
+unique_ptr<typename Backend::Decoder>
+SalsifyReceiver<Backend>::resync( const FrameHeader & header, DecoderState * base )
+{
+  if ( header.base_state == INITIAL_STATE ) {
+    return acquire_decoder();
+  }
+
+  if ( base == nullptr ) {
+    return nullptr;
+  }
+
+  return prime( base->raster, header.quantizer, header.gop, acquire_decoder(),
+                temp_frame_, scratch_raster_ );
+}
+
+/* the caller holds mutex_ */
+template <class Backend>
+typename SalsifyReceiver<Backend>::Speculation *
+SalsifyReceiver<Backend>::find_speculation( const uint32_t base, const uint16_t quantizer,
+                                            const GopMode gop )
+{
+  for ( auto & speculation : speculations_ ) {
+    if ( speculation.status != Speculation::Status::EMPTY
+         and speculation.base == base and speculation.quantizer == quantizer
+         and speculation.gop == gop ) {
+      return &speculation;
+    }
+  }
+
+  return nullptr;
+}
+
+/* empties a job that is not running; the caller holds mutex_ */
+template <class Backend>
+void SalsifyReceiver<Backend>::release_speculation( Speculation & speculation )
+{
+  if ( speculation.decoder ) {
+    spare_decoders_.push_back( move( speculation.decoder ) );
+  }
+
+  speculation.error = nullptr;
+  speculation.status = Speculation::Status::EMPTY;
+}
+
+/* a slot for a new job: an empty one, a new one while there are fewer
+   than the states kept for each other quality, or else the oldest result
+   (or queued job) whose state is gone, then the oldest of all; the
+   caller holds mutex_ */
+template <class Backend>
+typename SalsifyReceiver<Backend>::Speculation &
+SalsifyReceiver<Backend>::claim_speculation( void )
+{
+  Speculation * victim = nullptr;
+  bool victim_kept = true;
+
+  for ( auto & speculation : speculations_ ) {
+    if ( speculation.status == Speculation::Status::EMPTY ) {
+      return speculation;
+    }
+
+    if ( speculation.status == Speculation::Status::RUNNING ) {
+      continue;
+    }
+
+    const bool kept = std::any_of( states_.begin(), states_.end(),
+                                   [&]( const DecoderState & state )
+                                   { return state.id == speculation.base; } );
+
+    if ( victim == nullptr or ( victim_kept and not kept )
+         or ( victim_kept == kept and speculation.serial < victim->serial ) ) {
+      victim = &speculation;
+      victim_kept = kept;
+    }
+  }
+
+  if ( victim == nullptr or speculations_.size() < capacity_ * ( quantizers_.size() - 1 ) ) {
+    speculations_.push_back( { Speculation::Status::EMPTY, 0, 0, GopMode::INFINITE_GOP, 0,
+                               Raster( blank_raster_.size() ), Frame( temp_frame_.size() ),
+                               Raster( scratch_raster_.size() ), nullptr, nullptr } );
+    return speculations_.back();
+  }
+
+  release_speculation( *victim );
+  return *victim;
+}
+
+template <class Backend>
+unique_ptr<typename Backend::Decoder>
+SalsifyReceiver<Backend>::take_speculation( const FrameHeader & header )
+{
+  /* nothing else needs the jobs to be done */
+  if ( not header.resync ) {
+    return nullptr;
+  }
+
+  unique_lock<mutex> lock { mutex_ };
+  Speculation * const match = find_speculation( header.base_state, header.quantizer, header.gop );
+
+  if ( match == nullptr ) {
+    return nullptr;
+  }
+
+  if ( match->status == Speculation::Status::QUEUED ) {
+    /* priming it here is no slower than waiting for the jobs ahead of it */
+    release_speculation( *match );
+    return nullptr;
+  }
+
+  TimelineSpan span { "wait speculation" };
+  span.arg( "frame", header.frame_no );
+
+  const auto start = steady_clock::now();
+  changed_.wait( lock, [&]() { return match->status == Speculation::Status::DONE; } );
+  speculation_wait_ += steady_clock::now() - start;
+
+  if ( match->error ) {
+    const exception_ptr error = match->error;
+    release_speculation( *match );
+    rethrow_exception( error );
+  }
+
+  unique_ptr<Decoder> decoder = move( match->decoder );
+  release_speculation( *match );
+  speculation_hits_++;
+  return decoder;
+}
+
+template <class Backend>
+void SalsifyReceiver<Backend>::cancel_speculations( void )
+{
+  lock_guard<mutex> lock { mutex_ };
+
+  for ( auto & speculation : speculations_ ) {
+    if ( speculation.status == Speculation::Status::QUEUED ) {
+      release_speculation( speculation );
+    }
+  }
+}
+
+template <class Backend>
+void SalsifyReceiver<Backend>::start_speculations( const DecoderState & state,
+                                                   const FrameHeader & header )
+{
+  const uint16_t quantizer = header.quantizer;
+
+  if ( std::find( quantizers_.begin(), quantizers_.end(), quantizer ) == quantizers_.end() ) {
+    quantizers_.push_back( quantizer );
+  }
+
+  if ( not speculate_ or quantizers_.size() < 2 ) {
+    return;
+  }
+
+  if ( speculation_paused_ ) {
+    cancel_speculations();
+    return;
+  }
+
+  if ( not worker_.joinable() ) {
+    worker_ = thread( [this]() { speculate(); } );
+  }
+
+  {
+    lock_guard<mutex> lock { mutex_ };
+
+    for ( const uint16_t q : quantizers_ ) {
+      if ( q == quantizer or find_speculation( state.id, q, header.gop ) ) {
+        continue;
+      }
+
+      Speculation & speculation = claim_speculation();
+      speculation.base = state.id;
+      speculation.quantizer = q;
+      speculation.gop = header.gop;
+      speculation.serial = next_serial_++;
+      speculation.raster = state.raster;
+      speculation.decoder = acquire_decoder();
+      speculation.status = Speculation::Status::QUEUED;
+    }
+  }
+
+  changed_.notify_all();
+}
+
+/* the speculation thread: runs the queued jobs, oldest first */
+template <class Backend>
+void SalsifyReceiver<Backend>::speculate( void )
+{
+  if ( Timeline * const timeline = Timeline::active() ) {
+    timeline->name_thread( "speculation" );
+  }
+
+  unique_lock<mutex> lock { mutex_ };
+
+  while ( true ) {
+    Speculation * next = nullptr;
+
+    changed_.wait( lock, [&]()
+      {
+        next = nullptr;
+
+        for ( auto & speculation : speculations_ ) {
+          if ( speculation.status == Speculation::Status::QUEUED
+               and ( next == nullptr or speculation.serial < next->serial ) ) {
+            next = &speculation;
+          }
+        }
+
+        return stopping_ or next != nullptr;
+      } );
+
+    if ( stopping_ ) {
+      return;
+    }
+
+    next->status = Speculation::Status::RUNNING;
+    lock.unlock();
+
+    try {
+      next->decoder = prime( next->raster, next->quantizer, next->gop, move( next->decoder ),
+                             next->temp_frame, next->scratch );
+    }
+    catch ( ... ) {
+      next->error = current_exception();
+    }
+
+    lock.lock();
+    next->status = Speculation::Status::DONE;
+    changed_.notify_all();
+  }
+}
+
+template <class Backend>
+double SalsifyReceiver<Backend>::speculation_wait_ms( void ) const
+{
+  return duration<double, milli>( speculation_wait_ ).count();
+}
+
+template <class Backend>
+typename SalsifyReceiver<Backend>::DecoderState &
+SalsifyReceiver<Backend>::make_state( const uint32_t id )
+{
+  if ( states_.size() < capacity_ ) {
+    states_.push_front( { id, Raster( blank_raster_.size() ), nullptr } );
+  }
+  else {
+    /* recycle the least recently used state, buffers and all */
+    states_.splice( states_.begin(), states_, prev( states_.end() ) );
+    states_.front().id = id;
+
+    if ( states_.front().decoder ) {
+      spare_decoders_.push_back( move( states_.front().decoder ) );
+    }
+  }
+
+  return states_.front();
+}
+
+template <class Backend>
+unique_ptr<typename Backend::Decoder>
+SalsifyReceiver<Backend>::take_decoder( const FrameHeader & header )
+{
+  unique_ptr<Decoder> decoder = take_speculation( header );
+  DecoderState * base = find( header.base_state );
+
+  if ( decoder ) {
+    /* the switch was prepared in the background */
+  }
+  else if ( header.resync ) {
+    TimelineSpan span { "resync" };
+    span.arg( "frame", header.frame_no ).arg( "base", header.base_state );
+    decoder = resync( header, base );
+  }
+  else if ( base != nullptr ) {
+    decoder = move( base->decoder );
+  }
+
+  if ( decoder and base != nullptr and header.base_state != state_ ) {
+    older_base_frames_++;
+  }
+
+  return decoder;
+}
+
+template <class Backend>
+Ack SalsifyReceiver<Backend>::apply( const FrameHeader & header, DecoderState & next,
+                                     unique_ptr<Decoder> && decoder )
+{
+  next.decoder = move( decoder );
+  state_ = header.frame_no;
+
+  if ( header.state_hash != 0 and header.state_hash != state_hash( next.raster ) ) {
+    if ( divergences_++ == 0 ) {
+      first_divergence_ = header.frame_no;
+    }
+  }
+
+  start_speculations( next, header );
+
+  return { header.frame_no, state_, true };
+}
+
+template <class Backend>
+void SalsifyReceiver<Backend>::drop_partial( void )
+{
+  /* it has decoded part of a frame, so it is only good for a reset */
+  if ( partial_decoder_ ) {
+    spare_decoders_.push_back( move( partial_decoder_ ) );
+  }
+}
+
+template <class Backend>
+void SalsifyReceiver<Backend>::receive_part( const FrameHeader & header, const Chunk & part )
+{
+  if ( part.size() != header.length ) {
+    throw runtime_error( "SalsifyReceiver: part length does not match its header" );
+  }
+
+  if ( header.part == 0 ) {
+    drop_partial();
+    partial_decoder_ = take_decoder( header );
+    partial_frame_no_ = header.frame_no;
+    next_part_ = 0;
+  }
+  else if ( header.frame_no != partial_frame_no_ or header.part != next_part_ ) {
+    /* lost a part: the frame cannot be decoded anymore */
+    drop_partial();
+    return;
+  }
+
+  if ( partial_decoder_ ) {
+    partial_decoder_->decode_part( part.buffer(), part.size() );
+    next_part_++;
+  }
+}
+
+template <class Backend>
+Ack SalsifyReceiver<Backend>::finish_parts( const FrameHeader & header, const Chunk & last_part )
+{
+  if ( not partial_decoder_ or header.frame_no != partial_frame_no_
+       or header.part != next_part_ ) {
+    drop_partial();
+    return { header.frame_no, state_, false };
+  }
+
+  unique_ptr<Decoder> decoder = move( partial_decoder_ );
+
+  if ( last_part.size() ) {
+    decoder->decode_part( last_part.buffer(), last_part.size() );
+  }
+
+  DecoderState & next = make_state( header.frame_no );
+  decoder->finish_frame( next.raster.data() );
+  return apply( header, next, move( decoder ) );
+}
+
+template <class Backend>
+Ack SalsifyReceiver<Backend>::repeat( const FrameHeader & header )
+{
+  drop_partial();
+
+  /* the state just stays current, decoder and all */
+  if ( header.base_state != INITIAL_STATE and find( header.base_state ) == nullptr ) {
+    return { header.frame_no, state_, false };
+  }
+
+  state_ = header.base_state;
+  repeats_++;
+  return { header.frame_no, state_, true };
+}
+
+template <class Backend>
+Ack SalsifyReceiver<Backend>::receive( const FrameHeader & header, const Chunk & frame )
+{
+  if ( frame.size() != header.length ) {
+    throw runtime_error( "SalsifyReceiver: frame length does not match its header" );
+  }
+
+  if ( header.repeat ) {
+    return repeat( header );
+  }
+
+  if ( header.part != 0 ) {
+    return finish_parts( header, frame );
+  }
+
+  drop_partial();
+
+  unique_ptr<Decoder> decoder = take_decoder( header );
+
+  if ( not decoder ) {
+    return { header.frame_no, state_, false };
+  }
+
+  DecoderState & next = make_state( header.frame_no );
+
+  {
+    TimelineSpan span { "decode" };
+    span.arg( "frame", header.frame_no ).arg( "quantizer", header.quantizer )
+        .arg( "bytes", frame.size() );
+    decoder->decode( const_cast<uint8_t *>( frame.buffer() ), frame.size(), next.raster.data() );
+  }
+
+  return apply( header, next, move( decoder ) );
+}
+
+template class SalsifyReceiver<H264Backend>;
+template class SalsifyReceiver<X264Backend>;
+template class SalsifyReceiver<VP8Backend>;
+template class SalsifyReceiver<BandedH264Backend>;
+template class SalsifyReceiver<BandedX264Backend>;
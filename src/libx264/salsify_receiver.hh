@@ -0,0 +1,215 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef SALSIFY_RECEIVER_HH
+#define SALSIFY_RECEIVER_HH
+
+#include <list>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <exception>
+#include <condition_variable>
+
+#include "salsify_protocol.hh"
+#include "codec_backend.hh"
+
+/* Decodes frames produced by SalsifySender. The receiver remembers the last
+   few states it decoded (the raster, plus the decoder that produced it if
+   that decoder has not moved on), so a frame coded against any of them can
+   be applied. A frame whose base state is gone is dropped, and the returned
+   Ack tells the sender to resync.
+
+   This does not make a switch free: the sender still rebuilds the encoders
+   that lose a frame, and the receiver still primes a decoder with their
+   resync. What the states save is building decoders (a spare one is reset
+   instead), and the frames the sender codes against an older state after a
+   loss, which apply instead of being dropped; decoder_stats() and
+   older_base_frames() say how much that was.
+
+   After applying a frame, the receiver speculatively prepares the resync a
+   switch to each other quality would need (a decoder primed with the
+   re-encoded raster) on a background thread, so the switch itself only
+   costs a decoder handoff. Each job works on its own copy of the raster,
+   so only a resync that matches one waits for it; primed decoders are kept
+   (a few per quality) for as long as nothing needs their slot, since the
+   sender can still resync against an older state after a loss.
+
+   Backend is one of the policies in codec_backend.hh, and has to match
+   the sender's. */
+
+template <class Backend>
+class SalsifyReceiver
+{
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 4;
+
+private:
+  typedef typename Backend::Encoder Encoder;
+  typedef typename Backend::Decoder Decoder;
+
+  struct DecoderState
+  {
+    uint32_t id;
+    Raster raster;
+
+    /* positioned exactly at this state, or null once it decoded past it */
+    std::unique_ptr<Decoder> decoder;
+  };
+
+  const uint16_t width_;
+  const uint16_t height_;
+  const size_t capacity_;
+
+  /* most recently used first */
+  std::list<DecoderState> states_ {};
+
+  /* a decoder primed for a switch to `quantizer` from state `base`, by
+     the speculation thread */
+  struct Speculation
+  {
+    enum class Status { EMPTY, QUEUED, RUNNING, DONE };
+
+    /* guarded by mutex_; the rest belongs to the speculation thread while
+       the job runs, and to the caller otherwise */
+    Status status;
+
+    uint32_t base;
+    uint16_t quantizer;
+    GopMode gop;
+
+    /* jobs run in this order, and the oldest results are replaced first */
+    uint64_t serial;
+
+    Raster raster;
+    Frame temp_frame;
+    Raster scratch;
+
+    /* a reset decoder to prime, then the primed one (or what went wrong) */
+    std::unique_ptr<Decoder> decoder;
+    std::exception_ptr error;
+  };
+
+  /* decoders that can be reset instead of rebuilt */
+  std::vector<std::unique_ptr<Decoder>> spare_decoders_ {};
+  size_t decoders_built_ { 0 };
+  size_t decoders_reset_ { 0 };
+  std::chrono::steady_clock::duration build_time_ {};
+  std::chrono::steady_clock::duration reset_time_ {};
+
+  /* frames applied on a kept state other than the current one */
+  size_t older_base_frames_ { 0 };
+
+  const bool speculate_;
+  bool speculation_paused_ { false };
+  std::list<Speculation> speculations_ {};
+  std::vector<uint16_t> quantizers_ {};
+  uint64_t next_serial_ { 0 };
+  size_t speculation_hits_ { 0 };
+  std::chrono::steady_clock::duration speculation_wait_ {};
+
+  /* the speculation thread, started with the first job */
+  std::mutex mutex_ {};
+  std::condition_variable changed_ {};
+  bool stopping_ { false };
+  std::thread worker_ {};
+
+  /* a streamed frame that has started arriving */
+  std::unique_ptr<Decoder> partial_decoder_ {};
+  uint32_t partial_frame_no_ { INITIAL_STATE };
+  uint8_t next_part_ { 0 };
+
+  uint32_t state_ { INITIAL_STATE };
+
+  size_t repeats_ { 0 };
+
+  /* frames whose decoded raster did not match the sender's state hash */
+  size_t divergences_ { 0 };
+  uint32_t first_divergence_ { INITIAL_STATE };
+
+  Raster blank_raster_;
+  Raster scratch_raster_;
+  Frame temp_frame_;
+
+  DecoderState * find( const uint32_t id );
+  std::unique_ptr<Decoder> acquire_decoder( void );
+  std::unique_ptr<Decoder> resync( const FrameHeader & header, DecoderState * base );
+  DecoderState & make_state( const uint32_t id );
+
+  std::unique_ptr<Decoder> take_decoder( const FrameHeader & header );
+  Ack apply( const FrameHeader & header, DecoderState & next,
+             std::unique_ptr<Decoder> && decoder );
+  Ack finish_parts( const FrameHeader & header, const Chunk & last_part );
+  Ack repeat( const FrameHeader & header );
+  void drop_partial( void );
+
+  std::unique_ptr<Decoder> prime( const Raster & raster,
+                                  const uint16_t quantizer, const GopMode gop,
+                                  std::unique_ptr<Decoder> && decoder,
+                                  Frame & temp_frame, Raster & scratch ) const;
+  Speculation * find_speculation( const uint32_t base, const uint16_t quantizer,
+                                  const GopMode gop );
+  Speculation & claim_speculation( void );
+  void release_speculation( Speculation & speculation );
+  std::unique_ptr<Decoder> take_speculation( const FrameHeader & header );
+  void start_speculations( const DecoderState & state, const FrameHeader & header );
+  void cancel_speculations( void );
+  void speculate( void );
+
+public:
+  SalsifyReceiver( const uint16_t width, const uint16_t height,
+                   const size_t capacity = DEFAULT_CAPACITY,
+                   const bool speculate = true );
+  ~SalsifyReceiver();
+
+  /* ban copying (background work refers to this object) */
+  SalsifyReceiver( const SalsifyReceiver & other ) = delete;
+  SalsifyReceiver & operator=( const SalsifyReceiver & other ) = delete;
+
+  /* apply a frame sent whole, the final record of a streamed one, or a repeat */
+  Ack receive( const FrameHeader & header, const Chunk & frame );
+
+  /* decode a part of a streamed frame (a record with `more` set) right
+     away; a missing part makes the whole frame fail to apply */
+  void receive_part( const FrameHeader & header, const Chunk & part );
+
+  /* the raster of the current state */
+  const Raster & raster( void ) const;
+  uint32_t state( void ) const { return state_; }
+
+  /* decoders built and reset so far (a resync reuses a spare one when it
+     can), and the milliseconds each took in all */
+  struct DecoderStats
+  {
+    size_t built;
+    double build_ms;
+    size_t reset;
+    double reset_ms;
+  };
+
+  DecoderStats decoder_stats( void ) const;
+
+  /* frames whose base state was kept, but was not the current one */
+  size_t older_base_frames( void ) const { return older_base_frames_; }
+
+  /* stop preparing switches for now, and drop the jobs that have not
+     started (the speculation thread takes a core from a receiver that is
+     behind) */
+  void pause_speculation( const bool paused ) { speculation_paused_ = paused; }
+
+  /* switches that found their resync already prepared, and the
+     milliseconds they spent waiting for it to finish */
+  size_t speculation_hits( void ) const { return speculation_hits_; }
+  double speculation_wait_ms( void ) const;
+
+  /* repeat records applied (FrameHeader::repeat) */
+  size_t repeats( void ) const { return repeats_; }
+
+  /* frames decoded to something other than what the sender decoded, and
+     the first of them (INITIAL_STATE if none) */
+  size_t divergences( void ) const { return divergences_; }
+  uint32_t first_divergence( void ) const { return first_divergence_; }
+};
+
+#endif /* SALSIFY_RECEIVER_HH */
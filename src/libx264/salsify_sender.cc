@@ -0,0 +1,381 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <stdexcept>
+
+#include "salsify_sender.hh"
+#include "timeline.hh"
+
+using namespace std;
+
+template <class Backend>
+SalsifySender<Backend>::SalsifySender( const uint16_t width, const uint16_t height,
+                                       const vector<size_t> & qualities,
+                                       const GopMode gop, const bool splice )
+  : width_( width ), height_( height ), gop_( gop ), splice_( splice ),
+    encoders_(),
+    decoder_(),
+    temp_raster_( ( width * height * 3 ) / 2 ),
+    states_()
+{
+  if ( qualities.empty() ) {
+    throw runtime_error( "SalsifySender: at least one quality is required" );
+  }
+
+  if ( splice_ and not Backend::ANNEX_B ) {
+    throw runtime_error( string( "SalsifySender: cannot splice " ) + Backend::name() + " frames" );
+  }
+
+  for ( const size_t q : qualities ) {
+    encoders_.push_back( { make_unique<Encoder>( width_, height_, q, gop_ ),
+                           INITIAL_STATE, true, Frame( temp_raster_.size() ), 0,
+                           Frame( temp_raster_.size() ), 0, H264Splicer(), string() } );
+  }
+}
+
+template <class Backend>
+void SalsifySender<Backend>::encode_quality( EncoderState & e, const uint8_t * raster )
+{
+  TimelineSpan span { "encode quality" };
+
+  e.output_size = e.encoder->encode( const_cast<uint8_t *>( raster ), e.output.data() );
+  e.spliced.clear();
+
+  span.arg( "frame", next_frame_no_ ).arg( "quality", &e - encoders_.data() )
+      .arg( "quantizer", e.encoder->q() ).arg( "bytes", e.output_size );
+}
+
+template <class Backend>
+void SalsifySender<Backend>::encode( const uint8_t * raster )
+{
+  for ( auto & e : encoders_ ) {
+    encode_quality( e, raster );
+  }
+
+  streamed_.clear();
+  single_.clear();
+}
+
+template <class Backend>
+void SalsifySender<Backend>::encode( const uint8_t * raster, const size_t index )
+{
+  /* the others get rebuilt on their anchors at commit() anyway */
+  encode_quality( encoders_.at( index ), raster );
+
+  streamed_.clear();
+  single_.reset( index );
+}
+
+template <class Backend>
+void SalsifySender<Backend>::encode( const uint8_t * raster, const size_t streamed,
+                                     const PartSink & sink, const bool only_streamed )
+{
+  EncoderState & s = encoders_.at( streamed );
+  TimelineSpan span { "stream quality" };
+
+  /* everything but the length is known before the encoder starts */
+  s.spliced.clear();
+  FrameHeader header = next_header( s );
+  header.more = true;
+
+  /* what went out in records of their own */
+  size_t sent = 0;
+
+  s.output_size = s.encoder->encode( const_cast<uint8_t *>( raster ), s.output.data(),
+    [&]( const Chunk & slice )
+    {
+      Chunk part = slice;
+
+      /* rewritten on the way out, and kept whole for the decoder */
+      if ( s.splicer.active() ) {
+        const size_t offset = s.spliced.size();
+        s.spliced += s.splicer.apply( slice, stream_ );
+        part = Chunk( s.spliced )( offset );
+      }
+
+      /* the last part number is the final record's, which takes the rest */
+      if ( header.part + 1 < FrameHeader::MAX_PARTS ) {
+        header.length = part.size();
+        sink( header, part );
+        header.part++;
+        sent += part.size();
+      }
+    } );
+
+  /* the final record carries whatever slices did not get a part number
+     of their own (usually none), and the hash of the state it leads to */
+  const Chunk rest = payload( s )( sent );
+  header.length = rest.size();
+  header.more = false;
+  header.state_hash = state_hash( advance_decoder( s, header.frame_no ) );
+  sink( header, rest );
+
+  streamed_state_hash_ = header.state_hash;
+
+  span.arg( "frame", header.frame_no ).arg( "quality", streamed )
+      .arg( "quantizer", header.quantizer ).arg( "bytes", payload( s ).size() );
+  span.end();
+
+  streamed_.reset( streamed );
+
+  if ( only_streamed ) {
+    /* as in encode( raster, index ) */
+    single_.reset( streamed );
+    return;
+  }
+
+  /* the others can only be sent later, so they are not in a hurry */
+  for ( size_t i = 0; i < encoders_.size(); i++ ) {
+    if ( i != streamed ) {
+      encode_quality( encoders_[ i ], raster );
+    }
+  }
+
+  single_.clear();
+}
+
+template <class Backend>
+Chunk SalsifySender<Backend>::frame( const size_t index ) const
+{
+  return payload( encoders_.at( index ) );
+}
+
+template <class Backend>
+Chunk SalsifySender<Backend>::payload( const EncoderState & e ) const
+{
+  if ( not e.spliced.empty() ) {
+    return e.spliced;
+  }
+
+  return { e.output.data(), e.output_size };
+}
+
+template <class Backend>
+FrameHeader SalsifySender<Backend>::next_header( const EncoderState & e ) const
+{
+  return { next_frame_no_, e.anchor, static_cast<uint32_t>( payload( e ).size() ),
+           static_cast<uint16_t>( e.encoder->q() ), e.resync, gop_ };
+}
+
+template <class Backend>
+const Raster & SalsifySender<Backend>::advance_decoder( EncoderState & e, const uint32_t frame_no )
+{
+  TimelineSpan span { "decode" };
+  span.arg( "frame", frame_no ).arg( "resync", e.resync );
+
+  /* follow the receiver: rebuild the decoder if it has to */
+  if ( e.resync ) {
+    decoder_.reset( new Decoder( width_, height_ ) );
+
+    if ( e.resync_frame_size > 0 ) {
+      decoder_->decode( e.resync_frame.data(), e.resync_frame_size, temp_raster_.data() );
+    }
+  }
+
+  const Chunk frame = payload( e );
+  if ( states_.empty() or states_.back().id != frame_no ) {
+    if ( spare_states_.empty() ) {
+      states_.push_back( { frame_no, Raster( temp_raster_.size() ) } );
+    }
+    else {
+      states_.splice( states_.end(), spare_states_, spare_states_.begin() );
+      states_.back().id = frame_no;
+    }
+  }
+
+  Raster & decoded = states_.back().raster;
+  decoder_->decode( const_cast<uint8_t *>( frame.buffer() ), frame.size(), decoded.data() );
+  return decoded;
+}
+
+template <class Backend>
+FrameHeader SalsifySender<Backend>::commit( const size_t winner )
+{
+  if ( streamed_.initialized() and *streamed_ != winner ) {
+    throw runtime_error( "SalsifySender: another quality was already streamed" );
+  }
+
+  if ( single_.initialized() and *single_ != winner ) {
+    throw runtime_error( "SalsifySender: only another quality was encoded" );
+  }
+
+  EncoderState & e = encoders_.at( winner );
+
+  if ( e.splicer.active() and not streamed_.initialized() ) {
+    e.spliced = e.splicer.apply( { e.output.data(), e.output_size }, stream_ );
+  }
+
+  FrameHeader header = next_header( e );
+  header.state_hash = streamed_.initialized()
+                      ? streamed_state_hash_
+                      : state_hash( advance_decoder( e, header.frame_no ) );
+
+  next_frame_no_++;
+  shown_state_ = header.frame_no;
+  streamed_.clear();
+  single_.clear();
+
+  /* follow the receiver's decoder, which starts over on a resync */
+  if ( splice_ ) {
+    if ( e.resync ) {
+      stream_.reset();
+      stream_.feed( { e.resync_frame.data(), e.resync_frame_size } );
+    }
+
+    stream_.feed( payload( e ) );
+    e.splicer.committed();
+  }
+
+  /* the winner simply continues; everyone else restarts from the new state */
+  e.anchor = header.frame_no;
+  e.resync = false;
+
+  for ( size_t i = 0; i < encoders_.size(); i++ ) {
+    if ( i != winner ) {
+      reanchor( encoders_[ i ], header.frame_no, true );
+    }
+  }
+
+  prune_states();
+  return header;
+}
+
+template <class Backend>
+FrameHeader SalsifySender<Backend>::repeat( void )
+{
+  if ( streamed_.initialized() ) {
+    throw runtime_error( "SalsifySender: a streamed quality has to be committed" );
+  }
+
+  FrameHeader header { next_frame_no_++, shown_state_, 0, 0, false, gop_ };
+  header.repeat = true;
+  return header;
+}
+
+template <class Backend>
+void SalsifySender<Backend>::reanchor( EncoderState & e, const uint32_t state,
+                                       const bool allow_splice )
+{
+  TimelineSpan span { "reanchor" };
+  span.arg( "state", state ).arg( "quality", &e - encoders_.data() );
+
+  e.splicer.stop();
+  e.anchor = state;
+
+  /* a PPS id per quality, so the receiver's decoder can hold them all */
+  const uint32_t pps_id = 1 + ( &e - encoders_.data() );
+
+  if ( splice_ and allow_splice and gop_ == GopMode::ALL_INTRA ) {
+    /* the next frame is a key frame anyway, and brings its own parameter sets */
+    e.resync = false;
+    e.splicer.start( pps_id );
+    splice_count_++;
+    span.arg( "spliced", true );
+    return;
+  }
+
+  e.encoder.reset( new Encoder( width_, height_, e.encoder->q(), gop_ ) );
+  e.resync = true;
+  e.resync_frame_size = 0;
+
+  if ( state != INITIAL_STATE ) {
+    e.resync_frame_size = e.encoder->encode( const_cast<uint8_t *>( this->state( state ).data() ),
+                                             e.resync_frame.data() );
+
+    span.arg( "bytes", e.resync_frame_size );
+
+    if ( splice_ and allow_splice and splice_onto( e, state, pps_id ) ) {
+      e.resync = false;
+      splice_count_++;
+    }
+  }
+
+  span.arg( "spliced", not e.resync );
+}
+
+template <class Backend>
+bool SalsifySender<Backend>::splice_onto( EncoderState & e, const uint32_t state,
+                                          const uint32_t pps_id )
+{
+  /* the rebuilt encoder predicts from its own decode of the resync frame,
+     so the receiver can skip that frame only if it decodes to exactly the
+     state the receiver already holds */
+  if ( probe_decoder_ ) {
+    probe_decoder_->reset();
+  }
+  else {
+    probe_decoder_.reset( new Decoder( width_, height_ ) );
+  }
+
+  probe_decoder_->decode( e.resync_frame.data(), e.resync_frame_size, temp_raster_.data() );
+
+  if ( temp_raster_ != this->state( state ) ) {
+    return false;
+  }
+
+  return e.splicer.start( pps_id, { e.resync_frame.data(), e.resync_frame_size }, stream_ );
+}
+
+template <class Backend>
+void SalsifySender<Backend>::prune_states( void )
+{
+  while ( not states_.empty() and
+          ( states_.front().id < last_acked_ or states_.size() > MAX_STATES ) ) {
+    spare_states_.splice( spare_states_.end(), states_, states_.begin() );
+  }
+}
+
+template <class Backend>
+const typename SalsifySender<Backend>::DecodedState *
+SalsifySender<Backend>::find_state( const uint32_t id ) const
+{
+  for ( const auto & s : states_ ) {
+    if ( s.id == id ) {
+      return &s;
+    }
+  }
+
+  return nullptr;
+}
+
+template <class Backend>
+const Raster & SalsifySender<Backend>::state( const uint32_t id ) const
+{
+  const DecodedState * const s = find_state( id );
+
+  if ( s == nullptr ) {
+    throw out_of_range( "SalsifySender: no such state" );
+  }
+
+  return s->raster;
+}
+
+template <class Backend>
+void SalsifySender<Backend>::ack( const Ack & ack )
+{
+  if ( ack.state > last_acked_ ) {
+    last_acked_ = ack.state;
+    prune_states();
+  }
+
+  if ( ack.applied or ack.frame_no < resync_barrier_ ) {
+    return;
+  }
+
+  /* the receiver is stuck at `ack.state`: start every encoder over from there,
+     or from scratch if that state is no longer around */
+  const uint32_t recovery_state = find_state( ack.state ) ? ack.state : INITIAL_STATE;
+
+  for ( auto & e : encoders_ ) {
+    reanchor( e, recovery_state, false );
+  }
+
+  shown_state_ = recovery_state;
+  resync_barrier_ = next_frame_no_;
+  loss_count_++;
+}
+
+template class SalsifySender<H264Backend>;
+template class SalsifySender<X264Backend>;
+template class SalsifySender<VP8Backend>;
+template class SalsifySender<BandedH264Backend>;
+template class SalsifySender<BandedX264Backend>;
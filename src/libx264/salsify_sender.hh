@@ -0,0 +1,170 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef SALSIFY_SENDER_HH
+#define SALSIFY_SENDER_HH
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "optional.hh"
+#include "salsify_protocol.hh"
+#include "codec_backend.hh"
+#include "h264_splicer.hh"
+
+/* Encodes every raster at several qualities and keeps the encoders in
+   lockstep with the receiver's decoder. Each encoder is anchored to a
+   numbered state; an encoder that did not win the last frame (or that has
+   to recover from a loss) is rebuilt by re-encoding the raster of its
+   anchor state, which the receiver can reproduce on its side.
+
+   With `splice` (H.264 backends only), a switch skips that resync when
+   the receiver's decoder can take the loser's frames as they are: the
+   frames' headers are rewritten to continue the receiver's stream, and
+   the frame header says no resync is needed. All-intra encoders never
+   depend on earlier frames, so they always splice; otherwise the loser
+   is still rebuilt, but only resyncs if its rebuilt reference differs
+   from the receiver's.
+
+   Backend is one of the policies in codec_backend.hh. */
+
+template <class Backend>
+class SalsifySender
+{
+public:
+  /* how many decoded states to keep around for loss recovery */
+  static constexpr size_t MAX_STATES = 32;
+
+private:
+  typedef typename Backend::Encoder Encoder;
+  typedef typename Backend::Decoder Decoder;
+
+  struct EncoderState
+  {
+    std::unique_ptr<Encoder> encoder;
+    uint32_t anchor;
+
+    /* set when the encoder was rebuilt on its anchor; the next frame it
+       produces must tell the receiver to do the same */
+    bool resync;
+    Frame resync_frame;
+    size_t resync_frame_size;
+
+    Frame output;
+    size_t output_size;
+
+    /* with splicing on: rewrites this encoder's frames, and the last one
+       committed (or streamed) after rewriting */
+    H264Splicer splicer;
+    std::string spliced;
+  };
+
+  const uint16_t width_;
+  const uint16_t height_;
+  const GopMode gop_;
+  const bool splice_;
+
+  std::vector<EncoderState> encoders_;
+  std::unique_ptr<Decoder> decoder_;
+  Raster temp_raster_;
+
+  struct DecodedState
+  {
+    uint32_t id;
+    Raster raster;
+  };
+
+  /* decoded states, oldest first; the receiver is known to hold
+     last_acked_. Pruned ones keep their buffers for later states. */
+  std::list<DecodedState> states_;
+  std::list<DecodedState> spare_states_ {};
+  uint32_t last_acked_ { INITIAL_STATE };
+
+  uint32_t next_frame_no_ { INITIAL_STATE + 1 };
+
+  /* what the receiver shows once it has everything sent so far */
+  uint32_t shown_state_ { INITIAL_STATE };
+
+  /* negative acks for frames sent before this one predate the last resync */
+  uint32_t resync_barrier_ { INITIAL_STATE };
+
+  size_t loss_count_ { 0 };
+
+  /* the quality whose parts went out during the last encode(), if any;
+     its frame has already been decoded into the next state */
+  Optional<size_t> streamed_ {};
+  uint64_t streamed_state_hash_ { 0 };
+
+  /* the one quality the last encode() produced, if it skipped the others */
+  Optional<size_t> single_ {};
+
+  /* what the receiver's decoder has been fed, for splicing onto it */
+  H264StreamTracker stream_ {};
+  std::unique_ptr<Decoder> probe_decoder_ {};
+  size_t splice_count_ { 0 };
+
+  void encode_quality( EncoderState & e, const uint8_t * raster );
+  FrameHeader next_header( const EncoderState & e ) const;
+  const Raster & advance_decoder( EncoderState & e, const uint32_t frame_no );
+  Chunk payload( const EncoderState & e ) const;
+
+  void reanchor( EncoderState & encoder, const uint32_t state, const bool allow_splice );
+  bool splice_onto( EncoderState & e, const uint32_t state, const uint32_t pps_id );
+  void prune_states( void );
+  const DecodedState * find_state( const uint32_t id ) const;
+
+public:
+  SalsifySender( const uint16_t width, const uint16_t height,
+                 const std::vector<size_t> & qualities,
+                 const GopMode gop = GopMode::INFINITE_GOP,
+                 const bool splice = false );
+
+  /* receives a streamed frame's records; the chunk is only valid during the call */
+  typedef std::function<void( const FrameHeader &, const Chunk & )> PartSink;
+
+  /* encode the raster at every quality */
+  void encode( const uint8_t * raster );
+
+  /* encode the raster at quality `index` only, which must be committed next:
+     cheaper when there is no time to choose */
+  void encode( const uint8_t * raster, const size_t index );
+
+  /* same, but stream quality `streamed` to `sink` while it is encoded,
+     slice by slice (see FrameHeader); that quality must be committed next.
+     The other qualities are encoded afterwards, unless `only_streamed` */
+  void encode( const uint8_t * raster, const size_t streamed, const PartSink & sink,
+               const bool only_streamed = false );
+
+  size_t quality_count( void ) const { return encoders_.size(); }
+  size_t quantizer( const size_t index ) const { return encoders_.at( index ).encoder->q(); }
+  size_t frame_size( const size_t index ) const { return encoders_.at( index ).output_size; }
+  GopMode gop( void ) const { return gop_; }
+
+  /* send the given quality of the last encoded raster; returns its header,
+     and the payload is available from frame() until the next encode()
+     (splicing can make it a little larger than frame_size() said) */
+  FrameHeader commit( const size_t winner );
+  Chunk frame( const size_t index ) const;
+
+  /* in place of encode() and commit(), for a raster that did not change
+     (see frame_analyzer.hh): the receiver keeps showing what it shows, and
+     no encoder moves */
+  FrameHeader repeat( void );
+
+  /* the raster the receiver will show once it decodes the last committed frame */
+  const Raster & state( const uint32_t id ) const;
+
+  /* handle receiver feedback; a frame that could not be applied makes
+     every encoder resync against the last state the receiver holds */
+  void ack( const Ack & ack );
+
+  uint32_t last_acked( void ) const { return last_acked_; }
+  size_t loss_count( void ) const { return loss_count_; }
+
+  /* switches that were spliced instead of resynced */
+  size_t splice_count( void ) const { return splice_count_; }
+};
+
+#endif /* SALSIFY_SENDER_HH */
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "segment_encoder.hh"
+#include "h264_encoder.hh"
+#include "thread_pool.hh"
+
+namespace {
+
+typedef std::vector<uint8_t> EncodedFrame;
+
+// libavcodec's global setup in H264_encoder's constructor is not safe to
+// run from several threads at once
+std::mutex encoder_setup_mutex;
+
+std::vector<EncodedFrame> encode_segment(const std::string &input_filename,
+                                         size_t width, size_t height, size_t quantization,
+                                         size_t first_frame, size_t frame_count){
+    const size_t frame_size = width*height + width*height / 2;
+
+    std::ifstream infile(input_filename, std::ios::binary);
+    infile.seekg(first_frame * frame_size);
+
+    std::unique_ptr<H264_encoder> encoder;
+    {
+        std::lock_guard<std::mutex> lock(encoder_setup_mutex);
+        encoder.reset(new H264_encoder(width, height, quantization));
+    }
+
+    std::vector<uint8_t> raw(frame_size), output(frame_size);
+    std::vector<EncodedFrame> frames;
+
+    for(size_t i = 0; i < frame_count; i++){
+        if(!infile.read((char*)raw.data(), frame_size)){
+            throw std::runtime_error("could not read frame " + std::to_string(first_frame + i));
+        }
+
+        const size_t size = encoder->encode(raw.data(), output.data());
+        frames.emplace_back(output.begin(), output.begin() + size);
+    }
+
+    return frames;
+}
+
+}
+
+size_t encode_segments(const std::string &input_filename, size_t width, size_t height,
+                       size_t quantization, size_t segment_frames,
+                       const EncodedFrameSink &sink){
+    const size_t frame_size = width*height + width*height / 2;
+
+    if(segment_frames == 0){
+        throw std::runtime_error("segments need at least one frame");
+    }
+
+    std::ifstream infile(input_filename, std::ios::binary | std::ios::ate);
+    if(!infile.is_open()){
+        throw std::runtime_error("could not open file: " + input_filename);
+    }
+    const size_t total_frames = size_t(infile.tellg()) / frame_size;
+    const size_t segment_count = (total_frames + segment_frames - 1) / segment_frames;
+
+    // a wave of segments at a time, one per core, so that only that many
+    // encoded segments wait in memory to be passed on in order; each
+    // segment's H264_encoder keeps to one thread, so the wave does not
+    // oversubscribe the cores
+    ThreadPool &pool = ThreadPool::shared();
+    const size_t wave_size = pool.size() + 1;
+
+    size_t frame_no = 0;
+    for(size_t wave = 0; wave < segment_count; wave += wave_size){
+        const size_t wave_segments = std::min(wave_size, segment_count - wave);
+        std::vector<std::vector<EncodedFrame>> segments(wave_segments);
+
+        pool.parallel_for(wave_segments, [&](size_t i){
+            const size_t first_frame = (wave + i) * segment_frames;
+            segments[i] = encode_segment(input_filename, width, height, quantization, first_frame,
+                                         std::min(segment_frames, total_frames - first_frame));
+        });
+
+        for(const auto &segment : segments){
+            for(const EncodedFrame &frame : segment){
+                sink(frame_no++, frame.data(), frame.size());
+            }
+        }
+    }
+
+    return frame_no;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "gop_mode.hh"
+
+// Offline encoding of a raw I420 file in independent segments. Each
+// segment is coded by a fresh encoder, so it starts with an IDR frame and
+// needs nothing from the frames before it. Segments are encoded in
+// parallel on the shared thread pool, and their frames come out in order.
+
+// a segment per intra refresh sweep: about a second of video
+constexpr size_t SEGMENT_FRAMES = INTRA_REFRESH_PERIOD;
+
+// called for every frame, in order, on the calling thread
+typedef std::function<void(size_t frame_no, const uint8_t *frame, size_t size)> EncodedFrameSink;
+
+// returns the number of frames encoded
+size_t encode_segments(const std::string &input_filename, size_t width, size_t height,
+                       size_t quantization, size_t segment_frames,
+                       const EncodedFrameSink &sink);
@@ -1,19 +1,20 @@
 #include <chrono>
-#include <iomanip>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <memory>
-#include <sstream>
 #include <vector>
 
 #include "h264_encoder.hh"
+#include "segment_encoder.hh"
 
 #define PIX(x) (x < 0 ? 0 : (x > 255 ? 255 : x))
 
 int main(int argc, char **argv)
 {
-    if(argc != 4){
-        std::cout << "usage: " << argv[0] << " <quantizer (1-64; lower is better)> <input.raw> <output_dir>\n";
+    if(argc != 4 && !(argc == 5 && std::string(argv[4]) == "segments")){
+        std::cout << "usage: " << argv[0] << " <quantizer (1-64; lower is better)> <input.raw> <output_dir> [segments]\n";
+        std::cout << "  with segments, independent segments of " << SEGMENT_FRAMES << " frames are encoded in parallel\n";
         return 0;
     }
 
@@ -28,6 +29,39 @@ int main(int argc, char **argv)
     const size_t height = 720;
     const size_t frame_size = width*height + width*height / 2;
 
+    // one file per frame, named in a buffer made once and written through
+    // one stream, so its buffer is not allocated again for every file
+    std::vector<char> output_filename(output_dirname.size() + 32);
+    std::ofstream outfile;
+    auto write_frame = [&](size_t frame_no, const uint8_t *frame, size_t size){
+        std::snprintf(output_filename.data(), output_filename.size(), "%s/%05zu.raw",
+                      output_dirname.c_str(), frame_no);
+
+        outfile.clear();
+        outfile.open(output_filename.data(), std::ios::binary);
+        if(!outfile.is_open()){
+            std::cout << "Could not open file: " << output_filename.data() << "\n";
+            return false;
+        }
+
+        outfile.write((const char*)frame, size);
+        outfile.close();
+        if(!outfile){
+            std::cout << "Could not write file: " << output_filename.data() << "\n";
+            return false;
+        }
+        return true;
+    };
+
+    if(argc == 5){
+        bool written = true;
+        encode_segments(input_filename, width, height, quantizer, SEGMENT_FRAMES,
+                        [&](size_t frame_no, const uint8_t *frame, size_t size){
+                            written = written && write_frame(frame_no, frame, size);
+                        });
+        return written ? 0 : 1;
+    }
+
     std::ifstream infile(input_filename, std::ios::binary);
     if(!infile.is_open()){
         std::cout << "Could not open file: " << input_filename << "\n";
@@ -45,21 +79,11 @@ int main(int argc, char **argv)
 
         // TODO: add code to encode the frame
         size_t compressed_frame_size = encoder.encode(buffer1.get(), buffer2.get());
-        
-        { // scope the file object
-            std::stringstream ss;
-            ss << std::setw(5) << std::setfill('0') << frame_count;
-            std::string output_filename = output_dirname + "/" + ss.str() + ".raw";
-            
-            std::ofstream outfile(output_filename, std::ios::binary);
-            if(!outfile.is_open()){
-                std::cout << "Could not open file: " << input_filename << "\n";
-                return 0;
-            }
-
-            outfile.write((char*)buffer2.get(), compressed_frame_size);
-            frame_count++;            
+
+        if(!write_frame(frame_count, buffer2.get(), compressed_frame_size)){
+            return 1;
         }
+        frame_count++;
     }
 
     return 0;
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#include "chunk.hh"
+
+// Receives an encoded frame piece by piece, in decoding order, as soon as
+// each piece is ready. For H.264 a piece is a NAL unit. The chunk is only
+// valid during the call.
+typedef std::function<void(const Chunk &)> SliceSink;
+
+// H.264 frames are coded as this many slices so that they can be sent
+// before the whole frame is done. The slice layout changes the decoded
+// picture, so every H.264 encoder has to use the same value.
+constexpr size_t SLICES_PER_FRAME = 4;
@@ -0,0 +1,167 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* runs a sender and a receiver in one process, connected by lossy channels
+   in both directions, and measures how long the receiver takes to recover
+   from each loss */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include "optional.hh"
+#include "lossy_channel.hh"
+#include "salsify_sender.hh"
+#include "salsify_receiver.hh"
+
+using namespace std;
+
+constexpr uint16_t width = 1280;
+constexpr uint16_t height = 720;
+constexpr uint32_t frame_size = ( width * height * 3 ) / 2;
+
+constexpr uint64_t frame_rate = FRAME_RATE;
+
+void usage()
+{
+  cerr << "sloop [--codec=<backend>] [--gop=<mode>] [--stream] <input.raw> <output.raw> <trace> <loss-rate> <delay-frames> [seed]" << endl
+       << endl
+       << "  Backends: " << BACKEND_NAMES << " (default h264)." << endl
+       << "  GOP modes: all-intra, infinite, intra-refresh (default infinite)." << endl
+       << "  With --stream, every slice travels in its own datagram." << endl;
+}
+
+template <class Backend>
+int run( int argc, char const * argv[], const GopMode gop, const bool stream )
+{
+  ifstream input_fin { argv[ 1 ] };
+  ofstream fout { argv[ 2 ] };
+  ifstream trace_fin { argv[ 3 ] };
+
+  const double loss_rate = stod( argv[ 4 ] );
+  const uint64_t delay = stoull( argv[ 5 ] );
+  const uint32_t seed = ( argc == 7 ) ? stoul( argv[ 6 ] ) : 0;
+
+  LossyChannel forward { delay, loss_rate, seed };
+  LossyChannel backward { delay, loss_rate, seed + 1 };
+
+  SalsifySender<Backend> sender { width, height, { Backend::HIGH_QUALITY, Backend::LOW_QUALITY }, gop };
+  SalsifyReceiver<Backend> receiver { width, height };
+
+  Raster raster_buffer;
+  raster_buffer.resize( frame_size );
+
+  /* the first lost frame of the current outage, and when it was sent */
+  Optional<uint32_t> lost_frame;
+  uint64_t lost_tick = 0;
+  vector<uint64_t> recovery_ticks;
+  size_t frozen_ticks = 0;
+
+  size_t winner = 0;
+
+  for ( uint64_t tick = 0; input_fin.read( reinterpret_cast<char *>( raster_buffer.data() ), frame_size ); tick++ ) {
+    for ( const string & datagram : backward.receive( tick ) ) {
+      sender.ack( Ack::parse( datagram ) );
+    }
+
+    if ( not ( trace_fin >> winner ) ) {
+      winner = 0;
+    }
+
+    /* one datagram per frame, or per slice when streaming */
+    auto send = [&]( const FrameHeader & header, const Chunk & payload )
+      {
+        string datagram = header.serialize();
+        datagram.append( reinterpret_cast<const char *>( payload.buffer() ), payload.size() );
+
+        if ( not forward.send( tick, move( datagram ) ) and not lost_frame.initialized() ) {
+          lost_frame.reset( header.frame_no );
+          lost_tick = tick;
+        }
+      };
+
+    if ( stream ) {
+      sender.encode( raster_buffer.data(), winner, send );
+      sender.commit( winner );
+    }
+    else {
+      sender.encode( raster_buffer.data() );
+      const FrameHeader header = sender.commit( winner );
+      send( header, sender.frame( winner ) );
+    }
+
+    bool applied = false;
+
+    for ( const string & received : forward.receive( tick ) ) {
+      const Chunk chunk { received };
+      const FrameHeader header = FrameHeader::parse( chunk );
+
+      if ( header.more ) {
+        receiver.receive_part( header, chunk( FrameHeader::SIZE ) );
+        continue;
+      }
+
+      const Ack ack = receiver.receive( header, chunk( FrameHeader::SIZE ) );
+      applied |= ack.applied;
+
+      if ( lost_frame.initialized() and ack.applied and ack.frame_no > *lost_frame ) {
+        recovery_ticks.push_back( tick - lost_tick - delay );
+        lost_frame.clear();
+      }
+
+      backward.send( tick, ack.serialize() );
+    }
+
+    if ( not applied ) {
+      frozen_ticks++;
+    }
+
+    fout.write( reinterpret_cast<const char *>( receiver.raster().data() ), frame_size );
+  }
+
+  cerr << "datagrams sent: " << forward.sent() << ", lost: " << forward.dropped()
+       << ", acks lost: " << backward.dropped()
+       << ", resyncs: " << sender.loss_count()
+       << ", frozen frames: " << frozen_ticks << endl;
+
+  if ( not recovery_ticks.empty() ) {
+    sort( recovery_ticks.begin(), recovery_ticks.end() );
+
+    uint64_t total = 0;
+    for ( const auto ticks : recovery_ticks ) {
+      total += ticks;
+    }
+
+    const double ms_per_tick = 1000.0 / frame_rate;
+    cerr << "outages: " << recovery_ticks.size()
+         << ", recovery latency (ms): mean=" << ms_per_tick * total / recovery_ticks.size()
+         << " p50=" << ms_per_tick * recovery_ticks[ recovery_ticks.size() / 2 ]
+         << " max=" << ms_per_tick * recovery_ticks.back() << endl;
+  }
+
+  if ( receiver.divergences() ) {
+    cerr << "frames that differ from the sender's decode: " << receiver.divergences()
+         << ", first at frame " << receiver.first_divergence() << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+int main( int argc, char const * argv[] )
+{
+  const string codec = take_option( argc, argv, "codec", H264Backend::name() );
+  const GopMode gop = parse_gop_mode( take_option( argc, argv, "gop", gop_mode_name( GopMode::INFINITE_GOP ) ) );
+  const bool stream = take_flag( argc, argv, "stream" );
+
+  if ( argc != 6 and argc != 7 ) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  return with_backend( codec, [&]( auto backend ) {
+      return run<decltype( backend )>( argc, argv, gop, stream );
+    } );
+}
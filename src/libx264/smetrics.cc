@@ -0,0 +1,163 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* shows the live metrics of running ssender and sreceiver processes (see
+   their --metrics option), refreshed in place like top(1): totals since
+   each one started, and rates and stage times over the last interval. */
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "live_metrics.hh"
+#include "args.hh"
+
+using namespace std;
+
+void usage()
+{
+  cerr << "smetrics [--interval=<ms>] [--once] <name>..." << endl
+       << endl
+       << "  Refreshes every <ms> (default 1000) until every program has exited;" << endl
+       << "  with --once, prints a single interval and exits." << endl;
+}
+
+/* what rates are computed from */
+struct Snapshot
+{
+  uint64_t at_ns { 0 };
+  uint64_t frames { 0 };
+  array<uint64_t, LiveMetricsBlock::MAX_QUALITIES> bytes {};
+  array<uint64_t, LiveMetricsBlock::MAX_STAGES> stage_count {};
+  array<uint64_t, LiveMetricsBlock::MAX_STAGES> stage_ns {};
+
+  explicit Snapshot( const LiveMetricsBlock & block )
+    : at_ns( LiveMetricsBlock::now() ), frames( block.frames.load( memory_order_relaxed ) )
+  {
+    for ( size_t i = 0; i < LiveMetricsBlock::MAX_QUALITIES; i++ ) {
+      bytes[ i ] = block.qualities[ i ].bytes.load( memory_order_relaxed );
+    }
+
+    for ( size_t i = 0; i < LiveMetricsBlock::MAX_STAGES; i++ ) {
+      stage_count[ i ] = block.stages[ i ].count.load( memory_order_relaxed );
+      stage_ns[ i ] = block.stages[ i ].total_ns.load( memory_order_relaxed );
+    }
+  }
+};
+
+double per( const double numerator, const double denominator )
+{
+  return denominator ? numerator / denominator : 0;
+}
+
+void print( ostream & out, const string & name, const LiveMetricsBlock & block,
+            const Snapshot & now, const Snapshot & before )
+{
+  const bool finished = block.finished.load( memory_order_acquire );
+  const double interval_s = ( now.at_ns - before.at_ns ) / 1e9;
+  const uint64_t end_ns = finished ? block.updated_ns.load( memory_order_relaxed ) : now.at_ns;
+
+  out << name << ": " << block.program << " (pid " << block.pid << "), "
+      << ( end_ns - block.started_ns ) / 1e9 << " s, " << ( finished ? "finished" : "running" ) << endl
+      << "  frames " << now.frames << " (" << per( now.frames - before.frames, interval_s ) << "/s)"
+      << ", skipped " << block.skipped.load( memory_order_relaxed )
+      << ", switches " << block.switches.load( memory_order_relaxed ) << endl;
+
+  out << "  " << left << setw( 12 ) << "quantizer" << right
+      << setw( 10 ) << "frames" << setw( 12 ) << "MB" << setw( 12 ) << "Mbit/s" << endl;
+
+  for ( size_t i = 0; i < LiveMetricsBlock::MAX_QUALITIES; i++ ) {
+    const LiveMetricsBlock::Quality & quality = block.qualities[ i ];
+    const uint64_t quantizer = quality.quantizer.load( memory_order_relaxed );
+
+    if ( quantizer == 0 ) {
+      break;
+    }
+
+    out << "  " << left << setw( 12 ) << quantizer << right
+        << setw( 10 ) << quality.frames.load( memory_order_relaxed )
+        << setw( 12 ) << now.bytes[ i ] / 1e6
+        << setw( 12 ) << per( ( now.bytes[ i ] - before.bytes[ i ] ) * 8 / 1e6, interval_s ) << endl;
+  }
+
+  out << "  " << left << setw( 12 ) << "stage" << right
+      << setw( 10 ) << "mean ms" << setw( 12 ) << "recent ms" << setw( 12 ) << "max ms" << endl;
+
+  for ( size_t i = 0; i < block.stage_count; i++ ) {
+    const LiveMetricsBlock::Stage & stage = block.stages[ i ];
+
+    out << "  " << left << setw( 12 ) << stage.name << right
+        << setw( 10 ) << per( now.stage_ns[ i ] / 1e6, now.stage_count[ i ] )
+        << setw( 12 ) << per( ( now.stage_ns[ i ] - before.stage_ns[ i ] ) / 1e6,
+                              now.stage_count[ i ] - before.stage_count[ i ] )
+        << setw( 12 ) << stage.max_ns.load( memory_order_relaxed ) / 1e6 << endl;
+  }
+
+  if ( block.gauge_count ) {
+    out << "  " << left << setw( 12 ) << "gauge" << right
+        << setw( 10 ) << "now" << setw( 12 ) << "max" << endl;
+  }
+
+  for ( size_t i = 0; i < block.gauge_count; i++ ) {
+    const LiveMetricsBlock::Gauge & gauge = block.gauges[ i ];
+
+    out << "  " << left << setw( 12 ) << gauge.name << right
+        << setw( 10 ) << gauge.value.load( memory_order_relaxed )
+        << setw( 12 ) << gauge.max.load( memory_order_relaxed ) << endl;
+  }
+}
+
+int main( int argc, char const * argv[] )
+{
+  const chrono::milliseconds interval { stoul( take_option( argc, argv, "interval", "1000" ) ) };
+  const bool once = take_flag( argc, argv, "once" );
+
+  if ( argc < 2 ) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  const vector<string> names { argv + 1, argv + argc };
+  vector<unique_ptr<LiveMetricsView>> views;
+  vector<Snapshot> last;
+
+  for ( const string & name : names ) {
+    views.emplace_back( new LiveMetricsView( name ) );
+    last.emplace_back( views.back()->block() );
+  }
+
+  cout << fixed << setprecision( 2 );
+
+  while ( true ) {
+    this_thread::sleep_for( interval );
+
+    if ( not once ) {
+      /* home, and clear the screen */
+      cout << "\033[H\033[2J";
+    }
+
+    bool all_finished = true;
+
+    for ( size_t i = 0; i < views.size(); i++ ) {
+      const LiveMetricsBlock & block = views[ i ]->block();
+      const Snapshot now { block };
+
+      print( cout, names[ i ], block, now, last[ i ] );
+      cout << endl;
+
+      last[ i ] = now;
+      all_finished = all_finished and block.finished.load( memory_order_acquire );
+    }
+
+    cout << flush;
+
+    if ( once or all_finished ) {
+      return EXIT_SUCCESS;
+    }
+  }
+}
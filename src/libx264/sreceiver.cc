@@ -6,10 +6,17 @@
 #include <cstdlib>
 #include <vector>
 #include <memory>
+#include <chrono>
+#include <algorithm>
 
+#include "file.hh"
 #include "optional.hh"
-#include "h264_encoder.hh"
-#include "h264_decoder.hh"
+#include "quality.hh"
+#include "alloc_counter.hh"
+#include "perf_counters.hh"
+#include "timeline.hh"
+#include "live_metrics.hh"
+#include "salsify_receiver.hh"
 
 using namespace std;
 
@@ -17,70 +24,338 @@ constexpr uint16_t width = 1280;
 constexpr uint16_t height = 720;
 constexpr uint32_t raster_size = ( width * height * 3 ) / 2;
 
-typedef vector<uint8_t> Raster;
-typedef vector<uint8_t> Frame;
-
 void usage()
 {
-  cerr << "sender <input.compressed> <output.raw> <trace>" << endl;
+  cerr << "receiver [--codec=<backend>] [--source=<input.raw>] [--max-latency=<ms>] [--count-allocations] [--perf] [--timeline=<file.json>] [--metrics=<name>] [--no-speculation] <input.compressed> <output.raw>" << endl
+       << endl
+       << "  Backends: " << BACKEND_NAMES << " (default h264); must match the sender's." << endl
+       << "  With --source, every frame shown is compared against the sender's input," << endl
+       << "  and its quality written to stdout (frame, luma PSNR, PSNR, SSIM)." << endl
+       << endl
+       << "  With --max-latency, frames are expected at " << FRAME_RATE << " fps from the first one" << endl
+       << "  on (as ssender --paced writes them), and a frame decoded more than" << endl
+       << "  <ms> after it was due is not shown: the receiver decodes it, but skips" << endl
+       << "  writing it out until it has caught up." << endl
+       << endl
+       << "  With --count-allocations, the heap allocations of each stage of a record" << endl
+       << "  (read, decode, show) are reported." << endl
+       << endl
+       << "  With --perf, so are the time, cycles, instructions, LLC misses and" << endl
+       << "  branch misses of each stage, where hardware counters are available." << endl
+       << endl
+       << "  With --timeline, what each thread did when (the stages of every record," << endl
+       << "  resyncs, speculative switches) is written out at exit in the Chrome" << endl
+       << "  trace format, for chrome://tracing or ui.perfetto.dev." << endl
+       << endl
+       << "  With --metrics, frame counts, bytes per quality, switches, stage times" << endl
+       << "  and (with --max-latency) how far behind the receiver is are kept up to" << endl
+       << "  date in shared memory under the given name, for smetrics to show." << endl;
 }
 
-int main( int argc, char const * argv[] )
+struct LatencyStats
 {
-  if ( argc != 4 ) {
-    usage();
-    return EXIT_FAILURE;
+  size_t count { 0 };
+  double total { 0 };
+  double max { 0 };
+
+  void add( const double ms )
+  {
+    count++;
+    total += ms;
+    max = std::max( max, ms );
+  }
+
+  void print( const string & name ) const
+  {
+    if ( count ) {
+      cerr << name << ": " << count << " frames, mean " << total / count
+           << " ms, max " << max << " ms" << endl;
+    }
+  }
+};
+
+/* Frame n is due ( n - first ) / FRAME_RATE after the first frame
+   arrived. A receiver that is behind by more than the bound keeps
+   decoding, since later frames depend on every one of them, but stops
+   showing them until it is back within the bound. */
+class CatchUp
+{
+private:
+  typedef chrono::steady_clock Clock;
+
+  const double max_latency_;
+
+  Clock::time_point start_ {};
+  uint32_t first_frame_ { INITIAL_STATE };
+
+  bool behind_ { false };
+  Clock::time_point behind_since_ {};
+  double lag_ { 0 };
+
+  size_t skipped_ { 0 };
+  LatencyStats shown_latency_ {};
+  LatencyStats recovery_ {};
+
+public:
+  explicit CatchUp( const double max_latency ) : max_latency_( max_latency ) {}
+
+  bool behind( void ) const { return behind_; }
+
+  /* how late the last frame was decoded, in milliseconds */
+  double lag( void ) const { return lag_; }
+
+  /* a frame has been decoded: is it too late to be shown? */
+  bool stale( const uint32_t frame_no )
+  {
+    const Clock::time_point now = Clock::now();
+
+    if ( first_frame_ == INITIAL_STATE ) {
+      start_ = now;
+      first_frame_ = frame_no;
+    }
+
+    const Clock::time_point due = start_ + chrono::duration_cast<Clock::duration>(
+      chrono::duration<double>( double( frame_no - first_frame_ ) / FRAME_RATE ) );
+    const double latency = chrono::duration<double, milli>( now - due ).count();
+    lag_ = latency;
+
+    if ( latency > max_latency_ ) {
+      if ( not behind_ ) {
+        behind_ = true;
+        behind_since_ = now;
+      }
+
+      skipped_++;
+      return true;
+    }
+
+    if ( behind_ ) {
+      behind_ = false;
+      recovery_.add( chrono::duration<double, milli>( now - behind_since_ ).count() );
+    }
+
+    shown_latency_.add( max( latency, 0.0 ) );
+    return false;
+  }
+
+  void print( void ) const
+  {
+    cerr << "stale frames not shown: " << skipped_
+         << ( behind_ ? " (still behind at the end)" : "" ) << endl;
+    shown_latency_.print( "latency of shown frames" );
+
+    if ( recovery_.count ) {
+      cerr << "catch-ups: " << recovery_.count << ", time to recover: mean "
+           << recovery_.total / recovery_.count << " ms, max " << recovery_.max << " ms" << endl;
+    }
   }
+};
 
+template <class Backend>
+int run( char const * argv[], const string & source_filename,
+         const string & max_latency, const bool count_allocations, const bool perf,
+         const string & metrics_name, const bool speculate )
+{
+  string header_buffer( FrameHeader::SIZE, 0 );
   Frame frame_buffer;
   frame_buffer.resize( raster_size );
 
   /* open the i/o streams */
   ifstream fin { argv[ 1 ] };
   ofstream fout { argv[ 2 ] };
-  ifstream trace_fin { argv[ 3 ] };
 
-  /* the decoder objects */
-  unique_ptr<H264_decoder> decoder;
+  LatencyStats switch_latency, steady_latency;
+
+  /* the sender numbers its input frames from INITIAL_STATE + 1 */
+  const Optional<File> source { not source_filename.empty(), source_filename };
+
+  QualitySummary quality;
 
-  Optional<Raster> prev_raster;
+  Optional<CatchUp> catch_up { not max_latency.empty(), stod( max_latency.empty() ? "0" : max_latency ) };
 
-  Frame temp_frame;
-  temp_frame.resize( raster_size );
-  size_t temp_frame_size = 0;
+  enum Stage { READ, DECODE, SHOW };
+  const vector<string> stages { "read", "decode", "show" };
+  Optional<AllocationProfile> allocations { count_allocations, stages };
+  Optional<PerfProfile> profile { perf, stages };
+  TimelineStages timeline { { "read", "decode", "show" } };
 
-  size_t winner = 0;
-  size_t prev_winner = 0;
+  /* after the counters, so that they follow its speculation thread */
+  SalsifyReceiver<Backend> receiver { width, height,
+                                     SalsifyReceiver<Backend>::DEFAULT_CAPACITY, speculate };
 
-  while ( not fin.eof() ) {
-    trace_fin >> winner;
+  Optional<LiveMetrics> metrics { not metrics_name.empty(), metrics_name, "sreceiver", stages,
+                                  vector<string> { "lag ms" } };
+
+  /* the record being handled */
+  int64_t traced_frame = 0;
+
+  auto mark = [&]( const Stage stage )
+    {
+      timeline.mark( stage, { { "frame", traced_frame } } );
+
+      if ( allocations.initialized() ) {
+        allocations->mark( stage );
+      }
+
+      if ( profile.initialized() ) {
+        profile->mark( stage );
+      }
+
+      if ( metrics.initialized() ) {
+        metrics->mark( stage );
+      }
+    };
+
+  size_t dropped = 0;
+  size_t resyncs = 0;
+
+  /* every frame record says which state it was coded against, so the
+     receiver knows when to resync without being told the winners */
+  while ( fin.read( &header_buffer[ 0 ], FrameHeader::SIZE ) ) {
+    const FrameHeader header = FrameHeader::parse( header_buffer );
+    traced_frame = header.frame_no;
+
+    if ( header.length > frame_buffer.size() ) {
+      frame_buffer.resize( header.length );
+    }
 
-    /* read the compressed frame */
-    size_t frame_size;
-    size_t frame_q;
-    fin.read( reinterpret_cast<char *>( &frame_size ), sizeof( frame_size ) );
-    fin.read( reinterpret_cast<char *>( &frame_q ), sizeof( frame_q ) );
-    fin.read( reinterpret_cast<char *>( frame_buffer.data() ), frame_size );
+    fin.read( reinterpret_cast<char *>( frame_buffer.data() ), header.length );
+    mark( READ );
 
-    if ( not prev_raster.initialized() ) {
-      prev_raster.reset();
-      prev_raster->resize( raster_size );
-      decoder.reset( new H264_decoder( width, height ) );
+    if ( allocations.initialized() ) {
+      allocations->end_iteration();
     }
-    else {
-      if ( prev_winner != winner ) {
-        H264_encoder encoder { width, height, frame_q };
-        temp_frame_size = encoder.encode( prev_raster->data(), temp_frame.data() );
-        decoder.reset( new H264_decoder( width, height ) );
-        decoder->decode( temp_frame.data(), temp_frame_size, prev_raster->data() );
+
+    if ( profile.initialized() ) {
+      profile->end_iteration();
+    }
+
+    /* a slice of a streamed frame: decode it now, show the frame once complete */
+    if ( header.more ) {
+      receiver.receive_part( header, { frame_buffer.data(), header.length } );
+      mark( DECODE );
+      continue;
+    }
+
+    if ( catch_up.initialized() ) {
+      receiver.pause_speculation( catch_up->behind() );
+    }
+
+    const auto receive_start = chrono::steady_clock::now();
+    const Ack ack = receiver.receive( header, { frame_buffer.data(), header.length } );
+    const chrono::duration<double, milli> receive_time = chrono::steady_clock::now() - receive_start;
+    mark( DECODE );
+
+    if ( header.resync and header.base_state != INITIAL_STATE ) {
+      switch_latency.add( receive_time.count() );
+    }
+    else if ( not header.repeat ) {
+      steady_latency.add( receive_time.count() );
+    }
+
+    if ( not ack.applied ) {
+      dropped++;
+    }
+    else if ( header.resync ) {
+      resyncs++;
+    }
+
+    const bool stale = catch_up.initialized() and catch_up->stale( header.frame_no );
+
+    if ( metrics.initialized() ) {
+      if ( header.repeat or not ack.applied or stale ) {
+        metrics->add_skipped();
+      }
+      else {
+        metrics->add_frame( header.quantizer, FrameHeader::SIZE + header.length );
+      }
+
+      if ( catch_up.initialized() ) {
+        metrics->set_gauge( 0, catch_up->lag() );
       }
+
+      metrics->end_iteration();
+    }
+
+    if ( stale ) {
+      continue;
     }
 
-    decoder->decode( frame_buffer.data(), frame_size, prev_raster->data() );
-    fout.write( reinterpret_cast<char *>( prev_raster->data() ), raster_size );
+    fout.write( reinterpret_cast<const char *>( receiver.raster().data() ), raster_size );
 
-    prev_winner = winner;
+    const uint64_t source_offset = uint64_t( header.frame_no - INITIAL_STATE - 1 ) * raster_size;
+    if ( source.initialized() and source_offset + raster_size <= source.get().size() ) {
+      const FrameQuality q = measure_quality( source.get()( source_offset, raster_size ).buffer(),
+                                              receiver.raster().data(), width, height );
+      quality.add( q );
+      cout << header.frame_no << "\t" << q.psnr_y << "\t" << q.psnr << "\t" << q.ssim << "\n";
+    }
+
+    mark( SHOW );
+  }
+
+  const auto decoders = receiver.decoder_stats();
+
+  cerr << "resyncs: " << resyncs
+       << ", prepared in the background: " << receiver.speculation_hits()
+       << " (waited " << receiver.speculation_wait_ms() << " ms for them)"
+       << ", repeated frames: " << receiver.repeats() << endl
+       << "decoders built: " << decoders.built << " (" << decoders.build_ms << " ms), reset instead: "
+       << decoders.reset << " (" << decoders.reset_ms << " ms)"
+       << ", frames applied on an older kept state: " << receiver.older_base_frames() << endl;
+  /* run again with --no-speculation to compare */
+  const string speculation = speculate ? " (speculation on)" : " (speculation off)";
+  switch_latency.print( "switch frames" + speculation );
+  steady_latency.print( "other frames" + speculation );
+
+  if ( dropped ) {
+    cerr << "frames that could not be decoded: " << dropped << endl;
+  }
+
+  if ( receiver.divergences() ) {
+    cerr << "frames that differ from the sender's decode: " << receiver.divergences()
+         << ", first at frame " << receiver.first_divergence() << endl;
+  }
+
+  if ( catch_up.initialized() ) {
+    catch_up->print();
+  }
+
+  quality.print( cerr );
+
+  if ( allocations.initialized() ) {
+    allocations->print( cerr, "record" );
+  }
+
+  if ( profile.initialized() ) {
+    profile->print( cerr, "record" );
   }
 
   return 0;
 }
+
+int main( int argc, char const * argv[] )
+{
+  const string codec = take_option( argc, argv, "codec", H264Backend::name() );
+  const string source = take_option( argc, argv, "source", "" );
+  const string max_latency = take_option( argc, argv, "max-latency", "" );
+  const bool count_allocations = take_flag( argc, argv, "count-allocations" );
+  const bool perf = take_flag( argc, argv, "perf" );
+  const string timeline = take_option( argc, argv, "timeline", "" );
+  const string metrics = take_option( argc, argv, "metrics", "" );
+  const bool speculate = not take_flag( argc, argv, "no-speculation" );
+
+  if ( argc != 3 ) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  if ( not timeline.empty() ) {
+    Timeline::activate( timeline );
+  }
+
+  return with_backend( codec, [&]( auto backend ) {
+      return run<decltype( backend )>( argv, source, max_latency, count_allocations, perf,
+                                       metrics, speculate );
+    } );
+}
@@ -6,10 +6,18 @@
 #include <cstdlib>
 #include <vector>
 #include <memory>
+#include <algorithm>
 
 #include "optional.hh"
-#include "h264_encoder.hh"
-#include "h264_decoder.hh"
+#include "link_emulator.hh"
+#include "salsify_sender.hh"
+#include "frame_analyzer.hh"
+#include "frame_pacer.hh"
+#include "alloc_counter.hh"
+#include "perf_counters.hh"
+#include "timeline.hh"
+#include "live_metrics.hh"
+#include "encode_cache.hh"
 
 using namespace std;
 
@@ -17,92 +25,395 @@ constexpr uint16_t width = 1280;
 constexpr uint16_t height = 720;
 constexpr uint32_t frame_size = ( width * height * 3 ) / 2;
 
-constexpr uint16_t q_high = 16;
-constexpr uint16_t q_low = 48;
-
-typedef vector<uint8_t> Raster;
-typedef vector<uint8_t> Frame;
+constexpr uint64_t frame_rate = FRAME_RATE;
 
 void usage()
 {
-  cerr << "sender <input.raw> <output.compressed> <trace>" << endl;
+  cerr << "sender [--codec=<backend>] [--gop=<mode>] [--stream] [--splice] [--skip-static] [--paced] [--count-allocations] [--perf] [--timeline=<file.json>] [--metrics=<name>] [--cache=<dir>] <input.raw> <output.compressed> <trace> [<link.trace> <delay-ms>]" << endl
+       << endl
+       << "  Backends: " << BACKEND_NAMES << " (default h264)." << endl
+       << "  GOP modes: all-intra, infinite, intra-refresh (default infinite)." << endl
+       << endl
+       << "  Without a link trace, the winner of each frame is read from <trace>." << endl
+       << "  With a link trace, the winner is chosen online by emulating the link" << endl
+       << "  and the resulting winners are written to <trace> for the receiver." << endl
+       << endl
+       << "  With --stream (trace mode only), each slice of the winner is written" << endl
+       << "  out as soon as it is encoded." << endl
+       << endl
+       << "  With --splice (h264 and x264), a switch between qualities rewrites" << endl
+       << "  the new winner's headers instead of resyncing it, when that decodes" << endl
+       << "  the same (always in all-intra mode)." << endl
+       << endl
+       << "  With --skip-static, a raster that is nearly identical to the last one" << endl
+       << "  encoded is not encoded: the receiver is told to repeat what it shows." << endl
+       << endl
+       << "  With --paced, frames are read at " << frame_rate << " fps in real time, and each" << endl
+       << "  has to be written before the next one is read: a frame that is late" << endl
+       << "  is dropped (repeated), and one that would be late is encoded at the" << endl
+       << "  low quality only." << endl
+       << endl
+       << "  With --count-allocations, the heap allocations of each stage of a frame" << endl
+       << "  (read, encode, resync, write) are reported. Sending two qualities still" << endl
+       << "  allocates on every frame, even once warmed up: resyncing the quality" << endl
+       << "  that lost rebuilds its encoder." << endl
+       << endl
+       << "  With --perf, so are the time, cycles, instructions, LLC misses and" << endl
+       << "  branch misses of each stage, where hardware counters are available." << endl
+       << endl
+       << "  With --timeline, what each thread did when (the stages of every frame," << endl
+       << "  each quality's encode, resyncs) is written out at exit in the Chrome" << endl
+       << "  trace format, for chrome://tracing or ui.perfetto.dev." << endl
+       << endl
+       << "  With --metrics, frame counts, bytes per quality, switches, stage times" << endl
+       << "  and the emulated link's queue are kept up to date in shared memory" << endl
+       << "  under the given name, for smetrics to show while the sender runs." << endl
+       << endl
+       << "  With --cache, h264 frames are looked up in (and added to) an encode" << endl
+       << "  cache in the given directory." << endl;
 }
 
-int main( int argc, char const * argv[] )
+/* capture time of a frame, in milliseconds */
+uint64_t frame_time( const size_t frame_no )
 {
-  if ( argc != 4 ) {
-    usage();
-    return EXIT_FAILURE;
+  return ( frame_no * 1000 ) / frame_rate;
+}
+
+void print_link_summary( vector<uint64_t> & latencies, const size_t wins[ 2 ],
+                         const size_t q_high, const size_t q_low )
+{
+  if ( latencies.empty() ) {
+    return;
   }
 
+  sort( latencies.begin(), latencies.end() );
+
+  uint64_t total = 0;
+  for ( const auto latency : latencies ) {
+    total += latency;
+  }
+
+  cerr << "frames: " << latencies.size()
+       << " (q=" << q_high << ": " << wins[ 0 ]
+       << ", q=" << q_low << ": " << wins[ 1 ] << ")" << endl
+       << "latency (ms): mean=" << total / latencies.size()
+       << " p50=" << latencies[ latencies.size() / 2 ]
+       << " p95=" << latencies[ ( latencies.size() * 95 ) / 100 ]
+       << " max=" << latencies.back() << endl;
+}
+
+template <class Backend>
+int run( int argc, char const * argv[], const GopMode gop, const bool stream, const bool splice,
+         const bool skip_static, const bool paced, const bool count_allocations,
+         const bool perf, const string & metrics_name )
+{
   /* open the i/o streams */
   ifstream input_fin { argv[ 1 ] };
   ofstream fout { argv[ 2 ] };
-  ifstream trace_fin { argv[ 3 ] };
+
+  /* either replay the winners, or choose them against an emulated link */
+  Optional<LinkEmulator> link { argc == 6, argv[ 4 ], stoull( argc == 6 ? argv[ 5 ] : "0" ) };
+  ifstream trace_fin;
+  ofstream trace_fout;
+
+  if ( link.initialized() ) {
+    trace_fout.open( argv[ 3 ] );
+  }
+  else {
+    trace_fin.open( argv[ 3 ] );
+  }
+
+  vector<uint64_t> latencies;
+  size_t wins[ 2 ] = { 0 };
+  size_t frame_no = 0;
 
   /* create the raster buffer */
   Raster raster_buffer;
   raster_buffer.resize( frame_size );
 
-  /* create the frame buffers */
-  Frame frame_buffer[ 2 ];
-  frame_buffer[ 0 ].resize( frame_size );
-  frame_buffer[ 1 ].resize( frame_size );
+  FrameAnalyzer analyzer { width, height };
+  ActivitySummary activity;
 
-  /* the encoder objects */
-  unique_ptr<H264_encoder> encoders [ 2 ];
-  encoders[ 0 ].reset( new H264_encoder( width, height, q_high ) );
-  encoders[ 1 ].reset( new H264_encoder( width, height, q_low ) );
-  size_t out_frame_sizes[ 2 ] = { 0 };
+  /* indexed by FramePacer::Stage */
+  const vector<string> stages { "read", "encode", "resync", "write" };
+  Optional<AllocationProfile> allocations { count_allocations, stages };
+  Optional<PerfProfile> profile { perf, stages };
+  TimelineStages timeline { { "read", "encode", "resync", "write" } };
 
-  /* the decoder objects */
-  unique_ptr<H264_decoder> decoder { new H264_decoder( width, height ) };
+  /* after the counters, which only follow the threads started after them */
+  SalsifySender<Backend> sender { width, height, { Backend::HIGH_QUALITY, Backend::LOW_QUALITY }, gop, splice };
 
-  Optional<Raster> winning_raster;
+  Optional<FramePacer> pacer { paced, frame_rate, sender.quality_count() };
 
-  Raster temp_raster;
-  temp_raster.resize( frame_size );
+  Optional<LiveMetrics> metrics { not metrics_name.empty(), metrics_name, "ssender", stages,
+                                  vector<string> { "link queue ms" } };
 
-  Frame temp_frame;
-  temp_frame.resize( frame_size );
-  size_t temp_frame_size = 0;
+  /* what the timeline says about the current frame */
+  int64_t traced_frame = 0;
+  int64_t traced_bytes = 0;
+
+  string header_buffer;
 
   size_t winner = 0;
-  size_t prev_winner = 0;
+  const size_t lowest = sender.quality_count() - 1;
+
+  /* write each slice of the winner as soon as it is encoded */
+  auto write_part = [&]( const FrameHeader & part_header, const Chunk & part )
+    {
+      part_header.serialize( header_buffer );
+      fout << header_buffer;
+      fout.write( reinterpret_cast<const char *>( part.buffer() ), part.size() );
+      fout.flush();
+      traced_bytes += header_buffer.size() + part.size();
+    };
+
+  /* in place of an encoded frame; one line per frame in the trace either
+     way, so replays line up */
+  auto write_repeat = [&]()
+    {
+      if ( link.initialized() ) {
+        const uint64_t now = frame_time( frame_no );
+        latencies.push_back( link->send( now, FrameHeader::SIZE ) - now );
+        trace_fout << winner << endl;
+      }
+      else {
+        trace_fin >> winner;
+      }
+
+      frame_no++;
+      sender.repeat().serialize( header_buffer );
+      fout << header_buffer;
+      traced_bytes = header_buffer.size();
+    };
+
+  auto mark = [&]( const FramePacer::Stage stage )
+    {
+      if ( pacer.initialized() ) {
+        pacer->mark( stage );
+      }
+
+      if ( allocations.initialized() ) {
+        allocations->mark( stage );
+      }
+
+      if ( profile.initialized() ) {
+        profile->mark( stage );
+      }
+
+      if ( metrics.initialized() ) {
+        metrics->mark( stage );
+      }
+
+      if ( stage == FramePacer::RESYNC ) {
+        timeline.mark( stage, { { "frame", traced_frame }, { "winner", int64_t( winner ) },
+                                { "quantizer", int64_t( sender.quantizer( winner ) ) } } );
+      }
+      else if ( stage == FramePacer::WRITE ) {
+        timeline.mark( stage, { { "frame", traced_frame }, { "bytes", traced_bytes } } );
+      }
+      else {
+        timeline.mark( stage, { { "frame", traced_frame } } );
+      }
+    };
+
+  auto finish = [&]( const FramePacer::Outcome outcome )
+    {
+      if ( pacer.initialized() ) {
+        fout.flush();
+      }
+
+      mark( FramePacer::WRITE );
+
+      if ( pacer.initialized() ) {
+        pacer->finish( outcome );
+      }
+
+      if ( allocations.initialized() ) {
+        allocations->end_iteration();
+      }
+
+      if ( profile.initialized() ) {
+        profile->end_iteration();
+      }
+
+      if ( metrics.initialized() ) {
+        if ( outcome == FramePacer::Outcome::REPEATED or outcome == FramePacer::Outcome::DROPPED ) {
+          metrics->add_skipped();
+        }
+        else {
+          metrics->add_frame( sender.quantizer( winner ), traced_bytes );
+        }
+
+        if ( link.initialized() ) {
+          metrics->set_gauge( 0, int64_t( latencies.back() ) - int64_t( link->delay() ) );
+        }
+
+        metrics->end_iteration();
+      }
+    };
 
   while ( not input_fin.eof() ) {
-    trace_fin >> winner;
+    if ( pacer.initialized() ) {
+      pacer->release();
+    }
+
+    timeline.restart();
+
+    if ( metrics.initialized() ) {
+      metrics->restart();
+    }
+
+    traced_frame = frame_no;
+    traced_bytes = 0;
 
-    size_t winner_q = encoders[ winner ]->q();
     /* read and encode the raster with two different qualities */
     input_fin.read( reinterpret_cast<char *>( raster_buffer.data() ), frame_size );
-    out_frame_sizes[ 0 ] = encoders[ 0 ]->encode( raster_buffer.data(), frame_buffer[ 0 ].data() );
-    out_frame_sizes[ 1 ] = encoders[ 1 ]->encode( raster_buffer.data(), frame_buffer[ 1 ].data() );
-    fout.write( reinterpret_cast<char *>( &out_frame_sizes[ winner ] ), sizeof( out_frame_sizes[ winner ] ) );
-    fout.write( reinterpret_cast<char *>( &winner_q ), sizeof( winner_q ) );
-    fout.write( reinterpret_cast<char *>( frame_buffer[ winner ].data() ), out_frame_sizes[ winner ] );
-
-    if ( not winning_raster.initialized() ) {
-      winning_raster.reset();
-      winning_raster->resize( frame_size );
-      decoder->decode( frame_buffer[ winner ].data(), out_frame_sizes[ winner ], winning_raster->data() );
+    mark( FramePacer::READ );
+
+    if ( pacer.initialized() and pacer->late() ) {
+      mark( FramePacer::ENCODE );
+      write_repeat();
+      finish( FramePacer::Outcome::DROPPED );
+      continue;
     }
-    else {
-      if ( winner != prev_winner ) {
-        decoder.reset( new H264_decoder( width, height ) );
-        decoder->decode( temp_frame.data(), temp_frame_size, temp_raster.data() );
-        decoder->decode( frame_buffer[ winner ].data(), out_frame_sizes[ winner ], winning_raster->data() );
+
+    if ( skip_static ) {
+      const FrameActivity frame_activity = analyzer.analyze( raster_buffer.data() );
+      activity.add( frame_activity );
+
+      if ( frame_activity.is_static() ) {
+        mark( FramePacer::ENCODE );
+        write_repeat();
+        finish( FramePacer::Outcome::REPEATED );
+        continue;
       }
-      else {
-        decoder->decode( frame_buffer[ winner ].data(), out_frame_sizes[ winner ], winning_raster->data() );
+
+      analyzer.set_reference( raster_buffer.data() );
+    }
+
+    /* no time to encode the qualities that are not going to be sent */
+    const bool downgrade = pacer.initialized() and pacer->hurried();
+
+    if ( stream ) {
+      /* the winner has to be known before encoding starts */
+      trace_fin >> winner;
+
+      if ( downgrade ) {
+        winner = lowest;
+      }
+
+      sender.encode( raster_buffer.data(), winner, write_part, downgrade );
+    }
+    else if ( downgrade ) {
+      if ( not link.initialized() ) {
+        trace_fin >> winner;
       }
+
+      winner = lowest;
+      sender.encode( raster_buffer.data(), winner );
+
+      if ( link.initialized() ) {
+        const uint64_t now = frame_time( frame_no );
+        latencies.push_back( link->send( now, FrameHeader::SIZE + sender.frame_size( winner ) ) - now );
+        trace_fout << winner << endl;
+      }
+    }
+    else if ( link.initialized() ) {
+      sender.encode( raster_buffer.data() );
+
+      /* pick the best quality that the link can deliver before the next frame */
+      const uint64_t now = frame_time( frame_no );
+      const size_t budget = link->budget( now, frame_time( frame_no + 1 ) );
+
+      winner = ( sender.frame_size( 0 ) <= budget ) ? 0 : 1;
+
+      latencies.push_back( link->send( now, FrameHeader::SIZE + sender.frame_size( winner ) ) - now );
+      trace_fout << winner << endl;
+    }
+    else {
+      sender.encode( raster_buffer.data() );
+      trace_fin >> winner;
+    }
+
+    mark( FramePacer::ENCODE );
+
+    wins[ winner ]++;
+    frame_no++;
+
+    const FrameHeader header = sender.commit( winner );
+    mark( FramePacer::RESYNC );
+
+    if ( not stream ) {
+      header.serialize( header_buffer );
+      fout << header_buffer;
+      fout.write( reinterpret_cast<const char *>( sender.frame( winner ).buffer() ), header.length );
+      traced_bytes = header_buffer.size() + header.length;
     }
 
-    unique_ptr<H264_encoder> aux_encoder { new H264_encoder( width, height, encoders[ 1 - winner ]->q() ) };
-    temp_frame_size = aux_encoder->encode( winning_raster->data(), temp_frame.data() );
-    aux_encoder.swap( encoders[ 1 - winner ] );
-    prev_winner = winner;
+    finish( downgrade ? FramePacer::Outcome::DOWNGRADED : FramePacer::Outcome::ENCODED );
+  }
+
+  if ( link.initialized() ) {
+    print_link_summary( latencies, wins, Backend::HIGH_QUALITY, Backend::LOW_QUALITY );
+  }
+
+  if ( splice ) {
+    cerr << "spliced switches: " << sender.splice_count() << endl;
+  }
+
+  activity.print( cerr );
+
+  if ( pacer.initialized() ) {
+    pacer->print( cerr );
+  }
+
+  if ( allocations.initialized() ) {
+    allocations->print( cerr, "frame" );
+    cerr << "(resync allocates on every frame: it rebuilds the losing quality's encoder)" << endl;
+  }
+
+  if ( profile.initialized() ) {
+    profile->print( cerr, "frame" );
   }
 
   return 0;
 }
+
+int main( int argc, char const * argv[] )
+{
+  const string codec = take_option( argc, argv, "codec", H264Backend::name() );
+  const GopMode gop = parse_gop_mode( take_option( argc, argv, "gop", gop_mode_name( GopMode::INFINITE_GOP ) ) );
+  const bool stream = take_flag( argc, argv, "stream" );
+  const bool splice = take_flag( argc, argv, "splice" );
+  const bool skip_static = take_flag( argc, argv, "skip-static" );
+  const bool paced = take_flag( argc, argv, "paced" );
+  const bool count_allocations = take_flag( argc, argv, "count-allocations" );
+  const bool perf = take_flag( argc, argv, "perf" );
+  const string timeline = take_option( argc, argv, "timeline", "" );
+  const string metrics = take_option( argc, argv, "metrics", "" );
+  const string cache = take_option( argc, argv, "cache", "" );
+
+  if ( ( argc != 4 and argc != 6 ) or ( stream and argc == 6 ) ) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  if ( not cache.empty() ) {
+    EncodeCache::activate( cache );
+  }
+
+  if ( not timeline.empty() ) {
+    Timeline::activate( timeline );
+  }
+
+  const int status = with_backend( codec, [&]( auto backend ) {
+      return run<decltype( backend )>( argc, argv, gop, stream, splice, skip_static,
+                                       paced, count_allocations, perf, metrics );
+    } );
+
+  if ( EncodeCache::active() ) {
+    EncodeCache::active()->print_stats( cerr );
+  }
+
+  return status;
+}
@@ -0,0 +1,210 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* runs the sender and receiver over an emulated link for every combination
+   of high quality, low quality and link trace, concurrently, and writes one
+   table with the results. The input is mapped once and shared by all runs.
+
+   Backends that code each frame on the shared thread pool (the banded
+   ones) get the runs one at a time instead: runs side by side would wait
+   for their bands in the pool, and a thread waiting there can pick up a
+   whole other run. */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "file.hh"
+#include "thread_pool.hh"
+#include "link_emulator.hh"
+#include "quality.hh"
+#include "salsify_sender.hh"
+#include "encode_cache.hh"
+#include "salsify_receiver.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+constexpr uint16_t width = 1280;
+constexpr uint16_t height = 720;
+constexpr uint32_t frame_size = ( width * height * 3 ) / 2;
+
+constexpr uint64_t frame_rate = FRAME_RATE;
+
+void usage()
+{
+  cerr << "sweep [--codec=<backend>] [--gop=<mode>] [--cache=<dir>] <input.raw> <delay-ms> <results.tsv>"
+       << " <q-high>[,<q-high>...] <q-low>[,<q-low>...] <link.trace>..." << endl
+       << endl
+       << "  Backends: " << BACKEND_NAMES << " (default h264)." << endl
+       << "  GOP modes: all-intra, infinite, intra-refresh (default infinite)." << endl
+       << "  Quantizers are on the backend's own scale." << endl
+       << "  With --cache, h264 frames are looked up in (and added to) an encode" << endl
+       << "  cache in the given directory, shared by all runs." << endl;
+}
+
+vector<size_t> parse_list( const string & list )
+{
+  vector<size_t> values;
+  stringstream ss { list };
+
+  for ( string value; getline( ss, value, ',' ); ) {
+    values.push_back( stoul( value ) );
+  }
+
+  return values;
+}
+
+/* capture time of a frame, in milliseconds */
+uint64_t frame_time( const size_t frame_no )
+{
+  return ( frame_no * 1000 ) / frame_rate;
+}
+
+struct Run
+{
+  size_t q_high;
+  size_t q_low;
+  string trace;
+
+  size_t frames { 0 };
+  size_t low_quality_frames { 0 };
+  size_t bytes { 0 };
+  double encode_ms { 0 };
+  double decode_ms { 0 };
+  double psnr { 0 };
+  double ssim { 0 };
+  vector<uint64_t> latencies {};
+};
+
+double elapsed_ms( const steady_clock::time_point start )
+{
+  return duration<double, milli>( steady_clock::now() - start ).count();
+}
+
+/* the same loop as ssender with a link trace, with the receiver attached */
+template <class Backend>
+void simulate( const File & input, const uint64_t delay, const GopMode gop, Run & run )
+{
+  LinkEmulator link { run.trace, delay };
+  SalsifySender<Backend> sender { width, height, { run.q_high, run.q_low }, gop };
+  SalsifyReceiver<Backend> receiver { width, height, SalsifyReceiver<Backend>::DEFAULT_CAPACITY, false };
+
+  for ( size_t offset = 0; offset + frame_size <= input.size(); offset += frame_size ) {
+    const Chunk raster = input( offset, frame_size );
+
+    auto start = steady_clock::now();
+    sender.encode( raster.buffer() );
+    run.encode_ms += elapsed_ms( start );
+
+    const uint64_t now = frame_time( run.frames );
+    const size_t budget = link.budget( now, frame_time( run.frames + 1 ) );
+    const size_t winner = ( sender.frame_size( 0 ) <= budget ) ? 0 : 1;
+
+    const FrameHeader header = sender.commit( winner );
+    run.latencies.push_back( link.send( now, FrameHeader::SIZE + header.length ) - now );
+
+    start = steady_clock::now();
+    receiver.receive( header, sender.frame( winner ) );
+    run.decode_ms += elapsed_ms( start );
+
+    run.psnr += psnr( raster.buffer(), receiver.raster().data(), width, height );
+    run.ssim += ssim( raster.buffer(), receiver.raster().data(), width, height );
+
+    run.frames++;
+    run.low_quality_frames += winner;
+    run.bytes += header.length;
+  }
+}
+
+void write_results( ostream & out, vector<Run> & runs )
+{
+  out << "trace\tq_high\tq_low\tframes\tlow_quality_frames\tbytes"
+      << "\tencode_ms_per_frame\tdecode_ms_per_frame\tpsnr\tssim"
+      << "\tlatency_p50_ms\tlatency_p95_ms" << endl;
+
+  for ( Run & run : runs ) {
+    if ( run.frames == 0 ) {
+      continue;
+    }
+
+    sort( run.latencies.begin(), run.latencies.end() );
+    const double n = run.frames;
+
+    out << run.trace << "\t" << run.q_high << "\t" << run.q_low
+        << "\t" << run.frames << "\t" << run.low_quality_frames << "\t" << run.bytes
+        << "\t" << run.encode_ms / n << "\t" << run.decode_ms / n
+        << "\t" << run.psnr / n << "\t" << run.ssim / n
+        << "\t" << run.latencies[ run.latencies.size() / 2 ]
+        << "\t" << run.latencies[ ( run.latencies.size() * 95 ) / 100 ] << endl;
+  }
+}
+
+template <class Backend>
+int sweep( int argc, char const * argv[], const GopMode gop )
+{
+  const File input { argv[ 1 ] };
+  const uint64_t delay = stoull( argv[ 2 ] );
+
+  vector<Run> runs;
+  for ( int i = 6; i < argc; i++ ) {
+    for ( const size_t q_high : parse_list( argv[ 4 ] ) ) {
+      for ( const size_t q_low : parse_list( argv[ 5 ] ) ) {
+        runs.push_back( { q_high, q_low, argv[ i ] } );
+      }
+    }
+  }
+
+  const auto start = steady_clock::now();
+  const size_t threads = max( 1u, thread::hardware_concurrency() );
+
+  if ( Backend::USES_THREAD_POOL ) {
+    for ( Run & run : runs ) {
+      simulate<Backend>( input, delay, gop, run );
+    }
+  }
+  else {
+    /* whichever thread is free takes the next run; a pool of their own, so
+       that the runs never share a queue with anything the codecs do */
+    ThreadPool pool { threads - 1 };
+    pool.parallel_for( runs.size(),
+      [&]( const size_t i ) { simulate<Backend>( input, delay, gop, runs[ i ] ); } );
+  }
+
+  ofstream results { argv[ 3 ] };
+  write_results( results, runs );
+
+  cerr << runs.size() << " runs in " << elapsed_ms( start ) / 1000 << " s on "
+       << threads << " threads" << ( Backend::USES_THREAD_POOL ? ", one run at a time" : "" ) << endl;
+
+  if ( EncodeCache::active() ) {
+    EncodeCache::active()->print_stats( cerr );
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int main( int argc, char const * argv[] )
+{
+  const string codec = take_option( argc, argv, "codec", H264Backend::name() );
+  const GopMode gop = parse_gop_mode( take_option( argc, argv, "gop", gop_mode_name( GopMode::INFINITE_GOP ) ) );
+  const string cache = take_option( argc, argv, "cache", "" );
+
+  if ( argc < 7 ) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  if ( not cache.empty() ) {
+    EncodeCache::activate( cache );
+  }
+
+  return with_backend( codec, [&]( auto backend ) {
+      return sweep<decltype( backend )>( argc, argv, gop );
+    } );
+}
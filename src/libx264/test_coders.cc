@@ -1,4 +1,5 @@
 #include <chrono>
+#include <cmath>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
@@ -6,16 +7,529 @@
 #include <memory>
 #include <sstream>
 #include <vector>
+#include <algorithm>
 
 #include "h264_encoder.hh"
+#include "x264_encoder.hh"
+#include "nal_scanner.hh"
 #include "h264_decoder.hh"
+#include "salsify_sender.hh"
+#include "salsify_receiver.hh"
+#include "segment_encoder.hh"
+#include "thread_pool.hh"
+#include "quality.hh"
+#include "frame_analyzer.hh"
+#include "alloc_counter.hh"
+#include "perf_counters.hh"
+#include "optional.hh"
 
 #define PIX(x) (x < 0 ? 0 : (x > 255 ? 255 : x))
 
+// An encoder whose quantizer changes every frame should produce what a
+// dedicated fixed-quantizer encoder would have produced for that frame, at
+// least closely enough that either one can stand in for the other. All
+// encoders code intra frames only, so every frame stands on its own and
+// decoder2 can decode just the frames it is given.
+int check_dynamic_quantizer(std::ifstream &infile, std::ofstream &outfile,
+                            size_t width, size_t height, int q1, int q2)
+{
+    const size_t frame_size = width*height + width*height / 2;
+    const double min_psnr = 40.0;
+
+    std::vector<uint8_t> raw(frame_size), compressed(frame_size), reference(frame_size);
+    std::vector<uint8_t> decoded(frame_size), reference_decoded(frame_size);
+
+    H264_encoder dynamic_encoder(width, height, q1, GopMode::ALL_INTRA);
+    H264_decoder dynamic_decoder(width, height);
+
+    H264_encoder encoder1(width, height, q1, GopMode::ALL_INTRA);
+    H264_encoder encoder2(width, height, q2, GopMode::ALL_INTRA);
+    H264_decoder decoder1(width, height), decoder2(width, height);
+
+    size_t frame_count = 0, identical = 0;
+    size_t dynamic_bytes = 0, dedicated_bytes = 0;
+    double worst_psnr = 100.0;
+
+    while(infile.read((char*)raw.data(), frame_size)){
+        const bool second = frame_count % 2;
+
+        size_t size = dynamic_encoder.encode(raw.data(), compressed.data(), second ? q2 : q1);
+        dynamic_decoder.decode(compressed.data(), size, decoded.data());
+
+        // both dedicated encoders see every frame, like the dynamic one
+        size_t size1 = encoder1.encode(raw.data(), reference.data());
+        decoder1.decode(reference.data(), size1, reference_decoded.data());
+        if(second){
+            size_t size2 = encoder2.encode(raw.data(), reference.data());
+            decoder2.decode(reference.data(), size2, reference_decoded.data());
+            size1 = size2;
+        }
+        else{
+            encoder2.encode(raw.data(), reference.data());
+        }
+
+        const double frame_psnr = psnr(decoded.data(), reference_decoded.data(), width, height);
+        worst_psnr = std::min(worst_psnr, frame_psnr);
+        identical += (size == size1 && frame_psnr == MAX_PSNR);
+        dynamic_bytes += size;
+        dedicated_bytes += size1;
+
+        outfile.write((char*)decoded.data(), frame_size);
+        frame_count++;
+    }
+
+    std::cout << "frames: " << frame_count << ", identical to dedicated encoder: " << identical << "\n";
+    std::cout << "bytes: dynamic " << dynamic_bytes << ", dedicated " << dedicated_bytes << "\n";
+    std::cout << "worst luma PSNR against dedicated encoder: " << worst_psnr << " dB\n";
+
+    if(worst_psnr < min_psnr){
+        std::cout << "FAIL: per-frame quantizer diverges from the fixed-quantizer encoder\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// The same with P-frames. The dynamic encoder predicts every frame from its
+// own picture of the frame before, coded at the other quantizer, so the
+// dedicated encoder for each frame is given that reference the way the
+// receiver's resync gives it: it is built fresh, encodes the dynamic
+// stream's last decoded picture, and then the frame. That re-encode costs
+// some quality, so the bound is looser than with intra frames.
+int check_dynamic_quantizer_chain(std::ifstream &infile, std::ofstream &outfile,
+                                  size_t width, size_t height, int q1, int q2)
+{
+    const size_t frame_size = width*height + width*height / 2;
+    const double min_psnr = 30.0;
+
+    std::vector<uint8_t> raw(frame_size), compressed(frame_size), reference(frame_size);
+    std::vector<uint8_t> decoded(frame_size), last_decoded(frame_size), reference_decoded(frame_size);
+
+    H264_encoder dynamic_encoder(width, height, q1, GopMode::INFINITE_GOP);
+    H264_decoder dynamic_decoder(width, height);
+
+    size_t frame_count = 0;
+    double worst_psnr = 100.0, total_psnr = 0;
+
+    while(infile.read((char*)raw.data(), frame_size)){
+        const int q = frame_count % 2 ? q2 : q1;
+
+        const size_t size = dynamic_encoder.encode(raw.data(), compressed.data(), q);
+        dynamic_decoder.decode(compressed.data(), size, decoded.data());
+
+        H264_encoder dedicated(width, height, q, GopMode::INFINITE_GOP);
+        H264_decoder dedicated_decoder(width, height);
+
+        if(frame_count){
+            // the shared reference first; its picture is not compared
+            const size_t resync_size = dedicated.encode(last_decoded.data(), reference.data());
+            dedicated_decoder.decode(reference.data(), resync_size, reference_decoded.data());
+        }
+
+        const size_t reference_size = dedicated.encode(raw.data(), reference.data());
+        dedicated_decoder.decode(reference.data(), reference_size, reference_decoded.data());
+
+        const double frame_psnr = psnr(decoded.data(), reference_decoded.data(), width, height);
+        worst_psnr = std::min(worst_psnr, frame_psnr);
+        total_psnr += frame_psnr;
+
+        outfile.write((char*)decoded.data(), frame_size);
+        last_decoded.swap(decoded);
+        frame_count++;
+    }
+
+    if(frame_count){
+        std::cout << "with P-frames, luma PSNR against a dedicated encoder on the same reference: mean "
+                  << total_psnr / frame_count << " dB, worst " << worst_psnr << " dB\n";
+    }
+
+    if(worst_psnr < min_psnr){
+        std::cout << "FAIL: per-frame quantizer diverges from the fixed-quantizer encoder with P-frames\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// Sends the input through a sender and a receiver that switch between two
+// quantizers every few frames, and counts the frames where the receiver's
+// picture differs from what the sender thinks it shows. With `splice`,
+// the sender splices the switches it can. Static rasters are repeated
+// rather than encoded, as ssender --skip-static does.
+size_t count_desyncs(std::ifstream &infile, size_t width, size_t height, GopMode gop,
+                     bool splice = false)
+{
+    const size_t frame_size = width*height + width*height / 2;
+    const size_t switch_interval = 7;
+
+    SalsifySender<H264Backend> sender(width, height,
+                                      {H264Backend::HIGH_QUALITY, H264Backend::LOW_QUALITY}, gop, splice);
+    SalsifyReceiver<H264Backend> receiver(width, height);
+    FrameAnalyzer analyzer(width, height);
+
+    std::vector<uint8_t> raw(frame_size);
+    size_t frame_count = 0, desyncs = 0;
+
+    while(infile.read((char*)raw.data(), frame_size)){
+        if(analyzer.analyze(raw.data()).is_static()){
+            const FrameHeader header = sender.repeat();
+            receiver.receive(header, {raw.data(), 0});
+            desyncs += receiver.raster() != sender.state(header.base_state);
+            continue;
+        }
+        analyzer.set_reference(raw.data());
+
+        sender.encode(raw.data());
+
+        const size_t winner = (frame_count++ / switch_interval) % 2;
+        const FrameHeader header = sender.commit(winner);
+        receiver.receive(header, sender.frame(winner));
+
+        desyncs += receiver.raster() != sender.state(header.frame_no);
+    }
+
+    return desyncs;
+}
+
+// Encodes the input at two qualities, switching every few frames, then
+// decodes it with and without the receiver's speculation, and reports how
+// long receive() takes on switch frames and on the others each way.
+int compare_speculation(std::ifstream &infile, std::ofstream &outfile,
+                        size_t width, size_t height)
+{
+    const size_t frame_size = width*height + width*height / 2;
+    const size_t switch_interval = 7;
+
+    SalsifySender<H264Backend> sender(width, height,
+                                      {H264Backend::HIGH_QUALITY, H264Backend::LOW_QUALITY});
+
+    std::vector<FrameHeader> headers;
+    std::vector<std::string> frames;
+    std::vector<uint8_t> raw(frame_size);
+
+    while(infile.read((char*)raw.data(), frame_size)){
+        sender.encode(raw.data());
+
+        const size_t winner = (headers.size() / switch_interval) % 2;
+        headers.push_back(sender.commit(winner));
+
+        const Chunk frame = sender.frame(winner);
+        frames.emplace_back((const char*)frame.buffer(), frame.size());
+    }
+
+    for(const bool speculate : {false, true}){
+        SalsifyReceiver<H264Backend> receiver(width, height,
+                                              SalsifyReceiver<H264Backend>::DEFAULT_CAPACITY, speculate);
+        double switch_ms = 0, steady_ms = 0;
+        size_t switches = 0;
+
+        // the output is the last run's
+        outfile.seekp(0);
+
+        for(size_t i = 0; i < headers.size(); i++){
+            const auto start = std::chrono::steady_clock::now();
+            receiver.receive(headers[i], frames[i]);
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            if(headers[i].resync && headers[i].base_state != INITIAL_STATE){
+                switch_ms += ms;
+                switches++;
+            }
+            else{
+                steady_ms += ms;
+            }
+
+            // the speculation overlaps with this
+            outfile.write((const char*)receiver.raster().data(), frame_size);
+        }
+
+        std::cout << "speculation " << (speculate ? "on" : "off") << ": "
+                  << switches << " switch frames, mean " << (switches ? switch_ms / switches : 0) << " ms; "
+                  << headers.size() - switches << " other frames, mean "
+                  << (headers.size() > switches ? steady_ms / (headers.size() - switches) : 0) << " ms; "
+                  << receiver.speculation_hits() << " prepared, waited " << receiver.speculation_wait_ms() << " ms\n";
+
+        if(receiver.divergences()){
+            std::cout << "FAIL: " << receiver.divergences() << " frames differ from the sender's decode\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Encodes the input in every GOP mode, and reports the size and encode
+// time of each against all-intra. Also checks that each mode keeps the
+// sender and receiver in lockstep through quality switches, with and
+// without splicing.
+int compare_gop_modes(std::ifstream &infile, std::ofstream &outfile,
+                      size_t width, size_t height, int quantizer)
+{
+    const size_t frame_size = width*height + width*height / 2;
+
+    std::vector<uint8_t> raw(frame_size), compressed(frame_size), decoded(frame_size);
+    double intra_bytes = 0, intra_time = 0;
+    size_t total_desyncs = 0;
+
+    std::cout << std::fixed << std::setprecision(2);
+
+    for(GopMode gop : {GopMode::ALL_INTRA, GopMode::INFINITE_GOP, GopMode::INTRA_REFRESH}){
+        infile.clear();
+        infile.seekg(0);
+
+        H264_encoder encoder(width, height, quantizer, gop);
+        H264_decoder decoder(width, height);
+
+        size_t frame_count = 0, bytes = 0;
+        double encode_time = 0, total_psnr = 0;
+
+        while(infile.read((char*)raw.data(), frame_size)){
+            const auto start = std::chrono::steady_clock::now();
+            const size_t size = encoder.encode(raw.data(), compressed.data());
+            encode_time += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            decoder.decode(compressed.data(), size, decoded.data());
+            total_psnr += psnr(raw.data(), decoded.data(), width, height);
+            bytes += size;
+            frame_count++;
+
+            if(gop == GopMode::INFINITE_GOP){
+                outfile.write((char*)decoded.data(), frame_size);
+            }
+        }
+
+        if(frame_count == 0){
+            std::cout << "no frames in input\n";
+            return 1;
+        }
+
+        const double bytes_per_frame = double(bytes) / frame_count;
+        const double ms_per_frame = encode_time / frame_count;
+        if(gop == GopMode::ALL_INTRA){
+            intra_bytes = bytes_per_frame;
+            intra_time = ms_per_frame;
+        }
+
+        infile.clear();
+        infile.seekg(0);
+        const size_t desyncs = count_desyncs(infile, width, height, gop);
+        infile.clear();
+        infile.seekg(0);
+        const size_t spliced_desyncs = count_desyncs(infile, width, height, gop, true);
+        total_desyncs += desyncs + spliced_desyncs;
+
+        std::cout << std::setw(14) << gop_mode_name(gop) << ": "
+                  << bytes_per_frame << " bytes/frame (" << 100.0 * bytes_per_frame / intra_bytes << "%), "
+                  << ms_per_frame << " ms/frame (" << 100.0 * ms_per_frame / intra_time << "%), "
+                  << "luma PSNR " << total_psnr / frame_count << " dB, "
+                  << "sender/receiver mismatches " << desyncs
+                  << " (spliced " << spliced_desyncs << ")\n";
+    }
+
+    if(total_desyncs){
+        std::cout << "FAIL: receiver lost lockstep with the sender\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// Runs a sender and a receiver over the input, switching between the
+// qualities every switch_interval frames, and returns what the frames
+// after the warm-up allocated in all, or nothing if there were too few.
+Optional<AllocationSnapshot> steady_allocations(std::ifstream &infile, std::ofstream &outfile,
+                                                size_t width, size_t height,
+                                                const std::vector<size_t> &qualities,
+                                                size_t warmup_frames, size_t &steady_frames)
+{
+    const size_t frame_size = width*height + width*height / 2;
+    const size_t switch_interval = 7;
+
+    SalsifySender<H264Backend> sender(width, height, qualities);
+    SalsifyReceiver<H264Backend> receiver(width, height);
+
+    std::vector<uint8_t> raw(frame_size);
+    std::string header_buffer;
+
+    AllocationProfile profile({"encode", "commit", "serialize", "receive", "write"});
+    AllocationSnapshot warmup;
+
+    infile.clear();
+    infile.seekg(0);
+    outfile.seekp(0);
+
+    while(infile.read((char*)raw.data(), frame_size)){
+        const size_t winner = (profile.iterations() / switch_interval) % qualities.size();
+        profile.restart();
+
+        sender.encode(raw.data());
+        profile.mark(0);
+
+        // rebuilds the losers
+        const FrameHeader header = sender.commit(winner);
+        profile.mark(1);
+
+        header.serialize(header_buffer);
+        profile.mark(2);
+
+        sender.ack(receiver.receive(FrameHeader::parse(header_buffer), sender.frame(winner)));
+        profile.mark(3);
+
+        outfile.write((const char*)receiver.raster().data(), frame_size);
+        profile.mark(4);
+
+        profile.end_iteration();
+        if(profile.iterations() == warmup_frames){
+            warmup = profile.total();
+        }
+    }
+
+    if(profile.iterations() <= warmup_frames){
+        return {};
+    }
+
+    profile.print(std::cout, "frame");
+    steady_frames = profile.iterations() - warmup_frames;
+    return {true, profile.total() - warmup};
+}
+
+// Checks that a sender and a receiver at a single quality, as ssender and
+// sreceiver run between switches, do not allocate with operator new once
+// they have warmed up. What the codec libraries allocate on their own
+// (malloc) is reported but not held against them.
+//
+// Then runs them at two qualities and reports what that allocates without
+// failing on it: every frame rebuilds the losing encoder, and opening an
+// encoder allocates in the codec library (and takes an operator new for
+// the encoder itself), so switching is not allocation-free.
+int check_allocations(std::ifstream &infile, std::ofstream &outfile,
+                      size_t width, size_t height, int quantizer)
+{
+    // long enough for every buffer that gets recycled to have been made once
+    const size_t warmup_frames = 8;
+
+    size_t steady_frames = 0;
+    const Optional<AllocationSnapshot> single =
+        steady_allocations(infile, outfile, width, height, {size_t(quantizer)}, warmup_frames, steady_frames);
+
+    if(!single.initialized()){
+        std::cout << "FAIL: need more than " << warmup_frames << " frames\n";
+        return 1;
+    }
+
+    std::cout << "one quality, after " << warmup_frames << " frames: " << single->cxx.allocations << " operator new, "
+              << double(single->c.allocations) / steady_frames << " malloc ("
+              << double(single->c.bytes) / steady_frames << " bytes) per frame\n";
+
+    if(single->cxx.allocations){
+        std::cout << "FAIL: the steady state allocates\n";
+        return 1;
+    }
+
+    const Optional<AllocationSnapshot> switching =
+        steady_allocations(infile, outfile, width, height,
+                           {H264Backend::HIGH_QUALITY, H264Backend::LOW_QUALITY}, warmup_frames, steady_frames);
+
+    std::cout << "two qualities, after " << warmup_frames << " frames: "
+              << double(switching->cxx.allocations) / steady_frames << " operator new, "
+              << double(switching->c.allocations) / steady_frames << " malloc ("
+              << double(switching->c.bytes) / steady_frames << " bytes) per frame, "
+              << "mostly rebuilding the loser\n";
+
+    return 0;
+}
+
+// Both H.264 encoders have to code every frame as SLICES_PER_FRAME slices,
+// whatever the machine's core count, or their frames could not stand in
+// for each other.
+int check_slices(std::ifstream &infile, size_t width, size_t height, int quantizer)
+{
+    const size_t frame_size = width*height + width*height / 2;
+
+    H264_encoder libavcodec_encoder(width, height, quantizer);
+    X264_encoder x264_encoder(width, height, quantizer);
+
+    std::vector<uint8_t> raw(frame_size), compressed(frame_size);
+
+    auto count_slices = [&](size_t size){
+        NalScanner scanner(Chunk(compressed.data(), size));
+        NalUnit nal;
+        size_t slices = 0;
+        while(scanner.next(nal)){
+            slices += nal.is_slice();
+        }
+        return slices;
+    };
+
+    size_t frame_count = 0, mismatches = 0;
+    while(infile.read((char*)raw.data(), frame_size)){
+        const size_t libavcodec_slices = count_slices(libavcodec_encoder.encode(raw.data(), compressed.data()));
+        const size_t x264_slices = count_slices(x264_encoder.encode(raw.data(), compressed.data()));
+
+        if(libavcodec_slices != SLICES_PER_FRAME || x264_slices != SLICES_PER_FRAME){
+            std::cout << "frame " << frame_count << ": " << libavcodec_slices << " slices from H264_encoder, "
+                      << x264_slices << " from X264_encoder\n";
+            mismatches++;
+        }
+        frame_count++;
+    }
+
+    std::cout << "frames: " << frame_count << ", with other than " << SLICES_PER_FRAME
+              << " slices: " << mismatches << "\n";
+
+    if(mismatches){
+        std::cout << "FAIL: the H.264 encoders disagree on the slice layout\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// Encodes the input as independent segments on every core, then decodes
+// the stitched stream with a single decoder, which only works if each
+// segment really starts over with an IDR frame.
+int transcode_segments(const std::string &input_filename, std::ofstream &outfile,
+                       size_t width, size_t height, int quantizer)
+{
+    const size_t frame_size = width*height + width*height / 2;
+
+    H264_decoder decoder(width, height);
+    std::vector<uint8_t> compressed(frame_size), decoded(frame_size);
+    double decode_time = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    const size_t frame_count = encode_segments(input_filename, width, height, quantizer, SEGMENT_FRAMES,
+        [&](size_t, const uint8_t *frame, size_t size){
+            const auto decode_start = std::chrono::steady_clock::now();
+            std::copy(frame, frame + size, compressed.begin());
+            decoder.decode(compressed.data(), size, decoded.data());
+            decode_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - decode_start).count();
+
+            outfile.write((char*)decoded.data(), frame_size);
+        });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "frames: " << frame_count << " in segments of " << SEGMENT_FRAMES
+              << ", threads: " << ThreadPool::shared().size() + 1 << "\n";
+    std::cout << "encoded in " << seconds - decode_time << " s ("
+              << frame_count / (seconds - decode_time) << " frames/s)\n";
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
-    if(argc != 4){
-        std::cout << "usage: " << argv[0] << " <quantizer (1-64; lower is better)> <input.raw> <output.raw>\n";
+    if(argc != 4 && argc != 5){
+        std::cout << "usage: " << argv[0] << " <quantizer (1-64; lower is better)> <input.raw> <output.raw> [alternate quantizer | gop | segments | allocations | slices | speculation]\n";
+        std::cout << "  with an alternate quantizer, one encoder alternates between both quantizers\n";
+        std::cout << "  and is checked against dedicated fixed-quantizer encoders, with intra frames\n";
+        std::cout << "  and then with P-frames\n";
+        std::cout << "  with gop, every GOP mode is compared against all-intra coding\n";
+        std::cout << "  with segments, independent segments are encoded on every core and stitched\n";
+        std::cout << "  with allocations, a sender and receiver at one quality must not allocate once warmed up,\n";
+        std::cout << "  and what switching between two qualities allocates is reported\n";
+        std::cout << "  with slices, both H.264 encoders must code every frame as the same slices\n";
+        std::cout << "  with speculation, receive() is timed with and without the receiver's speculation\n";
         return 0;
     }
 
@@ -42,6 +556,39 @@ int main(int argc, char **argv)
                 return 0;
     }
 
+    if(argc == 5 && std::string(argv[4]) == "gop"){
+        return compare_gop_modes(infile, outfile, width, height, quantizer);
+    }
+
+    if(argc == 5 && std::string(argv[4]) == "segments"){
+        return transcode_segments(input_filename, outfile, width, height, quantizer);
+    }
+
+    if(argc == 5 && std::string(argv[4]) == "allocations"){
+        return check_allocations(infile, outfile, width, height, quantizer);
+    }
+
+    if(argc == 5 && std::string(argv[4]) == "slices"){
+        return check_slices(infile, width, height, quantizer);
+    }
+
+    if(argc == 5 && std::string(argv[4]) == "speculation"){
+        return compare_speculation(infile, outfile, width, height);
+    }
+
+    if(argc == 5){
+        const int alternate = std::stoi(argv[4]);
+        if(check_dynamic_quantizer(infile, outfile, width, height, quantizer, alternate)){
+            return 1;
+        }
+
+        // again from the start; the output is the P-frame run's
+        infile.clear();
+        infile.seekg(0);
+        outfile.seekp(0);
+        return check_dynamic_quantizer_chain(infile, outfile, width, height, quantizer, alternate);
+    }
+
     auto buffer1 = std::move(std::shared_ptr<uint8_t[]>((uint8_t*)aligned_alloc(32,frame_size)));;
     auto buffer2 = std::move(std::shared_ptr<uint8_t[]>((uint8_t*)aligned_alloc(32,frame_size)));;
     auto buffer3 = std::move(std::shared_ptr<uint8_t[]>((uint8_t*)aligned_alloc(32,frame_size)));;
@@ -49,22 +596,53 @@ int main(int argc, char **argv)
     H264_encoder encoder(width, height, quantizer);
     H264_decoder decoder(width, height);
 
+    QualitySummary quality;
+    double coding_time = 0, quality_time = 0;
+
+    // hardware counters per stage, where the machine has them
+    PerfProfile profile({"encode", "decode", "quality", "write"});
+
     size_t frame_count = 0;
-    while(!infile.eof()){
+    while(infile.read((char*)buffer1.get(), frame_size)){
 
-        // read in raw video
-        infile.read((char*)buffer1.get(), frame_size);
+        const auto start = std::chrono::steady_clock::now();
+        profile.restart();
 
         // encode
         size_t compressed_frame_size = encoder.encode(buffer1.get(), buffer2.get());
+        profile.mark(0);
 
         // decode
         decoder.decode(buffer2.get(), compressed_frame_size, buffer3.get());
+        profile.mark(1);
+
+        const auto decoded = std::chrono::steady_clock::now();
+
+        // measure against the source
+        const FrameQuality frame_quality = measure_quality(buffer1.get(), buffer3.get(), width, height);
+        quality.add(frame_quality);
+
+        const auto measured = std::chrono::steady_clock::now();
+        coding_time += std::chrono::duration<double, std::milli>(decoded - start).count();
+        quality_time += std::chrono::duration<double, std::milli>(measured - decoded).count();
+
+        std::cout << "frame " << frame_count << ": luma PSNR " << frame_quality.psnr_y
+                  << " dB, PSNR " << frame_quality.psnr << " dB, SSIM " << frame_quality.ssim << "\n";
+        profile.mark(2);
 
         // write out raw video
         outfile.write((char*)buffer3.get(), frame_size);
+        profile.mark(3);
+        profile.end_iteration();
         frame_count++;
     }
 
+    quality.print(std::cout);
+    profile.print(std::cout, "frame");
+    if(frame_count){
+        std::cout << "ms/frame: encode and decode " << coding_time / frame_count
+                  << ", quality " << quality_time / frame_count << "\n";
+    }
+
     return 0;
 }
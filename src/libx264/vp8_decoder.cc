@@ -0,0 +1,103 @@
+#include <cstring>
+#include <stdexcept>
+#include "vp8_decoder.hh"
+
+
+VP8_decoder::VP8_decoder(size_t _width, size_t _height) :
+    width(_width),
+    height(_height),
+    decoder_codec(NULL),
+    decoder_context(NULL),
+    decoder_frame(NULL),
+    decoder_packet(NULL),
+    packet_buffer(),
+    parts()
+{
+    avcodec_register_all();
+
+    decoder_codec = avcodec_find_decoder(codec_id);
+    if(decoder_codec == NULL){
+        throw std::runtime_error("vp8: decoder not found");
+    }
+
+    decoder_context = avcodec_alloc_context3(decoder_codec);
+    if(decoder_context == NULL){
+        throw std::runtime_error("vp8: could not allocate decoder context");
+    }
+
+    decoder_context->width = width;
+    decoder_context->height = height;
+
+    // frame threading would delay the output by a frame per thread
+    decoder_context->thread_count = 1;
+
+    if(avcodec_open2(decoder_context, decoder_codec, NULL) < 0){
+        throw std::runtime_error("vp8: could not open decoder");
+    }
+
+    decoder_frame = av_frame_alloc();
+    decoder_packet = av_packet_alloc();
+    if(decoder_frame == NULL || decoder_packet == NULL){
+        throw std::runtime_error("vp8: could not allocate frame or packet");
+    }
+}
+
+
+VP8_decoder::~VP8_decoder(){
+    avcodec_free_context(&decoder_context);
+    av_frame_free(&decoder_frame);
+    av_packet_free(&decoder_packet);
+}
+
+
+void VP8_decoder::reset(){
+    avcodec_flush_buffers(decoder_context);
+    parts.clear();
+}
+
+
+void VP8_decoder::decode_part(const uint8_t *input, size_t len){
+    parts.insert(parts.end(), input, input + len);
+}
+
+
+void VP8_decoder::finish_frame(uint8_t *output){
+    decode(parts.data(), parts.size(), output);
+    parts.clear();
+}
+
+
+void VP8_decoder::decode(uint8_t *input, size_t len, uint8_t *output){
+    packet_buffer.resize(len + AV_INPUT_BUFFER_PADDING_SIZE);
+    std::memcpy(packet_buffer.data(), input, len);
+    std::memset(packet_buffer.data() + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    decoder_packet->data = packet_buffer.data();
+    decoder_packet->size = len;
+
+    bool output_set = false;
+    if(avcodec_send_packet(decoder_context, decoder_packet) >= 0 &&
+       avcodec_receive_frame(decoder_context, decoder_frame) >= 0){
+        output_set = true;
+    }
+
+    uint8_t *plane = output;
+    for(int p = 0; p < 3; p++){
+        const size_t plane_width = p ? width / 2 : width;
+        const size_t plane_height = p ? height / 2 : height;
+
+        // same placeholder as H264_decoder when nothing could be decoded
+        if(!output_set){
+            std::memset(plane, p ? 128 : 255, plane_width*plane_height);
+        }
+        else{
+            for(size_t row = 0; row < plane_height; row++){
+                std::memcpy(plane + row*plane_width,
+                            decoder_frame->data[p] + row*decoder_frame->linesize[p],
+                            plane_width);
+            }
+        }
+
+        plane += plane_width*plane_height;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/frame.h"
+}
+
+#include <vector>
+
+// libavcodec's own VP8 decoder. Every call to decode() gets exactly one
+// frame, so unlike H264_decoder there is no parser in front of it.
+class VP8_decoder{
+public:
+    VP8_decoder(size_t _width, size_t _height);
+    ~VP8_decoder();
+
+    VP8_decoder(const VP8_decoder &) = delete;
+    VP8_decoder & operator=(const VP8_decoder &) = delete;
+
+    void decode(uint8_t *input, size_t len, uint8_t *output);
+
+    // same interface as H264_decoder; VP8 frames cannot be decoded in
+    // pieces, so the parts are collected and decoded by finish_frame()
+    void decode_part(const uint8_t *input, size_t len);
+    void finish_frame(uint8_t *output);
+
+    // forget all decoded pictures without reopening the codec
+    void reset();
+
+private:
+    const AVCodecID codec_id = AV_CODEC_ID_VP8;
+
+    const size_t width;
+    const size_t height;
+
+    AVCodec *decoder_codec;
+    AVCodecContext *decoder_context;
+    AVFrame *decoder_frame;
+    AVPacket *decoder_packet;
+
+    // libavcodec reads past the end of its input; keep a padded copy
+    std::vector<uint8_t> packet_buffer;
+
+    std::vector<uint8_t> parts;
+};
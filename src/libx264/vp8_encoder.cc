@@ -0,0 +1,105 @@
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "vp8_encoder.hh"
+
+
+VP8_encoder::VP8_encoder(size_t _width, size_t _height, size_t quantization, GopMode gop) :
+    width(_width),
+    height(_height),
+    quantization(quantization),
+    frame_count(0),
+    gop_mode(gop),
+    config(),
+    encoder(),
+    picture()
+{
+    if(vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &config, 0) != VPX_CODEC_OK){
+        throw std::runtime_error("vp8: could not get the default configuration");
+    }
+
+    config.g_w = width;
+    config.g_h = height;
+    config.g_timebase.num = 1;
+    config.g_timebase.den = FRAME_RATE;
+    config.g_pass = VPX_RC_ONE_PASS;
+    config.g_lag_in_frames = 0;
+    config.g_error_resilient = 0;
+
+    // the receiver re-encodes rasters to resync, so the output has to be
+    // deterministic: no encoder threads
+    config.g_threads = 1;
+
+    // key frames only where the GOP mode puts them
+    config.kf_mode = VPX_KF_DISABLED;
+
+    config.rc_end_usage = VPX_VBR;
+    config.rc_min_quantizer = quantization;
+    config.rc_max_quantizer = quantization;
+
+    if(vpx_codec_enc_init(&encoder, vpx_codec_vp8_cx(), &config, 0) != VPX_CODEC_OK){
+        throw std::runtime_error("vp8: could not open encoder");
+    }
+
+    // favour speed, like the "fast" preset of the H.264 backends
+    vpx_codec_control(&encoder, VP8E_SET_CPUUSED, 8);
+    vpx_codec_control(&encoder, VP8E_SET_NOISE_SENSITIVITY, 0);
+}
+
+
+VP8_encoder::~VP8_encoder(){
+    vpx_codec_destroy(&encoder);
+}
+
+
+Chunk VP8_encoder::encode(const uint8_t *input){
+    // libvpx only reads the planes, straight out of the caller's raster
+    vpx_img_wrap(&picture, VPX_IMG_FMT_I420, width, height, 1, const_cast<uint8_t *>(input));
+
+    const bool key_frame = gop_mode == GopMode::ALL_INTRA ||
+        (gop_mode == GopMode::INTRA_REFRESH && frame_count % INTRA_REFRESH_PERIOD == 0);
+    const vpx_enc_frame_flags_t flags = key_frame ? VPX_EFLAG_FORCE_KF : 0;
+
+    if(vpx_codec_encode(&encoder, &picture, frame_count++, 1, flags, VPX_DL_REALTIME) != VPX_CODEC_OK){
+        throw std::runtime_error(std::string("vp8: error during encoding: ") + vpx_codec_error(&encoder));
+    }
+
+    Chunk frame(NULL, 0);
+    vpx_codec_iter_t iter = NULL;
+    const vpx_codec_cx_pkt_t *packet;
+    while((packet = vpx_codec_get_cx_data(&encoder, &iter)) != NULL){
+        if(packet->kind == VPX_CODEC_CX_FRAME_PKT){
+            frame = Chunk(static_cast<const uint8_t *>(packet->data.frame.buf), packet->data.frame.sz);
+        }
+    }
+
+    return frame;
+}
+
+
+size_t VP8_encoder::encode(uint8_t *input, uint8_t *output){
+    const Chunk frame = encode(input);
+    std::memcpy(output, frame.buffer(), frame.size());
+    return frame.size();
+}
+
+
+size_t VP8_encoder::encode(uint8_t *input, uint8_t *output, const SliceSink &sink){
+    const size_t size = encode(input, output);
+    sink(Chunk(output, size));
+    return size;
+}
+
+
+size_t VP8_encoder::encode(uint8_t *input, uint8_t *output, size_t q){
+    if(q != quantization){
+        config.rc_min_quantizer = q;
+        config.rc_max_quantizer = q;
+        if(vpx_codec_enc_config_set(&encoder, &config) != VPX_CODEC_OK){
+            throw std::runtime_error("vp8: could not change the quantizer");
+        }
+        quantization = q;
+    }
+
+    return encode(input, output);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+extern "C" {
+#include <stdint.h>
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+}
+
+#include <cstddef>
+
+#include "chunk.hh"
+#include "gop_mode.hh"
+#include "slice_sink.hh"
+
+// VP8 through libvpx. libavcodec's libvpx wrapper cannot change the
+// quantizer of an open encoder, so this talks to libvpx directly; the
+// quantizer is pinned by setting the rate control's min and max to it.
+// Quantizers are on VP8's 0-63 scale. VP8 has no intra refresh, so
+// GopMode::INTRA_REFRESH inserts a key frame every INTRA_REFRESH_PERIOD
+// frames instead.
+class VP8_encoder{
+public:
+    VP8_encoder(size_t _width, size_t _height, size_t quantization,
+                GopMode gop = GopMode::INFINITE_GOP);
+    ~VP8_encoder();
+
+    VP8_encoder(const VP8_encoder &) = delete;
+    VP8_encoder & operator=(const VP8_encoder &) = delete;
+
+    // same interface as H264_encoder
+    size_t encode(uint8_t *input, uint8_t *output);
+    size_t encode(uint8_t *input, uint8_t *output, size_t q);
+    // VP8 frames are not sliced, so sink gets the frame in one piece
+    size_t encode(uint8_t *input, uint8_t *output, const SliceSink &sink);
+
+    size_t q() const { return quantization; }
+    GopMode gop() const { return gop_mode; }
+
+    // the encoded frame, valid until the next call
+    Chunk encode(const uint8_t *input);
+
+private:
+    const size_t width;
+    const size_t height;
+    size_t quantization;
+    vpx_codec_pts_t frame_count;
+    const GopMode gop_mode;
+
+    vpx_codec_enc_cfg_t config;
+    vpx_codec_ctx_t encoder;
+    vpx_image_t picture;
+};
@@ -0,0 +1,177 @@
+#include <cstring>
+#include <stdexcept>
+#include "x264_encoder.hh"
+
+
+X264_encoder::X264_encoder(size_t _width, size_t _height, size_t quantization, GopMode gop) :
+    width(_width),
+    height(_height),
+    quantization(quantization),
+    frame_count(0),
+    gop_mode(gop),
+    params(),
+    encoder(NULL),
+    picture_in(),
+    picture_out(),
+    frame_buffer(_width * _height * 3),
+    frame_size(0),
+    sink(NULL)
+{
+    // mirror what libavcodec's libx264 wrapper does with H264_encoder's settings
+    if(x264_param_default_preset(&params, "fast", "zerolatency") < 0){
+        throw std::runtime_error("x264: could not apply preset");
+    }
+
+    params.i_log_level = X264_LOG_NONE;
+    params.i_csp = X264_CSP_I420;
+    params.i_width = width;
+    params.i_height = height;
+
+    // as H264_encoder pins it; with more threads x264 would also add slices
+    params.i_threads = 1;
+    params.i_lookahead_threads = 1;
+    params.i_slice_count = SLICES_PER_FRAME;
+
+    // NAL units are written into frame_buffer as they are finished
+    params.nalu_process = nal_ready;
+
+    params.i_fps_num = FRAME_RATE;
+    params.i_fps_den = 1;
+    params.i_timebase_num = 1;
+    params.i_timebase_den = FRAME_RATE;
+
+    switch(gop_mode){
+    case GopMode::ALL_INTRA:
+        params.i_keyint_max = 1;
+        break;
+    case GopMode::INFINITE_GOP:
+        params.i_keyint_max = X264_KEYINT_MAX_INFINITE;
+        break;
+    case GopMode::INTRA_REFRESH:
+        params.i_keyint_max = INTRA_REFRESH_PERIOD;
+        params.b_intra_refresh = 1;
+        break;
+    }
+    params.i_scenecut_threshold = 0;
+    params.i_bframe = 0;
+
+    // constant quantizer that can change between frames (see H264_encoder)
+    params.rc.i_rc_method = X264_RC_CRF;
+    params.rc.f_rf_constant = quantization;
+    params.rc.f_qcompress = 1.0;
+    params.rc.f_ip_factor = 1.0;
+    params.rc.i_aq_mode = X264_AQ_NONE;
+
+    encoder = x264_encoder_open(&params);
+    if(encoder == NULL){
+        throw std::runtime_error("x264: could not open encoder");
+    }
+
+    x264_picture_init(&picture_in);
+    picture_in.img.i_csp = X264_CSP_I420;
+    picture_in.img.i_plane = 3;
+    picture_in.opaque = this;
+}
+
+
+X264_encoder::~X264_encoder(){
+    x264_encoder_close(encoder);
+}
+
+
+void X264_encoder::nal_ready(x264_t *h, x264_nal_t *nal, void *opaque){
+    // with a single thread, x264 finishes the NAL units one at a time and
+    // in decoding order
+    X264_encoder *self = static_cast<X264_encoder *>(opaque);
+
+    // x264 may need this much room to add start codes and emulation prevention
+    const size_t offset = self->frame_size;
+    const size_t worst_case = nal->i_payload * 3 / 2 + 5 + 64;
+    if(self->frame_buffer.size() < offset + worst_case){
+        self->frame_buffer.resize(offset + worst_case);
+    }
+
+    x264_nal_encode(h, self->frame_buffer.data() + offset, nal);
+    self->frame_size += nal->i_payload;
+
+    if(self->sink != NULL && *self->sink){
+        (*self->sink)(Chunk(self->frame_buffer.data() + offset, nal->i_payload));
+    }
+}
+
+
+Chunk X264_encoder::encode(const uint8_t *input, const SliceSink &slice_sink){
+    const uint8_t *const planes[3] = {input, input + width*height, input + width*height + width*height/4};
+    const int strides[3] = {int(width), int(width/2), int(width/2)};
+    return encode(planes, strides, slice_sink);
+}
+
+
+Chunk X264_encoder::encode(const uint8_t *const planes[3], const int strides[3],
+                           const SliceSink &slice_sink){
+    // x264 only reads the planes, straight out of the caller's buffers
+    for(int p = 0; p < 3; p++){
+        picture_in.img.plane[p] = const_cast<uint8_t *>(planes[p]);
+        picture_in.img.i_stride[p] = strides[p];
+    }
+    picture_in.i_pts = frame_count++;
+
+    frame_size = 0;
+    sink = &slice_sink;
+
+    x264_nal_t *nals = NULL;
+    int nal_count = 0;
+    const int size = x264_encoder_encode(encoder, &nals, &nal_count, &picture_in, &picture_out);
+    sink = NULL;
+
+    if(size < 0){
+        throw std::runtime_error("x264: error during encoding");
+    }
+
+    return Chunk(frame_buffer.data(), frame_size);
+}
+
+
+size_t X264_encoder::encode(uint8_t *input, uint8_t *output, const SliceSink &slice_sink){
+    const Chunk frame = encode(input, slice_sink);
+    std::memcpy(output, frame.buffer(), frame.size());
+    return frame.size();
+}
+
+
+size_t X264_encoder::encode(uint8_t *input, uint8_t *output){
+    const Chunk frame = encode(input);
+    std::memcpy(output, frame.buffer(), frame.size());
+    return frame.size();
+}
+
+
+size_t X264_encoder::encode(uint8_t *input, uint8_t *output, size_t q){
+    set_quantizer(q);
+    return encode(input, output);
+}
+
+
+size_t X264_encoder::encode(const uint8_t *const planes[3], const int strides[3], uint8_t *output){
+    const Chunk frame = encode(planes, strides);
+    std::memcpy(output, frame.buffer(), frame.size());
+    return frame.size();
+}
+
+
+size_t X264_encoder::encode(const uint8_t *const planes[3], const int strides[3],
+                            uint8_t *output, size_t q){
+    set_quantizer(q);
+    return encode(planes, strides, output);
+}
+
+
+void X264_encoder::set_quantizer(size_t q){
+    if(q != quantization){
+        params.rc.f_rf_constant = q;
+        if(x264_encoder_reconfig(encoder, &params) < 0){
+            throw std::runtime_error("x264: could not change the quantizer");
+        }
+        quantization = q;
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+extern "C" {
+#include <stdint.h>
+#include <x264.h>
+}
+
+#include <cstddef>
+#include <vector>
+
+#include "chunk.hh"
+#include "gop_mode.hh"
+#include "slice_sink.hh"
+
+// Talks to libx264 directly instead of through libavcodec: the picture
+// points at the caller's planes and the encoded NAL units are handed back
+// without a copy, each one as soon as x264 finishes it. Configured exactly
+// like H264_encoder, so both produce the same bitstream for the same input.
+class X264_encoder{
+public:
+    X264_encoder(size_t _width, size_t _height, size_t quantization,
+                 GopMode gop = GopMode::INFINITE_GOP);
+    ~X264_encoder();
+
+    X264_encoder(const X264_encoder &) = delete;
+    X264_encoder & operator=(const X264_encoder &) = delete;
+
+    // same interface as H264_encoder
+    size_t encode(uint8_t *input, uint8_t *output);
+    size_t encode(uint8_t *input, uint8_t *output, size_t q);
+    size_t q() const { return quantization; }
+    GopMode gop() const { return gop_mode; }
+
+    size_t encode(uint8_t *input, uint8_t *output, const SliceSink &sink);
+
+    // the encoded frame, valid until the next call; sink (if any) gets
+    // each NAL unit while the rest of the frame is still being encoded
+    Chunk encode(const uint8_t *input, const SliceSink &sink = SliceSink());
+
+    // the same, from separate Y, U and V planes with the given row strides
+    Chunk encode(const uint8_t *const planes[3], const int strides[3],
+                 const SliceSink &sink = SliceSink());
+    size_t encode(const uint8_t *const planes[3], const int strides[3], uint8_t *output);
+    size_t encode(const uint8_t *const planes[3], const int strides[3], uint8_t *output, size_t q);
+
+private:
+    const size_t width;
+    const size_t height;
+    size_t quantization;
+    int64_t frame_count;
+    const GopMode gop_mode;
+
+    x264_param_t params;
+    x264_t *encoder;
+    x264_picture_t picture_in;
+    x264_picture_t picture_out;
+
+    // the NAL units of the current frame, back to back
+    std::vector<uint8_t> frame_buffer;
+    size_t frame_size;
+    const SliceSink *sink;
+
+    static void nal_ready(x264_t *h, x264_nal_t *nal, void *opaque);
+    void set_quantizer(size_t q);
+};
@@ -0,0 +1,218 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <new>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+
+#include "alloc_counter.hh"
+
+using namespace std;
+
+namespace {
+
+/* off until the first AllocationProfile, so programs that never count pay
+   one relaxed load per allocation and nothing else */
+atomic<bool> counting { false };
+
+struct Counter
+{
+  atomic<uint64_t> allocations { 0 };
+  atomic<uint64_t> bytes { 0 };
+
+  void add( const size_t size )
+  {
+    if ( not counting.load( memory_order_relaxed ) ) {
+      return;
+    }
+
+    allocations.fetch_add( 1, memory_order_relaxed );
+    bytes.fetch_add( size, memory_order_relaxed );
+  }
+
+  AllocationCount get( void ) const
+  {
+    return { allocations.load( memory_order_relaxed ), bytes.load( memory_order_relaxed ) };
+  }
+};
+
+/* constant-initialized, so they work before any constructor runs */
+Counter cxx_counter;
+Counter c_counter;
+
+}
+
+/* sanitizers bring allocators of their own */
+#if defined( __GLIBC__ ) and not defined( __SANITIZE_ADDRESS__ ) and not defined( __SANITIZE_THREAD__ )
+
+/* glibc's own allocator, under the names it exports for replacements like
+   this one; operator new goes straight to it, to be counted only once */
+extern "C" {
+void * __libc_malloc( size_t size );
+void * __libc_calloc( size_t count, size_t size );
+void * __libc_realloc( void * ptr, size_t size );
+void * __libc_memalign( size_t alignment, size_t size );
+void __libc_free( void * ptr );
+
+void * malloc( size_t size ) noexcept
+{
+  c_counter.add( size );
+  return __libc_malloc( size );
+}
+
+void * calloc( size_t count, size_t size ) noexcept
+{
+  c_counter.add( count * size );
+  return __libc_calloc( count, size );
+}
+
+void * realloc( void * ptr, size_t size ) noexcept
+{
+  if ( size ) {
+    c_counter.add( size );
+  }
+
+  return __libc_realloc( ptr, size );
+}
+
+void * memalign( size_t alignment, size_t size ) noexcept
+{
+  c_counter.add( size );
+  return __libc_memalign( alignment, size );
+}
+
+void * aligned_alloc( size_t alignment, size_t size ) noexcept
+{
+  c_counter.add( size );
+  return __libc_memalign( alignment, size );
+}
+
+int posix_memalign( void ** ptr, size_t alignment, size_t size ) noexcept
+{
+  if ( alignment < sizeof( void * ) or ( alignment & ( alignment - 1 ) ) ) {
+    return EINVAL;
+  }
+
+  c_counter.add( size );
+  void * const allocated = __libc_memalign( alignment, size );
+
+  if ( allocated == nullptr ) {
+    return ENOMEM;
+  }
+
+  *ptr = allocated;
+  return 0;
+}
+
+void free( void * ptr ) noexcept
+{
+  __libc_free( ptr );
+}
+}
+
+#define RAW_MALLOC __libc_malloc
+#define RAW_FREE __libc_free
+
+bool AllocationSnapshot::counts_malloc( void ) { return true; }
+
+#else
+
+#define RAW_MALLOC std::malloc
+#define RAW_FREE std::free
+
+bool AllocationSnapshot::counts_malloc( void ) { return false; }
+
+#endif
+
+void * operator new( size_t size )
+{
+  cxx_counter.add( size );
+  void * const ptr = RAW_MALLOC( size ? size : 1 );
+
+  if ( ptr == nullptr ) {
+    throw bad_alloc();
+  }
+
+  return ptr;
+}
+
+void * operator new[]( size_t size )
+{
+  return operator new( size );
+}
+
+void * operator new( size_t size, const nothrow_t & ) noexcept
+{
+  cxx_counter.add( size );
+  return RAW_MALLOC( size ? size : 1 );
+}
+
+void * operator new[]( size_t size, const nothrow_t & tag ) noexcept
+{
+  return operator new( size, tag );
+}
+
+void operator delete( void * ptr ) noexcept { RAW_FREE( ptr ); }
+void operator delete[]( void * ptr ) noexcept { RAW_FREE( ptr ); }
+void operator delete( void * ptr, size_t ) noexcept { RAW_FREE( ptr ); }
+void operator delete[]( void * ptr, size_t ) noexcept { RAW_FREE( ptr ); }
+void operator delete( void * ptr, const nothrow_t & ) noexcept { RAW_FREE( ptr ); }
+void operator delete[]( void * ptr, const nothrow_t & ) noexcept { RAW_FREE( ptr ); }
+
+AllocationSnapshot AllocationSnapshot::now( void )
+{
+  return { cxx_counter.get(), c_counter.get() };
+}
+
+void AllocationSnapshot::start_counting( void )
+{
+  counting.store( true, memory_order_relaxed );
+}
+
+AllocationProfile::AllocationProfile( const vector<string> & stages )
+  : stages_( stages ), totals_( stages.size() ), last_()
+{
+  AllocationSnapshot::start_counting();
+  last_ = AllocationSnapshot::now();
+}
+
+void AllocationProfile::mark( const size_t stage )
+{
+  const AllocationSnapshot now = AllocationSnapshot::now();
+  totals_.at( stage ) += now - last_;
+  last_ = now;
+}
+
+AllocationSnapshot AllocationProfile::total( void ) const
+{
+  AllocationSnapshot sum;
+
+  for ( const auto & stage : totals_ ) {
+    sum += stage;
+  }
+
+  return sum;
+}
+
+void AllocationProfile::print( ostream & out, const string & iteration_name ) const
+{
+  if ( iterations_ == 0 ) {
+    return;
+  }
+
+  out << "allocations per " << iteration_name << " (operator new"
+      << ( AllocationSnapshot::counts_malloc() ? " + malloc" : "" ) << "):";
+
+  for ( size_t i = 0; i < stages_.size(); i++ ) {
+    const AllocationSnapshot & stage = totals_[ i ];
+    out << " " << stages_[ i ] << "=" << double( stage.cxx.allocations ) / iterations_;
+
+    if ( AllocationSnapshot::counts_malloc() ) {
+      out << "+" << double( stage.c.allocations ) / iterations_;
+    }
+
+    out << " (" << double( stage.cxx.bytes + stage.c.bytes ) / iterations_ << " bytes)";
+  }
+
+  out << endl;
+}
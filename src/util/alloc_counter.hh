@@ -0,0 +1,95 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef ALLOC_COUNTER_HH
+#define ALLOC_COUNTER_HH
+
+/* Counts the heap allocations the program makes. Linking this in replaces
+   the global operator new, and with glibc also malloc() and its relatives,
+   so what libavcodec, x264 and libvpx allocate is counted as well (as
+   "malloc"; operator new is counted on its own). Nothing is counted until
+   the first AllocationProfile (or start_counting()); until then each
+   allocation costs one relaxed load, and after it two relaxed atomic
+   additions as well. */
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+struct AllocationCount
+{
+  uint64_t allocations { 0 };
+  uint64_t bytes { 0 };
+
+  AllocationCount operator-( const AllocationCount & other ) const
+  {
+    return { allocations - other.allocations, bytes - other.bytes };
+  }
+
+  AllocationCount & operator+=( const AllocationCount & other )
+  {
+    allocations += other.allocations;
+    bytes += other.bytes;
+    return *this;
+  }
+};
+
+struct AllocationSnapshot
+{
+  /* by operator new (C++ code, ours and the standard library's) */
+  AllocationCount cxx {};
+
+  /* by malloc() and the like (the C libraries); always zero if those
+     cannot be replaced on this platform */
+  AllocationCount c {};
+
+  /* everything allocated since counting started */
+  static AllocationSnapshot now( void );
+
+  /* counting stays on from here to the end of the program */
+  static void start_counting( void );
+
+  /* whether malloc() is being counted */
+  static bool counts_malloc( void );
+
+  AllocationSnapshot operator-( const AllocationSnapshot & other ) const
+  {
+    return { cxx - other.cxx, c - other.c };
+  }
+
+  AllocationSnapshot & operator+=( const AllocationSnapshot & other )
+  {
+    cxx += other.cxx;
+    c += other.c;
+    return *this;
+  }
+};
+
+/* allocations made in each stage of a loop, per iteration: mark() the end
+   of every stage, in any order, and end_iteration() once per pass */
+class AllocationProfile
+{
+private:
+  std::vector<std::string> stages_;
+  std::vector<AllocationSnapshot> totals_;
+  AllocationSnapshot last_;
+  size_t iterations_ { 0 };
+
+public:
+  explicit AllocationProfile( const std::vector<std::string> & stages );
+
+  /* what was allocated before here belongs to no stage */
+  void restart( void ) { last_ = AllocationSnapshot::now(); }
+
+  void mark( const size_t stage );
+  void end_iteration( void ) { iterations_++; }
+
+  size_t iterations( void ) const { return iterations_; }
+
+  /* over every stage and iteration */
+  AllocationSnapshot total( void ) const;
+
+  void print( std::ostream & out, const std::string & iteration_name ) const;
+};
+
+#endif /* ALLOC_COUNTER_HH */
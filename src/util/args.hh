@@ -0,0 +1,48 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef ARGS_HH
+#define ARGS_HH
+
+/* options on the command line, taken out of argv so that what is left are
+   the positional arguments */
+
+#include <string>
+#include <algorithm>
+
+/* removes a --<name>=<value> argument from the command line and returns
+   its value, or `fallback` if there is none */
+inline std::string take_option( int & argc, char const * argv[],
+                                const std::string & name, const std::string & fallback )
+{
+  const std::string prefix = "--" + name + "=";
+
+  for ( int i = 1; i < argc; i++ ) {
+    const std::string arg = argv[ i ];
+
+    if ( arg.compare( 0, prefix.size(), prefix ) == 0 ) {
+      std::copy( argv + i + 1, argv + argc, argv + i );
+      argc--;
+      return arg.substr( prefix.size() );
+    }
+  }
+
+  return fallback;
+}
+
+/* removes a --<name> argument from the command line, and tells if it was there */
+inline bool take_flag( int & argc, char const * argv[], const std::string & name )
+{
+  const std::string flag = "--" + name;
+
+  for ( int i = 1; i < argc; i++ ) {
+    if ( argv[ i ] == flag ) {
+      std::copy( argv + i + 1, argv + argc, argv + i );
+      argc--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+#endif /* ARGS_HH */
@@ -0,0 +1,120 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <fcntl.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cstring>
+
+#include "blob_store.hh"
+#include "exception.hh"
+
+using namespace std;
+
+constexpr size_t BlobStore::RECORD_HEADER_SIZE;
+
+BlobStore::BlobStore( const string & filename )
+  : fd_( SystemCall( filename, open( filename.c_str(), O_RDWR | O_CREAT, 0644 ) ) ),
+    mapped_size_( fd_.size() ),
+    mapped_( mapped_size_ > 0, mapped_size_, PROT_READ, MAP_SHARED, fd_.fd_num() ),
+    end_( 0 )
+{
+  load_index();
+}
+
+void BlobStore::load_index( void )
+{
+  const Chunk contents = mapped_.initialized()
+                         ? Chunk( mapped_->addr(), mapped_size_ )
+                         : Chunk( nullptr, 0 );
+
+  while ( end_ + RECORD_HEADER_SIZE <= contents.size() ) {
+    const Chunk header = contents( end_, RECORD_HEADER_SIZE );
+    const uint64_t key = header( 0, 8 ).le64();
+    const uint64_t length = header( 8, 8 ).le64();
+
+    if ( length > contents.size() - end_ - RECORD_HEADER_SIZE ) {
+      break;
+    }
+
+    index_.emplace( key, Location { end_ + RECORD_HEADER_SIZE, length } );
+    end_ += RECORD_HEADER_SIZE + length;
+  }
+
+  /* drop a record that was cut short, so new ones follow the last whole one */
+  if ( end_ != contents.size() ) {
+    SystemCall( "ftruncate", ftruncate( fd_.fd_num(), end_ ) );
+    mapped_size_ = end_;
+  }
+}
+
+bool BlobStore::contains( const uint64_t key ) const
+{
+  unique_lock<mutex> lock { mutex_ };
+  return index_.count( key ) > 0;
+}
+
+bool BlobStore::get( const uint64_t key, vector<uint8_t> & value ) const
+{
+  Location location;
+
+  {
+    unique_lock<mutex> lock { mutex_ };
+    const auto it = index_.find( key );
+    if ( it == index_.end() ) {
+      return false;
+    }
+    location = it->second;
+  }
+
+  value.resize( location.length );
+
+  if ( location.offset + location.length <= mapped_size_ ) {
+    memcpy( value.data(), mapped_->addr() + location.offset, location.length );
+    return true;
+  }
+
+  for ( size_t done = 0; done < location.length; ) {
+    const ssize_t bytes_read = SystemCall( "pread", pread( fd_.fd_num(), value.data() + done,
+                                                           location.length - done,
+                                                           location.offset + done ) );
+    if ( bytes_read == 0 ) {
+      throw runtime_error( "BlobStore: record extends past the end of the file" );
+    }
+    done += bytes_read;
+  }
+
+  return true;
+}
+
+void BlobStore::put( const uint64_t key, const Chunk & value )
+{
+  unique_lock<mutex> lock { mutex_ };
+
+  if ( index_.count( key ) ) {
+    return;
+  }
+
+  uint8_t header[ RECORD_HEADER_SIZE ];
+  const uint64_t le_key = htole64( key );
+  const uint64_t le_length = htole64( value.size() );
+  memcpy( header, &le_key, 8 );
+  memcpy( header + 8, &le_length, 8 );
+
+  /* a record is only indexed once it is entirely on disk */
+  for ( const Chunk & piece : { Chunk( header, RECORD_HEADER_SIZE ), value } ) {
+    for ( size_t done = 0; done < piece.size(); ) {
+      done += SystemCall( "pwrite", pwrite( fd_.fd_num(), piece.buffer() + done,
+                                            piece.size() - done, end_ + done ) );
+    }
+    end_ += piece.size();
+  }
+
+  index_.emplace( key, Location { end_ - value.size(), value.size() } );
+}
+
+size_t BlobStore::size( void ) const
+{
+  unique_lock<mutex> lock { mutex_ };
+  return index_.size();
+}
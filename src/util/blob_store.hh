@@ -0,0 +1,58 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef BLOB_STORE_HH
+#define BLOB_STORE_HH
+
+/* an append-only file of ( 64-bit key, blob ) records. What was in the file
+   when it was opened is read through a read-only mapping; records added
+   since are read back with pread(). Safe to share between threads, but
+   only one process should have a given file open at a time. */
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "chunk.hh"
+#include "optional.hh"
+#include "mmap_region.hh"
+#include "file_descriptor.hh"
+
+class BlobStore
+{
+private:
+  struct Location
+  {
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  /* each record is the key and the length (little-endian), then the blob */
+  static constexpr size_t RECORD_HEADER_SIZE = 16;
+
+  FileDescriptor fd_;
+  size_t mapped_size_;
+  Optional<MMap_Region> mapped_;
+
+  mutable std::mutex mutex_ {};
+  std::unordered_map<uint64_t, Location> index_ {};
+  uint64_t end_;
+
+  void load_index( void );
+
+public:
+  BlobStore( const std::string & filename );
+
+  bool contains( const uint64_t key ) const;
+
+  /* copies the blob into `value`; false if there is none */
+  bool get( const uint64_t key, std::vector<uint8_t> & value ) const;
+
+  /* keeps the first blob stored under a key */
+  void put( const uint64_t key, const Chunk & value );
+
+  size_t size( void ) const;
+};
+
+#endif /* BLOB_STORE_HH */
@@ -33,10 +33,22 @@ private:
 
   static uint64_t bit_mask( const uint64_t & n )
   {
-    if ( n > 63 ) {
+    if ( n > 64 ) {
       throw std::out_of_range( "bit mask size is unsupported" );
     }
-    return ( 1 << n ) - 1;
+    return ( n == 64 ) ? ~uint64_t( 0 ) : ( uint64_t( 1 ) << n ) - 1;
+  }
+
+  /* bytes holding bits [bit_offset, bit_offset + bit_length) */
+  uint64_t bit_span( const uint64_t & bit_offset, const uint64_t bit_length ) const
+  {
+    if ( bit_length > 64 ) {
+      throw std::out_of_range( "bit length is unsupported" );
+    }
+
+    const uint64_t byte_len = ( bit_offset % 8 + bit_length + 7 ) / 8;
+    bounds_check( bit_offset / 8 + byte_len );
+    return byte_len;
   }
 
 public:
@@ -96,20 +108,46 @@ public:
     return le64toh( extract_value<uint64_t>() );
   }
 
+  /* up to 64 bits, least significant first (as VP8 codes them) */
   uint64_t bits( const uint64_t & bit_offset, const uint64_t bit_length ) const
   {
-    const uint64_t byte_len = 1 + ( bit_offset + bit_length - 1 ) / 8;
-    bounds_check( byte_len );
+    const uint64_t byte_len = bit_span( bit_offset, bit_length );
+    const uint8_t * first = buffer_ + bit_offset / 8;
+    const uint64_t shift = bit_offset % 8;
+
+    uint64_t val = 0;
+    for ( uint64_t i = 0; i < byte_len and i < sizeof( uint64_t ); i++ ) {
+      val |= uint64_t( first[ i ] ) << ( i * 8 );
+    }
+    val >>= shift;
+
+    /* a ninth byte, when the bits straddle it */
     if ( byte_len > sizeof( uint64_t ) ) {
-      throw std::out_of_range( "bit offset and length not supported" );
+      val |= uint64_t( first[ 8 ] ) << ( 64 - shift );
     }
 
+    return val & bit_mask( bit_length );
+  }
+
+  /* up to 64 bits, most significant first (as H.264 codes them) */
+  uint64_t be_bits( const uint64_t & bit_offset, const uint64_t bit_length ) const
+  {
+    const uint64_t byte_len = bit_span( bit_offset, bit_length );
+    const uint8_t * first = buffer_ + bit_offset / 8;
+    const uint64_t shift = bit_offset % 8;
+
     uint64_t val = 0;
-    for ( uint64_t i = 0; i < byte_len; i++ ) {
-      val |= buffer_[ i ] << ( i * 8 );
+    for ( uint64_t i = 0; i < byte_len and i < sizeof( uint64_t ); i++ ) {
+      val = ( val << 8 ) | first[ i ];
+    }
+
+    if ( byte_len <= sizeof( uint64_t ) ) {
+      return ( val >> ( byte_len * 8 - shift - bit_length ) ) & bit_mask( bit_length );
     }
 
-    return ( val >> bit_offset ) & bit_mask( bit_length );
+    /* the last few bits come from a ninth byte */
+    const uint64_t tail = shift + bit_length - 64;
+    return ( ( val << tail ) | ( first[ 8 ] >> ( 8 - tail ) ) ) & bit_mask( bit_length );
   }
 };
 
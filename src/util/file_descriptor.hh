@@ -106,17 +106,15 @@ public:
     register_write();
   }
 
-  std::string read( const size_t limit )
+  /* reads up to `limit` bytes into `buffer`, without allocating; returns
+     how many (0 at the end of the file) */
+  size_t read( char * buffer, const size_t limit )
   {
-    static const size_t BUFFER_SIZE = 1048576;
-    char buffer[ BUFFER_SIZE ];
-
     if ( eof() ) {
       throw std::runtime_error( "read() called after eof was set" );
     }
 
-    ssize_t bytes_read = SystemCall( "read",
-      ::read( fd_, buffer, std::min( BUFFER_SIZE, limit ) ) );
+    ssize_t bytes_read = SystemCall( "read", ::read( fd_, buffer, limit ) );
 
     if ( bytes_read == 0 ) {
       eof_ = true;
@@ -124,20 +122,32 @@ public:
 
     register_read();
 
-    return std::string( buffer, bytes_read );
+    return bytes_read;
   }
 
-  std::string read_exactly( const size_t length )
+  std::string read( const size_t limit )
   {
-    std::string ret;
-    while ( ret.size() < length ) {
-      ret.append( read( length - ret.size() ) );
+    static const size_t BUFFER_SIZE = 1048576;
+    char buffer[ BUFFER_SIZE ];
+
+    return std::string( buffer, read( buffer, std::min( BUFFER_SIZE, limit ) ) );
+  }
+
+  void read_exactly( char * buffer, const size_t length )
+  {
+    size_t bytes_read = 0;
+    while ( bytes_read < length ) {
+      bytes_read += read( buffer + bytes_read, length - bytes_read );
       if ( eof() ) {
         throw std::runtime_error( "read_exactly: FileDescriptor reached EOF before reaching target" );
       }
     }
+  }
 
-    assert( ret.size() == length );
+  std::string read_exactly( const size_t length )
+  {
+    std::string ret( length, 0 );
+    read_exactly( &ret[ 0 ], length );
     return ret;
   }
 };
@@ -0,0 +1,276 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cstring>
+#include <endian.h>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#include "hash.hh"
+
+using namespace std;
+
+namespace {
+
+constexpr uint64_t PRIME1 = 11400714785074694791ULL;
+constexpr uint64_t PRIME2 = 14029467366897019727ULL;
+constexpr uint64_t PRIME3 = 1609587929392839161ULL;
+constexpr uint64_t PRIME4 = 9650029242287828579ULL;
+constexpr uint64_t PRIME5 = 2870177450012600261ULL;
+
+inline uint64_t rotl( const uint64_t x, const int r )
+{
+  return ( x << r ) | ( x >> ( 64 - r ) );
+}
+
+/* unaligned little-endian loads; memcpy compiles to a plain load */
+inline uint64_t read64( const uint8_t * p )
+{
+  uint64_t v;
+  memcpy( &v, p, sizeof( v ) );
+  return le64toh( v );
+}
+
+inline uint32_t read32( const uint8_t * p )
+{
+  uint32_t v;
+  memcpy( &v, p, sizeof( v ) );
+  return le32toh( v );
+}
+
+inline uint64_t round( uint64_t acc, const uint64_t input )
+{
+  acc += input * PRIME2;
+  acc = rotl( acc, 31 );
+  return acc * PRIME1;
+}
+
+inline uint64_t merge_round( uint64_t acc, const uint64_t value )
+{
+  acc ^= round( 0, value );
+  return acc * PRIME1 + PRIME4;
+}
+
+/* bulk_hash64() consumes 64-byte stripes into eight 64-bit lanes, and
+   scrambles the lanes after every block of stripes. Each stripe of a block
+   is keyed one word further into the key. */
+constexpr size_t LANES = 8;
+constexpr size_t STRIPE_SIZE = LANES * 8;
+constexpr size_t STRIPES_PER_BLOCK = 16;
+constexpr size_t KEY_WORDS = STRIPES_PER_BLOCK + LANES;
+
+constexpr uint64_t SCRAMBLE_PRIME = 2654435761U;
+
+struct BulkKey
+{
+  uint64_t words[ KEY_WORDS ];
+
+  BulkKey()
+    : words()
+  {
+    /* splitmix64 */
+    uint64_t state = PRIME1;
+    for ( uint64_t & word : words ) {
+      state += 0x9E3779B97F4A7C15ULL;
+      uint64_t z = state;
+      z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+      z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+      word = z ^ ( z >> 31 );
+    }
+  }
+};
+
+const BulkKey bulk_key;
+
+#if defined( __SSE2__ )
+
+/* two lanes: each adds its neighbour's input, and the product of the low
+   and high halves of its own keyed input */
+inline __m128i accumulate( const __m128i acc, const uint8_t * p, const uint64_t * key )
+{
+  const __m128i data = _mm_loadu_si128( reinterpret_cast<const __m128i *>( p ) );
+  const __m128i keyed = _mm_xor_si128( data, _mm_loadu_si128( reinterpret_cast<const __m128i *>( key ) ) );
+  const __m128i product = _mm_mul_epu32( keyed, _mm_shuffle_epi32( keyed, _MM_SHUFFLE( 0, 3, 0, 1 ) ) );
+  const __m128i swapped = _mm_shuffle_epi32( data, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+  return _mm_add_epi64( acc, _mm_add_epi64( product, swapped ) );
+}
+
+inline __m128i scramble_lanes( const __m128i lanes, const uint64_t * key )
+{
+  const __m128i prime = _mm_set1_epi32( int( SCRAMBLE_PRIME ) );
+
+  __m128i acc = _mm_xor_si128( lanes, _mm_srli_epi64( lanes, 47 ) );
+  acc = _mm_xor_si128( acc, _mm_loadu_si128( reinterpret_cast<const __m128i *>( key ) ) );
+
+  const __m128i low = _mm_mul_epu32( acc, prime );
+  const __m128i high = _mm_mul_epu32( _mm_srli_epi64( acc, 32 ), prime );
+  return _mm_add_epi64( low, _mm_slli_epi64( high, 32 ) );
+}
+
+/* spelled out four times so that the lanes stay in registers */
+struct Accumulators
+{
+  __m128i a, b, c, d;
+
+  explicit Accumulators( const uint64_t init[ LANES ] )
+    : a( _mm_loadu_si128( reinterpret_cast<const __m128i *>( init ) ) ),
+      b( _mm_loadu_si128( reinterpret_cast<const __m128i *>( init + 2 ) ) ),
+      c( _mm_loadu_si128( reinterpret_cast<const __m128i *>( init + 4 ) ) ),
+      d( _mm_loadu_si128( reinterpret_cast<const __m128i *>( init + 6 ) ) )
+  {}
+
+  void stripe( const uint8_t * p, const uint64_t * key )
+  {
+    a = accumulate( a, p, key );
+    b = accumulate( b, p + 16, key + 2 );
+    c = accumulate( c, p + 32, key + 4 );
+    d = accumulate( d, p + 48, key + 6 );
+  }
+
+  void scramble( const uint64_t * key )
+  {
+    a = scramble_lanes( a, key );
+    b = scramble_lanes( b, key + 2 );
+    c = scramble_lanes( c, key + 4 );
+    d = scramble_lanes( d, key + 6 );
+  }
+
+  void store( uint64_t out[ LANES ] ) const
+  {
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( out ), a );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( out + 2 ), b );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( out + 4 ), c );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( out + 6 ), d );
+  }
+};
+
+#else
+
+struct Accumulators
+{
+  uint64_t lanes[ LANES ];
+
+  explicit Accumulators( const uint64_t init[ LANES ] )
+    : lanes()
+  {
+    memcpy( lanes, init, sizeof( lanes ) );
+  }
+
+  void stripe( const uint8_t * p, const uint64_t * key )
+  {
+    for ( size_t i = 0; i < LANES; i++ ) {
+      const uint64_t data = read64( p + 8 * i );
+      const uint64_t keyed = data ^ key[ i ];
+      lanes[ i ^ 1 ] += data;
+      lanes[ i ] += ( keyed & 0xFFFFFFFF ) * ( keyed >> 32 );
+    }
+  }
+
+  void scramble( const uint64_t * key )
+  {
+    for ( size_t i = 0; i < LANES; i++ ) {
+      lanes[ i ] = ( lanes[ i ] ^ ( lanes[ i ] >> 47 ) ^ key[ i ] ) * SCRAMBLE_PRIME;
+    }
+  }
+
+  void store( uint64_t out[ LANES ] ) const
+  {
+    memcpy( out, lanes, sizeof( lanes ) );
+  }
+};
+
+#endif
+
+}
+
+uint64_t hash64( const uint8_t * data, const size_t length, const uint64_t seed )
+{
+  const uint8_t * p = data;
+  const uint8_t * const end = data + length;
+  uint64_t h;
+
+  if ( length >= 32 ) {
+    /* four independent lanes over 32-byte stripes */
+    uint64_t v1 = seed + PRIME1 + PRIME2;
+    uint64_t v2 = seed + PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME1;
+
+    for ( ; p + 32 <= end; p += 32 ) {
+      v1 = round( v1, read64( p ) );
+      v2 = round( v2, read64( p + 8 ) );
+      v3 = round( v3, read64( p + 16 ) );
+      v4 = round( v4, read64( p + 24 ) );
+    }
+
+    h = rotl( v1, 1 ) + rotl( v2, 7 ) + rotl( v3, 12 ) + rotl( v4, 18 );
+    h = merge_round( h, v1 );
+    h = merge_round( h, v2 );
+    h = merge_round( h, v3 );
+    h = merge_round( h, v4 );
+  }
+  else {
+    h = seed + PRIME5;
+  }
+
+  h += length;
+
+  for ( ; p + 8 <= end; p += 8 ) {
+    h ^= round( 0, read64( p ) );
+    h = rotl( h, 27 ) * PRIME1 + PRIME4;
+  }
+
+  if ( p + 4 <= end ) {
+    h ^= uint64_t( read32( p ) ) * PRIME1;
+    h = rotl( h, 23 ) * PRIME2 + PRIME3;
+    p += 4;
+  }
+
+  for ( ; p < end; p++ ) {
+    h ^= *p * PRIME5;
+    h = rotl( h, 11 ) * PRIME1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+uint64_t bulk_hash64( const uint8_t * data, const size_t length )
+{
+  const uint64_t init[ LANES ] = { PRIME3, PRIME1, PRIME2, PRIME4, PRIME5, PRIME2, PRIME1, PRIME3 };
+  const uint64_t * const key = bulk_key.words;
+
+  Accumulators acc { init };
+
+  const uint8_t * p = data;
+  const uint8_t * const end = data + length;
+  constexpr size_t BLOCK_SIZE = STRIPES_PER_BLOCK * STRIPE_SIZE;
+
+  for ( ; p + BLOCK_SIZE <= end; p += BLOCK_SIZE ) {
+    for ( size_t stripe = 0; stripe < STRIPES_PER_BLOCK; stripe++ ) {
+      acc.stripe( p + stripe * STRIPE_SIZE, key + stripe );
+    }
+    acc.scramble( key + STRIPES_PER_BLOCK );
+  }
+
+  for ( size_t stripe = 0; p + STRIPE_SIZE <= end; stripe++, p += STRIPE_SIZE ) {
+    acc.stripe( p, key + stripe );
+  }
+
+  uint64_t lanes[ LANES ];
+  acc.store( lanes );
+
+  uint64_t h = length * PRIME1;
+  for ( size_t i = 0; i < LANES; i++ ) {
+    h = merge_round( h, lanes[ i ] ^ key[ i ] );
+  }
+
+  /* the bytes after the last whole stripe */
+  return hash64( p, end - p, h );
+}
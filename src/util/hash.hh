@@ -0,0 +1,31 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef HASH_HH
+#define HASH_HH
+
+/* fast non-cryptographic 64-bit hashing (the xxHash64 algorithm), for
+   content-addressing data that only we produce */
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+uint64_t hash64( const uint8_t * data, const size_t length, const uint64_t seed = 0 );
+
+inline uint64_t hash64( const std::string & data, const uint64_t seed = 0 )
+{
+  return hash64( reinterpret_cast<const uint8_t *>( data.data() ), data.size(), seed );
+}
+
+/* for large buffers such as rasters: an XXH3-style stripe loop, faster
+   than hash64() with SSE2 and giving the same result with or without it.
+   Not compatible with any published hash. */
+uint64_t bulk_hash64( const uint8_t * data, const size_t length );
+
+/* folds `value` into the running hash `h` */
+inline uint64_t hash_combine( const uint64_t h, const uint64_t value )
+{
+  return hash64( reinterpret_cast<const uint8_t *>( &value ), sizeof( value ), h );
+}
+
+#endif /* HASH_HH */
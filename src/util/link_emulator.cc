@@ -0,0 +1,73 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "link_emulator.hh"
+
+using namespace std;
+
+LinkEmulator::LinkEmulator( const string & trace_filename, const uint64_t delay_ms )
+  : opportunities_(), period_( 0 ), delay_( delay_ms )
+{
+  ifstream trace { trace_filename };
+  if ( not trace.is_open() ) {
+    throw runtime_error( "could not open link trace: " + trace_filename );
+  }
+
+  uint64_t timestamp;
+  while ( trace >> timestamp ) {
+    if ( not opportunities_.empty() and timestamp < opportunities_.back() ) {
+      throw runtime_error( "link trace timestamps must be non-decreasing" );
+    }
+    opportunities_.push_back( timestamp );
+  }
+
+  if ( opportunities_.empty() ) {
+    throw runtime_error( "link trace is empty: " + trace_filename );
+  }
+
+  period_ = opportunities_.back();
+  if ( period_ == 0 ) {
+    throw runtime_error( "link trace must span at least one millisecond" );
+  }
+}
+
+uint64_t LinkEmulator::opportunity_time( const uint64_t index ) const
+{
+  return ( index / opportunities_.size() ) * period_
+         + opportunities_[ index % opportunities_.size() ];
+}
+
+uint64_t LinkEmulator::first_opportunity_at( const uint64_t time ) const
+{
+  const uint64_t loop = time / period_;
+  const auto it = lower_bound( opportunities_.begin(), opportunities_.end(),
+                               time - loop * period_ );
+
+  const uint64_t index = loop * opportunities_.size()
+                         + ( it - opportunities_.begin() );
+
+  return max( index, next_opportunity_ );
+}
+
+size_t LinkEmulator::budget( const uint64_t now, const uint64_t deadline ) const
+{
+  size_t packets = 0;
+
+  for ( uint64_t i = first_opportunity_at( now ); opportunity_time( i ) < deadline; i++ ) {
+    packets++;
+  }
+
+  return packets * PACKET_SIZE;
+}
+
+uint64_t LinkEmulator::send( const uint64_t now, const size_t length )
+{
+  const uint64_t packets = max<uint64_t>( 1, ( length + PACKET_SIZE - 1 ) / PACKET_SIZE );
+  const uint64_t first = first_opportunity_at( now );
+
+  next_opportunity_ = first + packets;
+  return opportunity_time( next_opportunity_ - 1 ) + delay_;
+}
@@ -0,0 +1,43 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef LINK_EMULATOR_HH
+#define LINK_EMULATOR_HH
+
+/* trace-driven emulation of a bottleneck link, in the style of mahimahi:
+   every line of the trace is a millisecond timestamp at which the link
+   can deliver one MTU-sized packet, and the trace repeats with a period
+   equal to its last timestamp. */
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class LinkEmulator
+{
+public:
+  static constexpr size_t PACKET_SIZE = 1500;
+
+private:
+  std::vector<uint64_t> opportunities_;
+  uint64_t period_;
+  uint64_t delay_;
+
+  /* absolute index of the first delivery opportunity not yet used */
+  uint64_t next_opportunity_ { 0 };
+
+  uint64_t opportunity_time( const uint64_t index ) const;
+  uint64_t first_opportunity_at( const uint64_t time ) const;
+
+public:
+  LinkEmulator( const std::string & trace_filename, const uint64_t delay_ms );
+
+  /* bytes the link can deliver in [now, deadline), behind whatever is queued */
+  size_t budget( const uint64_t now, const uint64_t deadline ) const;
+
+  /* enqueue a frame at `now`; returns the time its last byte reaches the receiver */
+  uint64_t send( const uint64_t now, const size_t length );
+
+  uint64_t delay( void ) const { return delay_; }
+};
+
+#endif /* LINK_EMULATOR_HH */
@@ -0,0 +1,234 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <new>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdexcept>
+#include <type_traits>
+
+#include "live_metrics.hh"
+#include "exception.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+static_assert( is_standard_layout<LiveMetricsBlock>::value,
+               "LiveMetricsBlock has to be laid out the same in every process" );
+static_assert( ATOMIC_LLONG_LOCK_FREE == 2 and ATOMIC_INT_LOCK_FREE == 2,
+               "atomics in shared memory have to be lock-free" );
+
+namespace {
+
+/* shm_open() names start with a slash */
+string shared_name( const string & name )
+{
+  return name.empty() or name[ 0 ] != '/' ? "/" + name : name;
+}
+
+size_t block_size( const FileDescriptor & fd, const string & name )
+{
+  if ( fd.size() < sizeof( LiveMetricsBlock ) ) {
+    throw runtime_error( name + ": not a metrics block" );
+  }
+
+  return sizeof( LiveMetricsBlock );
+}
+
+/* a complete block whose writer finished, or died without removing it */
+bool abandoned( const string & name )
+{
+  const int fd = shm_open( name.c_str(), O_RDONLY, 0 );
+  if ( fd < 0 ) {
+    return false;
+  }
+
+  FileDescriptor block_fd { fd };
+  if ( block_fd.size() < sizeof( LiveMetricsBlock ) ) {
+    return false;
+  }
+
+  MMap_Region region { sizeof( LiveMetricsBlock ), PROT_READ, MAP_SHARED, block_fd.fd_num() };
+  const LiveMetricsBlock & block = *reinterpret_cast<const LiveMetricsBlock *>( region.addr() );
+
+  if ( block.magic.load( memory_order_acquire ) != LiveMetricsBlock::MAGIC ) {
+    return false;
+  }
+
+  return block.finished.load( memory_order_acquire )
+         or ( kill( block.pid, 0 ) < 0 and errno == ESRCH );
+}
+
+/* a new block, sized to fit; never one that another process may be writing.
+   Everything that can be checked beforehand is, so that a block is only
+   left behind when the program dies. */
+int create_block( const string & name, const size_t stages, const size_t gauges )
+{
+  if ( stages > LiveMetricsBlock::MAX_STAGES or gauges > LiveMetricsBlock::MAX_GAUGES ) {
+    throw runtime_error( "LiveMetrics: too many stages or gauges" );
+  }
+
+  int fd = shm_open( name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644 );
+
+  if ( fd < 0 and errno == EEXIST and abandoned( name ) ) {
+    shm_unlink( name.c_str() );
+    fd = shm_open( name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644 );
+  }
+
+  if ( fd < 0 and errno == EEXIST ) {
+    throw runtime_error( "metrics block " + name + " already exists: another program is using"
+                         " the name (or left /dev/shm" + name + " behind before it was"
+                         " filled in; remove it to reuse the name)" );
+  }
+
+  SystemCall( "shm_open " + name, fd );
+
+  if ( ftruncate( fd, sizeof( LiveMetricsBlock ) ) < 0 ) {
+    const int error = errno;
+    close( fd );
+    shm_unlink( name.c_str() );
+    throw unix_error( "ftruncate", error );
+  }
+
+  return fd;
+}
+
+void copy_name( char ( & dest )[ LiveMetricsBlock::NAME_LENGTH ], const string & name )
+{
+  strncpy( dest, name.c_str(), LiveMetricsBlock::NAME_LENGTH - 1 );
+}
+
+/* there is only one writer, so there is nothing to race with */
+void bump( LiveMetricsBlock::Counter & counter, const uint64_t amount )
+{
+  counter.store( counter.load( memory_order_relaxed ) + amount, memory_order_relaxed );
+}
+
+void raise_max( LiveMetricsBlock::Counter & counter, const uint64_t value )
+{
+  if ( value > counter.load( memory_order_relaxed ) ) {
+    counter.store( value, memory_order_relaxed );
+  }
+}
+
+}
+
+uint64_t LiveMetricsBlock::now( void )
+{
+  return duration_cast<nanoseconds>( steady_clock::now().time_since_epoch() ).count();
+}
+
+LiveMetrics::LiveMetrics( const string & name, const string & program,
+                          const vector<string> & stages,
+                          const vector<string> & gauges )
+  : name_( shared_name( name ) ),
+    fd_( create_block( name_, stages.size(), gauges.size() ) ),
+    unlinker_( { name_ } ),
+    region_( sizeof( LiveMetricsBlock ), PROT_READ | PROT_WRITE, MAP_SHARED, fd_.fd_num() ),
+    block_( *new ( region_.addr() ) LiveMetricsBlock() ),
+    last_( Clock::now() )
+{
+  block_.version = LiveMetricsBlock::VERSION;
+  block_.pid = getpid();
+  copy_name( block_.program, program );
+  block_.started_ns = LiveMetricsBlock::now();
+  block_.updated_ns.store( block_.started_ns, memory_order_relaxed );
+
+  block_.stage_count = stages.size();
+  for ( size_t i = 0; i < stages.size(); i++ ) {
+    copy_name( block_.stages[ i ].name, stages[ i ] );
+  }
+
+  block_.gauge_count = gauges.size();
+  for ( size_t i = 0; i < gauges.size(); i++ ) {
+    copy_name( block_.gauges[ i ].name, gauges[ i ] );
+  }
+
+  block_.magic.store( LiveMetricsBlock::MAGIC, memory_order_release );
+}
+
+LiveMetrics::~LiveMetrics()
+{
+  /* unlinker_ removes it next */
+  block_.finished.store( 1, memory_order_release );
+}
+
+/* readers keep their mappings; new ones will not find it */
+LiveMetrics::Unlinker::~Unlinker()
+{
+  shm_unlink( name.c_str() );
+}
+
+void LiveMetrics::mark( const size_t stage )
+{
+  const Clock::time_point now = Clock::now();
+  const uint64_t ns = duration_cast<nanoseconds>( now - last_ ).count();
+  LiveMetricsBlock::Stage & s = block_.stages[ stage ];
+
+  bump( s.count, 1 );
+  bump( s.total_ns, ns );
+  raise_max( s.max_ns, ns );
+
+  last_ = now;
+}
+
+void LiveMetrics::end_iteration( void )
+{
+  bump( block_.frames, 1 );
+  block_.updated_ns.store( LiveMetricsBlock::now(), memory_order_relaxed );
+}
+
+void LiveMetrics::add_frame( const uint64_t quantizer, const uint64_t bytes )
+{
+  if ( last_quantizer_ != 0 and quantizer != last_quantizer_ ) {
+    bump( block_.switches, 1 );
+  }
+
+  last_quantizer_ = quantizer;
+
+  for ( auto & quality : block_.qualities ) {
+    const uint64_t q = quality.quantizer.load( memory_order_relaxed );
+
+    if ( q == 0 ) {
+      quality.quantizer.store( quantizer, memory_order_relaxed );
+    }
+    else if ( q != quantizer ) {
+      continue;
+    }
+
+    bump( quality.frames, 1 );
+    bump( quality.bytes, bytes );
+    return;
+  }
+}
+
+void LiveMetrics::add_skipped( void )
+{
+  bump( block_.skipped, 1 );
+}
+
+void LiveMetrics::set_gauge( const size_t gauge, const int64_t value )
+{
+  LiveMetricsBlock::Gauge & g = block_.gauges[ gauge ];
+
+  g.value.store( value, memory_order_relaxed );
+
+  if ( value > g.max.load( memory_order_relaxed ) ) {
+    g.max.store( value, memory_order_relaxed );
+  }
+}
+
+LiveMetricsView::LiveMetricsView( const string & name )
+  : fd_( SystemCall( "shm_open " + name,
+                     shm_open( shared_name( name ).c_str(), O_RDONLY, 0 ) ) ),
+    region_( block_size( fd_, name ), PROT_READ, MAP_SHARED, fd_.fd_num() ),
+    block_( *reinterpret_cast<const LiveMetricsBlock *>( region_.addr() ) )
+{
+  if ( block_.magic.load( memory_order_acquire ) != LiveMetricsBlock::MAGIC
+       or block_.version != LiveMetricsBlock::VERSION ) {
+    throw runtime_error( name + ": not a metrics block (or not one of this version)" );
+  }
+}
@@ -0,0 +1,156 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef LIVE_METRICS_HH
+#define LIVE_METRICS_HH
+
+/* Counters of a long-running program, in a named shared-memory block
+   (shm_open(3), so /dev/shm/<name> on Linux) that smetrics shows while the
+   program runs. The block has a fixed layout and a single writer, which
+   updates it with relaxed atomic stores: nothing is logged or sent, and a
+   reader can see one counter a frame ahead of another, but never a torn
+   value. */
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "file_descriptor.hh"
+#include "mmap_region.hh"
+
+struct LiveMetricsBlock
+{
+  static constexpr uint64_t MAGIC = 0x5341534c4d455452; /* "SASLMETR" */
+  static constexpr uint32_t VERSION = 1;
+
+  static constexpr size_t NAME_LENGTH = 24;
+  static constexpr size_t MAX_QUALITIES = 4;
+  static constexpr size_t MAX_STAGES = 8;
+  static constexpr size_t MAX_GAUGES = 4;
+
+  typedef std::atomic<uint64_t> Counter;
+
+  /* the frames coded at one quantizer */
+  struct Quality
+  {
+    Counter quantizer;
+    Counter frames;
+    Counter bytes;
+  };
+
+  struct Stage
+  {
+    char name[ NAME_LENGTH ];
+    Counter count;
+    Counter total_ns;
+    Counter max_ns;
+  };
+
+  /* a level, like the depth of a queue */
+  struct Gauge
+  {
+    char name[ NAME_LENGTH ];
+    std::atomic<int64_t> value;
+    std::atomic<int64_t> max;
+  };
+
+  /* set last, once everything above the counters is filled in */
+  std::atomic<uint64_t> magic;
+  uint32_t version;
+  uint32_t pid;
+  char program[ NAME_LENGTH ];
+
+  /* on the monotonic clock, which every process shares */
+  uint64_t started_ns;
+  Counter updated_ns;
+  std::atomic<uint32_t> finished;
+
+  uint32_t stage_count;
+  uint32_t gauge_count;
+
+  /* every frame, and those that did not bring a new picture (repeated,
+     dropped or not shown) */
+  Counter frames;
+  Counter skipped;
+
+  /* frames coded at another quantizer than the frame before */
+  Counter switches;
+
+  Quality qualities[ MAX_QUALITIES ];
+  Stage stages[ MAX_STAGES ];
+  Gauge gauges[ MAX_GAUGES ];
+
+  /* the monotonic clock, in nanoseconds */
+  static uint64_t now( void );
+};
+
+/* the writer: creates the block, and removes it again when destroyed
+   (readers that have it mapped keep seeing the final values); fails if a
+   block of that name exists already, unless the program that wrote it is
+   gone */
+class LiveMetrics
+{
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  /* removes the block's name, also when the constructor fails after it
+     was created */
+  struct Unlinker
+  {
+    const std::string name;
+    ~Unlinker();
+  };
+
+  const std::string name_;
+  FileDescriptor fd_;
+  Unlinker unlinker_;
+  MMap_Region region_;
+  LiveMetricsBlock & block_;
+
+  Clock::time_point last_;
+  uint64_t last_quantizer_ { 0 };
+
+public:
+  /* `stages` are named as in AllocationProfile, and the gauges are all 0 at first */
+  LiveMetrics( const std::string & name, const std::string & program,
+               const std::vector<std::string> & stages,
+               const std::vector<std::string> & gauges );
+  ~LiveMetrics();
+
+  /* ban copying */
+  LiveMetrics( const LiveMetrics & other ) = delete;
+  LiveMetrics & operator=( const LiveMetrics & other ) = delete;
+
+  /* the time before here belongs to no stage */
+  void restart( void ) { last_ = Clock::now(); }
+
+  /* the end of a stage, as with AllocationProfile */
+  void mark( const size_t stage );
+
+  /* a frame is done */
+  void end_iteration( void );
+
+  /* the current frame was coded at `quantizer` (quantizers past
+     MAX_QUALITIES distinct ones are not broken down) */
+  void add_frame( const uint64_t quantizer, const uint64_t bytes );
+  void add_skipped( void );
+
+  void set_gauge( const size_t gauge, const int64_t value );
+};
+
+/* a reader's view of a block that another process writes */
+class LiveMetricsView
+{
+private:
+  FileDescriptor fd_;
+  MMap_Region region_;
+  const LiveMetricsBlock & block_;
+
+public:
+  explicit LiveMetricsView( const std::string & name );
+
+  const LiveMetricsBlock & block( void ) const { return block_; }
+};
+
+#endif /* LIVE_METRICS_HH */
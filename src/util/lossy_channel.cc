@@ -0,0 +1,50 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <stdexcept>
+
+#include "lossy_channel.hh"
+
+using namespace std;
+
+namespace {
+
+/* checked before the distribution sees it, which requires [0, 1] */
+double checked_loss_rate( const double loss_rate )
+{
+  if ( not ( loss_rate >= 0 and loss_rate < 1 ) ) {
+    throw runtime_error( "loss rate must be in [0, 1)" );
+  }
+
+  return loss_rate;
+}
+
+}
+
+LossyChannel::LossyChannel( const uint64_t delay, const double loss_rate, const uint32_t seed )
+  : delay_( delay ), loss_( checked_loss_rate( loss_rate ) ), prng_( seed )
+{}
+
+bool LossyChannel::send( const uint64_t now, string && payload )
+{
+  sent_++;
+
+  if ( loss_( prng_ ) ) {
+    dropped_++;
+    return false;
+  }
+
+  in_flight_.push_back( { now + delay_, move( payload ) } );
+  return true;
+}
+
+vector<string> LossyChannel::receive( const uint64_t now )
+{
+  vector<string> delivered;
+
+  while ( not in_flight_.empty() and in_flight_.front().delivery_time <= now ) {
+    delivered.push_back( move( in_flight_.front().payload ) );
+    in_flight_.pop_front();
+  }
+
+  return delivered;
+}
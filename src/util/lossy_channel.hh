@@ -0,0 +1,46 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef LOSSY_CHANNEL_HH
+#define LOSSY_CHANNEL_HH
+
+/* in-process datagram channel with a fixed delay and random loss,
+   for exercising feedback and recovery without a network */
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+
+class LossyChannel
+{
+private:
+  struct Datagram
+  {
+    uint64_t delivery_time;
+    std::string payload;
+  };
+
+  uint64_t delay_;
+  std::bernoulli_distribution loss_;
+  std::mt19937 prng_;
+
+  std::deque<Datagram> in_flight_ {};
+
+  uint64_t sent_ { 0 };
+  uint64_t dropped_ { 0 };
+
+public:
+  LossyChannel( const uint64_t delay, const double loss_rate, const uint32_t seed );
+
+  /* returns false if the datagram was dropped */
+  bool send( const uint64_t now, std::string && payload );
+
+  /* everything due for delivery at or before `now`, in order */
+  std::vector<std::string> receive( const uint64_t now );
+
+  uint64_t sent( void ) const { return sent_; }
+  uint64_t dropped( void ) const { return dropped_; }
+};
+
+#endif /* LOSSY_CHANNEL_HH */
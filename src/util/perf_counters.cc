@@ -0,0 +1,200 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf_counters.hh"
+#include "exception.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+/* -1 (with errno set) if the event cannot be counted here */
+int open_counter( const uint64_t config )
+{
+  perf_event_attr attr;
+  memset( &attr, 0, sizeof( attr ) );
+  attr.size = sizeof( attr );
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+
+  /* what a perf_event_paranoid of 2 still allows */
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  /* and the threads this one starts from now on */
+  attr.inherit = 1;
+
+  return syscall( __NR_perf_event_open, &attr, 0 /* this thread */, -1 /* any CPU */,
+                  -1 /* no group */, PERF_FLAG_FD_CLOEXEC );
+}
+
+/* the threads of this process (0 if that cannot be told) */
+size_t thread_count( void )
+{
+  DIR * const tasks = opendir( "/proc/self/task" );
+  if ( not tasks ) {
+    return 0;
+  }
+
+  /* one entry per thread, besides . and .. */
+  size_t count = 0;
+  while ( const dirent * entry = readdir( tasks ) ) {
+    if ( entry->d_name[ 0 ] != '.' ) {
+      count++;
+    }
+  }
+
+  closedir( tasks );
+  return count;
+}
+
+}
+
+const char * PerfCounters::name( const Event event )
+{
+  switch ( event ) {
+  case CYCLES: return "cycles";
+  case INSTRUCTIONS: return "instructions";
+  case LLC_MISSES: return "LLC misses";
+  case BRANCH_MISSES: return "branch misses";
+  case EVENT_COUNT: break;
+  }
+
+  throw runtime_error( "invalid performance counter" );
+}
+
+PerfCounters::PerfCounters()
+  : uncounted_threads_( max( thread_count(), size_t( 1 ) ) - 1 )
+{
+  /* generic events, which the kernel maps to the PMU's own (for
+     PERF_COUNT_HW_CACHE_MISSES, the last-level cache's misses) */
+  const uint64_t configs[ EVENT_COUNT ] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+  for ( size_t i = 0; i < EVENT_COUNT; i++ ) {
+    const int fd = open_counter( configs[ i ] );
+
+    if ( fd >= 0 ) {
+      counters_[ i ].reset( new FileDescriptor( fd ) );
+    }
+    else if ( unavailable_reason_.empty() ) {
+      unavailable_reason_ = unix_error( "perf_event_open" ).what();
+    }
+  }
+}
+
+bool PerfCounters::any_available( void ) const
+{
+  for ( const auto & counter : counters_ ) {
+    if ( counter ) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+PerfCounters::Values PerfCounters::read( void ) const
+{
+  Values values {};
+
+  for ( size_t i = 0; i < EVENT_COUNT; i++ ) {
+    if ( counters_[ i ] ) {
+      counters_[ i ]->read( reinterpret_cast<char *>( &values[ i ] ), sizeof( values[ i ] ) );
+    }
+  }
+
+  return values;
+}
+
+PerfProfile::PerfProfile( const vector<string> & stages )
+  : stages_( stages ), totals_( stages.size() ),
+    last_time_( Clock::now() ), last_counters_( counters_.read() )
+{}
+
+void PerfProfile::restart( void )
+{
+  last_counters_ = counters_.read();
+  last_time_ = Clock::now();
+}
+
+void PerfProfile::mark( const size_t stage )
+{
+  const Clock::time_point now = Clock::now();
+  const PerfCounters::Values counters = counters_.read();
+  Totals & totals = totals_.at( stage );
+
+  totals.ms += duration<double, milli>( now - last_time_ ).count();
+
+  for ( size_t i = 0; i < PerfCounters::EVENT_COUNT; i++ ) {
+    totals.counters[ i ] += counters[ i ] - last_counters_[ i ];
+  }
+
+  last_time_ = now;
+  last_counters_ = counters;
+}
+
+void PerfProfile::print( ostream & out, const string & iteration_name ) const
+{
+  if ( iterations_ == 0 ) {
+    return;
+  }
+
+  out << "per " << iteration_name << ":" << setw( 14 - iteration_name.size() ) << "ms";
+
+  for ( size_t i = 0; i < PerfCounters::EVENT_COUNT; i++ ) {
+    out << setw( 15 ) << PerfCounters::name( PerfCounters::Event( i ) );
+  }
+
+  out << setw( 8 ) << "IPC" << endl;
+
+  for ( size_t stage = 0; stage < stages_.size(); stage++ ) {
+    const Totals & totals = totals_[ stage ];
+
+    out << left << setw( 10 ) << stages_[ stage ] << right
+        << setw( 8 ) << fixed << setprecision( 3 ) << totals.ms / iterations_;
+
+    for ( size_t i = 0; i < PerfCounters::EVENT_COUNT; i++ ) {
+      if ( counters_.available( PerfCounters::Event( i ) ) ) {
+        out << setw( 15 ) << setprecision( 0 ) << double( totals.counters[ i ] ) / iterations_;
+      }
+      else {
+        out << setw( 15 ) << "-";
+      }
+    }
+
+    const uint64_t cycles = totals.counters[ PerfCounters::CYCLES ];
+    if ( cycles ) {
+      out << setw( 8 ) << setprecision( 2 )
+          << double( totals.counters[ PerfCounters::INSTRUCTIONS ] ) / cycles;
+    }
+    else {
+      out << setw( 8 ) << "-";
+    }
+
+    out << endl;
+  }
+
+  out << defaultfloat << setprecision( 6 );
+
+  if ( not counters_.any_available() ) {
+    out << "(no hardware counters: " << counters_.unavailable_reason() << ")" << endl;
+  }
+  else {
+    out << "(counters cover the profiling thread and the threads it started afterwards";
+
+    if ( counters_.uncounted_threads() ) {
+      out << "; " << counters_.uncounted_threads() << " thread(s) already running are missing";
+    }
+
+    out << ")" << endl;
+  }
+}
@@ -0,0 +1,94 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef PERF_COUNTERS_HH
+#define PERF_COUNTERS_HH
+
+/* Hardware performance counters of the calling thread, and of every
+   thread it starts after they are opened (the encoders', the thread
+   pool's, the receiver's speculation), through perf_event_open(2), in user
+   space only. Threads that were already running are not counted, so open
+   the counters before starting any. A counter the kernel or the container
+   does not allow (no PMU in a VM, a strict perf_event_paranoid, a seccomp
+   filter) is left out and reads as zero, so callers never have to care
+   whether counting works. */
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <ostream>
+
+#include "file_descriptor.hh"
+
+class PerfCounters
+{
+public:
+  enum Event { CYCLES, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, EVENT_COUNT };
+
+  typedef std::array<uint64_t, EVENT_COUNT> Values;
+
+  static const char * name( const Event event );
+
+private:
+  /* null where the counter could not be opened */
+  std::array<std::unique_ptr<FileDescriptor>, EVENT_COUNT> counters_ {};
+
+  /* why the first counter that failed did */
+  std::string unavailable_reason_ {};
+
+  /* the other threads that were running when the counters were opened */
+  size_t uncounted_threads_ { 0 };
+
+public:
+  PerfCounters();
+
+  bool available( const Event event ) const { return counters_[ event ] != nullptr; }
+  bool any_available( void ) const;
+  const std::string & unavailable_reason( void ) const { return unavailable_reason_; }
+  size_t uncounted_threads( void ) const { return uncounted_threads_; }
+
+  /* the counts since the counters were opened */
+  Values read( void ) const;
+};
+
+/* wall time and counters spent in each stage of a loop, per iteration:
+   mark() the end of every stage, in any order, and end_iteration() once
+   per pass (like AllocationProfile in alloc_counter.hh). A stage's counts
+   include whatever the other counted threads did while it ran. */
+class PerfProfile
+{
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Totals
+  {
+    double ms { 0 };
+    PerfCounters::Values counters {};
+  };
+
+  std::vector<std::string> stages_;
+  std::vector<Totals> totals_;
+  PerfCounters counters_ {};
+
+  Clock::time_point last_time_;
+  PerfCounters::Values last_counters_;
+  size_t iterations_ { 0 };
+
+public:
+  explicit PerfProfile( const std::vector<std::string> & stages );
+
+  /* what happened before here belongs to no stage */
+  void restart( void );
+
+  void mark( const size_t stage );
+  void end_iteration( void ) { iterations_++; }
+
+  size_t iterations( void ) const { return iterations_; }
+
+  /* a table with a row per stage */
+  void print( std::ostream & out, const std::string & iteration_name ) const;
+};
+
+#endif /* PERF_COUNTERS_HH */
@@ -0,0 +1,127 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <exception>
+
+#include "thread_pool.hh"
+
+using namespace std;
+
+ThreadPool::ThreadPool( const size_t threads )
+{
+  for ( size_t i = 0; i < threads; i++ ) {
+    workers_.emplace_back( [this]() { work(); } );
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    unique_lock<mutex> lock { mutex_ };
+    shutting_down_ = true;
+  }
+
+  work_available_.notify_all();
+
+  for ( auto & worker : workers_ ) {
+    worker.join();
+  }
+}
+
+ThreadPool & ThreadPool::shared( void )
+{
+  /* the calling thread takes part too */
+  static ThreadPool pool { max( 1u, thread::hardware_concurrency() ) - 1 };
+  return pool;
+}
+
+bool ThreadPool::run_one( unique_lock<mutex> & lock, const void * batch )
+{
+  auto it = queue_.begin();
+
+  if ( batch ) {
+    while ( it != queue_.end() and it->batch != batch ) {
+      ++it;
+    }
+  }
+
+  if ( it == queue_.end() ) {
+    return false;
+  }
+
+  function<void()> task = move( it->run );
+  queue_.erase( it );
+
+  lock.unlock();
+  task();
+  lock.lock();
+
+  return true;
+}
+
+void ThreadPool::work( void )
+{
+  unique_lock<mutex> lock { mutex_ };
+
+  while ( true ) {
+    work_available_.wait( lock, [this]() { return shutting_down_ or not queue_.empty(); } );
+
+    if ( queue_.empty() ) {
+      return;
+    }
+
+    run_one( lock );
+  }
+}
+
+void ThreadPool::parallel_for( const size_t count, const function<void( size_t )> & f )
+{
+  if ( count == 0 ) {
+    return;
+  }
+
+  size_t remaining = count;
+  exception_ptr error;
+
+  unique_lock<mutex> lock { mutex_ };
+
+  /* unique among the batches in flight */
+  const void * const batch = &remaining;
+
+  for ( size_t i = 0; i < count; i++ ) {
+    queue_.push_back( { batch, [this, i, &f, &remaining, &error]()
+      {
+        exception_ptr task_error;
+
+        try {
+          f( i );
+        }
+        catch ( ... ) {
+          task_error = current_exception();
+        }
+
+        unique_lock<mutex> task_lock { mutex_ };
+
+        if ( task_error and not error ) {
+          error = task_error;
+        }
+
+        if ( --remaining == 0 ) {
+          work_done_.notify_all();
+        }
+      } } );
+  }
+
+  work_available_.notify_all();
+
+  /* help out with this batch rather than sit idle; the rest of the queue
+     may belong to a caller on another thread that is in no hurry */
+  while ( remaining > 0 ) {
+    if ( not run_one( lock, batch ) ) {
+      work_done_.wait( lock );
+    }
+  }
+
+  if ( error ) {
+    rethrow_exception( error );
+  }
+}
@@ -0,0 +1,58 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef THREAD_POOL_HH
+#define THREAD_POOL_HH
+
+/* fixed set of worker threads for fork-join parallelism; a thread waiting
+   for its work runs its own queued tasks itself, so callers can nest, and
+   never picks up another caller's (which could take far longer) */
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+class ThreadPool
+{
+private:
+  std::mutex mutex_ {};
+  std::condition_variable work_available_ {};
+  std::condition_variable work_done_ {};
+
+  struct Task
+  {
+    const void * batch;
+    std::function<void()> run;
+  };
+
+  std::deque<Task> queue_ {};
+  bool shutting_down_ { false };
+
+  std::vector<std::thread> workers_ {};
+
+  /* pops and runs one task, with the lock released meanwhile: the first
+     queued, or the first of `batch`; false if there was none */
+  bool run_one( std::unique_lock<std::mutex> & lock, const void * batch = nullptr );
+  void work( void );
+
+public:
+  explicit ThreadPool( const size_t threads );
+  ~ThreadPool();
+
+  /* ban copying */
+  ThreadPool( const ThreadPool & other ) = delete;
+  ThreadPool & operator=( const ThreadPool & other ) = delete;
+
+  /* runs f( 0 ) ... f( count - 1 ), in parallel, and returns once all of
+     them are done; the first exception thrown by any of them is rethrown */
+  void parallel_for( const size_t count, const std::function<void( size_t )> & f );
+
+  size_t size( void ) const { return workers_.size(); }
+
+  /* one worker per core, shared by the whole process */
+  static ThreadPool & shared( void );
+};
+
+#endif /* THREAD_POOL_HH */
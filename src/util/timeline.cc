@@ -0,0 +1,322 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "timeline.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+/* Written by the thread that holds it, and read by write() at any time:
+   a span is published by the release store of its block's count, and a
+   block by the release store of the link to it. */
+class Timeline::Buffer
+{
+private:
+  struct Block
+  {
+    array<Span, BLOCK_SPANS> spans {};
+    atomic<size_t> used { 0 };
+    atomic<Block *> next { nullptr };
+  };
+
+  Block head_ {};
+  Block * tail_ { &head_ };
+
+public:
+  const size_t row;
+
+  /* held by a thread; handed over by a release store and a CAS */
+  atomic<bool> in_use { true };
+
+  /* guarded by the timeline's mutex */
+  string name {};
+
+  explicit Buffer( const size_t row_number ) : row( row_number ) {}
+
+  ~Buffer()
+  {
+    Block * block = head_.next.load();
+
+    while ( block ) {
+      Block * const next = block->next.load();
+      delete block;
+      block = next;
+    }
+  }
+
+  /* ban copying */
+  Buffer( const Buffer & other ) = delete;
+  Buffer & operator=( const Buffer & other ) = delete;
+
+  void append( const Span & span )
+  {
+    size_t used = tail_->used.load( memory_order_relaxed );
+
+    if ( used == BLOCK_SPANS ) {
+      Block * const block = new Block;
+      tail_->next.store( block, memory_order_release );
+      tail_ = block;
+      used = 0;
+    }
+
+    tail_->spans[ used ] = span;
+    tail_->used.store( used + 1, memory_order_release );
+  }
+
+  template <class F>
+  void for_each( const F & f ) const
+  {
+    for ( const Block * block = &head_; block; block = block->next.load( memory_order_acquire ) ) {
+      const size_t used = block->used.load( memory_order_acquire );
+
+      for ( size_t i = 0; i < used; i++ ) {
+        f( block->spans[ i ] );
+      }
+    }
+  }
+};
+
+namespace {
+
+atomic<uint64_t> next_serial { 1 };
+
+unique_ptr<Timeline> active_timeline;
+atomic<Timeline *> active_pointer { nullptr };
+
+/* the calling thread's buffer, given back when the thread exits */
+struct ThreadSlot
+{
+  uint64_t serial { 0 };
+  shared_ptr<Timeline::Buffer> buffer {};
+
+  ~ThreadSlot()
+  {
+    if ( buffer ) {
+      buffer->in_use.store( false, memory_order_release );
+    }
+  }
+};
+
+thread_local ThreadSlot slot;
+
+void finish_at_exit( void )
+{
+  try {
+    Timeline::finish();
+  }
+  catch ( const exception & e ) {
+    cerr << "timeline: " << e.what() << endl;
+  }
+}
+
+}
+
+Timeline::Timeline( const string & filename )
+  : filename_( filename ), start_( Clock::now() ),
+    serial_( next_serial.fetch_add( 1 ) )
+{}
+
+Timeline::~Timeline()
+{}
+
+Timeline * Timeline::active( void )
+{
+  return active_pointer.load( memory_order_acquire );
+}
+
+void Timeline::activate( const string & filename )
+{
+  if ( active_timeline ) {
+    throw runtime_error( "Timeline: already active" );
+  }
+
+  static bool registered = false;
+  if ( not registered ) {
+    atexit( finish_at_exit );
+    registered = true;
+  }
+
+  active_timeline.reset( new Timeline( filename ) );
+  active_pointer.store( active_timeline.get(), memory_order_release );
+  active_timeline->name_thread( "main" );
+}
+
+void Timeline::finish( void )
+{
+  if ( not active_timeline ) {
+    return;
+  }
+
+  active_pointer.store( nullptr, memory_order_release );
+  const unique_ptr<Timeline> timeline = move( active_timeline );
+
+  ofstream out { timeline->filename_ };
+  timeline->write( out );
+  out.close();
+
+  if ( not out ) {
+    throw runtime_error( "Timeline: could not write " + timeline->filename_ );
+  }
+}
+
+int64_t Timeline::now( void ) const
+{
+  return duration_cast<nanoseconds>( Clock::now() - start_ ).count();
+}
+
+Timeline::Buffer & Timeline::buffer( void )
+{
+  if ( slot.serial == serial_ ) {
+    return *slot.buffer;
+  }
+
+  lock_guard<mutex> lock { mutex_ };
+
+  if ( slot.buffer ) {
+    slot.buffer->in_use.store( false, memory_order_release );
+    slot.buffer.reset();
+  }
+
+  /* take over the row of a thread that has exited, if there is one */
+  for ( const auto & buffer : buffers_ ) {
+    bool expected = false;
+    if ( buffer->in_use.compare_exchange_strong( expected, true, memory_order_acq_rel ) ) {
+      slot.buffer = buffer;
+      break;
+    }
+  }
+
+  if ( not slot.buffer ) {
+    buffers_.push_back( make_shared<Buffer>( buffers_.size() ) );
+    slot.buffer = buffers_.back();
+  }
+
+  slot.serial = serial_;
+  return *slot.buffer;
+}
+
+void Timeline::record( const Span & span )
+{
+  buffer().append( span );
+}
+
+void Timeline::name_thread( const char * name )
+{
+  Buffer & own = buffer();
+
+  lock_guard<mutex> lock { mutex_ };
+  own.name = name;
+}
+
+void Timeline::write( ostream & out ) const
+{
+  lock_guard<mutex> lock { mutex_ };
+
+  const pid_t pid = getpid();
+  const char * separator = "\n";
+
+  out << "{\"traceEvents\":[" << fixed << setprecision( 3 );
+
+  for ( const auto & buffer : buffers_ ) {
+    const string name = buffer->name.empty() ? "thread " + to_string( buffer->row ) : buffer->name;
+
+    out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+        << ",\"tid\":" << buffer->row << ",\"args\":{\"name\":\"" << name << "\"}}";
+    separator = ",\n";
+
+    /* rows in the order threads started recording */
+    out << separator << "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":" << pid
+        << ",\"tid\":" << buffer->row << ",\"args\":{\"sort_index\":" << buffer->row << "}}";
+
+    buffer->for_each( [&]( const Span & span )
+      {
+        /* complete events, in microseconds */
+        out << separator << "{\"name\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":" << pid
+            << ",\"tid\":" << buffer->row
+            << ",\"ts\":" << span.start_ns / 1000.0
+            << ",\"dur\":" << ( span.end_ns - span.start_ns ) / 1000.0;
+
+        if ( span.arg_count ) {
+          out << ",\"args\":{";
+
+          for ( size_t i = 0; i < span.arg_count; i++ ) {
+            out << ( i ? "," : "" ) << "\"" << span.args[ i ].name << "\":" << span.args[ i ].value;
+          }
+
+          out << "}";
+        }
+
+        out << "}";
+      } );
+  }
+
+  out << "\n],\"displayTimeUnit\":\"ms\"}" << endl;
+}
+
+TimelineSpan::TimelineSpan( const char * name )
+  : timeline_( Timeline::active() )
+{
+  if ( timeline_ ) {
+    span_.name = name;
+    span_.start_ns = timeline_->now();
+  }
+}
+
+TimelineSpan & TimelineSpan::arg( const char * name, const int64_t value )
+{
+  if ( timeline_ and span_.arg_count < Timeline::MAX_ARGS ) {
+    span_.args[ span_.arg_count++ ] = { name, value };
+  }
+
+  return *this;
+}
+
+void TimelineSpan::end( void )
+{
+  if ( timeline_ and span_.name ) {
+    span_.end_ns = timeline_->now();
+    timeline_->record( span_ );
+    span_.name = nullptr;
+  }
+}
+
+TimelineStages::TimelineStages( const vector<const char *> & names )
+  : timeline_( Timeline::active() ), names_( names )
+{
+  restart();
+}
+
+void TimelineStages::restart( void )
+{
+  if ( timeline_ ) {
+    last_ns_ = timeline_->now();
+  }
+}
+
+void TimelineStages::mark( const size_t stage, const initializer_list<TimelineArg> & args )
+{
+  if ( not timeline_ ) {
+    return;
+  }
+
+  Timeline::Span span;
+  span.name = names_.at( stage );
+  span.start_ns = last_ns_;
+  span.end_ns = timeline_->now();
+
+  for ( const TimelineArg & arg : args ) {
+    if ( span.arg_count < Timeline::MAX_ARGS ) {
+      span.args[ span.arg_count++ ] = arg;
+    }
+  }
+
+  timeline_->record( span );
+  last_ns_ = span.end_ns;
+}
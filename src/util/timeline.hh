@@ -0,0 +1,139 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef TIMELINE_HH
+#define TIMELINE_HH
+
+/* Records what every thread spends its time on, as spans with a few
+   integer arguments, and writes them out at exit in the Chrome trace event
+   format (JSON), which chrome://tracing and ui.perfetto.dev lay out on a
+   timeline with a row per thread. Nothing is recorded until activate();
+   from then on a span costs two clock reads and an append to the calling
+   thread's own buffer, without locks (or allocation, but for a new block
+   every BLOCK_SPANS spans).
+
+   Rows are buffers rather than threads: a thread that exits hands its
+   buffer over to the next thread that records, so short-lived threads
+   (like the receiver's speculations) share rows instead of getting one
+   each. Span and argument names are only looked at when the file is
+   written, and have to be string literals. */
+
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <initializer_list>
+
+struct TimelineArg
+{
+  const char * name;
+  int64_t value;
+};
+
+class Timeline
+{
+public:
+  static constexpr size_t MAX_ARGS = 4;
+  static constexpr size_t BLOCK_SPANS = 1024;
+
+  struct Span
+  {
+    const char * name { nullptr };
+    int64_t start_ns { 0 };
+    int64_t end_ns { 0 };
+    std::array<TimelineArg, MAX_ARGS> args {};
+    size_t arg_count { 0 };
+  };
+
+  /* one thread's spans at a time (defined in timeline.cc) */
+  class Buffer;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  const std::string filename_;
+  const Clock::time_point start_;
+
+  /* tells a thread's buffer from one it had under an earlier timeline */
+  const uint64_t serial_;
+
+  mutable std::mutex mutex_ {};
+  std::vector<std::shared_ptr<Buffer>> buffers_ {};
+
+  /* the calling thread's */
+  Buffer & buffer( void );
+
+public:
+  explicit Timeline( const std::string & filename );
+  ~Timeline();
+
+  /* ban copying */
+  Timeline( const Timeline & other ) = delete;
+  Timeline & operator=( const Timeline & other ) = delete;
+
+  /* the timeline spans go to, if one was activated */
+  static Timeline * active( void );
+
+  /* start recording, as row "main" for the calling thread, and write
+     `filename` at exit (or at finish(), once no thread records anymore) */
+  static void activate( const std::string & filename );
+  static void finish( void );
+
+  /* nanoseconds since the timeline started */
+  int64_t now( void ) const;
+
+  void record( const Span & span );
+
+  /* label the calling thread's row */
+  void name_thread( const char * name );
+
+  void write( std::ostream & out ) const;
+};
+
+/* a span from construction to end() (or destruction), if a timeline is active */
+class TimelineSpan
+{
+private:
+  Timeline * const timeline_;
+  Timeline::Span span_ {};
+
+public:
+  explicit TimelineSpan( const char * name );
+  ~TimelineSpan() { end(); }
+
+  /* ban copying */
+  TimelineSpan( const TimelineSpan & other ) = delete;
+  TimelineSpan & operator=( const TimelineSpan & other ) = delete;
+
+  /* arguments past MAX_ARGS are dropped */
+  TimelineSpan & arg( const char * name, const int64_t value );
+
+  void end( void );
+};
+
+/* the stages of a loop on one thread, each recorded as a span when it is
+   mark()ed done (like AllocationProfile in alloc_counter.hh) */
+class TimelineStages
+{
+private:
+  Timeline * const timeline_;
+  const std::vector<const char *> names_;
+  int64_t last_ns_ { 0 };
+
+public:
+  explicit TimelineStages( const std::vector<const char *> & names );
+
+  /* ban copying */
+  TimelineStages( const TimelineStages & other ) = delete;
+  TimelineStages & operator=( const TimelineStages & other ) = delete;
+
+  /* the time since the last mark() belongs to no stage */
+  void restart( void );
+
+  void mark( const size_t stage, const std::initializer_list<TimelineArg> & args );
+};
+
+#endif /* TIMELINE_HH */